@@ -0,0 +1,192 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "protocol.h"
+#include "types.h"
+
+/**
+ * Measures the cost of parsing a read buffer of pipelined requests, the way
+ * event loops do it, against the previous byte at a time parser.
+ */
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+enum {
+  REQ_COUNT = 128,
+  ROUNDS = 1000,
+  TRIALS = 200,
+  ARGS_MAX = 8,
+  NSEC_PER_SEC = 1000000000,
+};
+
+static void append_req(struct buffer *buf, uint32_t argc, const char **args) {
+  // Requests are written like replies
+  struct reply_out out = make_reply_out(buf, PROTO_RESP2);
+  write_array_header(out, argc);
+  for (uint32_t i = 0; i < argc; i++) {
+    write_str_value(out, make_str_slice(args[i]));
+  }
+}
+
+/** A typical mix of small pipelined requests */
+static void build_input(struct buffer *buf) {
+  char key[32];
+  char value[256];
+  for (uint32_t i = 0; i < REQ_COUNT; i++) {
+    snprintf(key, sizeof(key), "user:%u:profile", i * 7919);
+    size_t value_size = 1 + (i * 37) % (sizeof(value) - 1);
+    memset(value, 'v', value_size);
+    value[value_size] = '\0';
+
+    switch (i % 4) {
+      case 0:
+        append_req(buf, 3, (const char *[]){"SET", key, value});
+        break;
+      case 1:
+        append_req(buf, 4, (const char *[]){"HSET", key, "field", value});
+        break;
+      default:
+        append_req(buf, 2, (const char *[]){"GET", key});
+        break;
+    }
+  }
+}
+
+/**
+ * The size parser from before the end of sizes was found with a vector
+ * compare, for reference. Not inlined, like the real parser which lives in
+ * another translation unit.
+ */
+__attribute__((noinline)) static ssize_t parse_size_bytewise(
+    enum resp_type type, uint64_t *size, struct const_slice buffer) {
+  if (buffer.size < 1) {
+    return PARSE_MORE;
+  }
+  if (const_slice_get(buffer, 0) != type) {
+    return PARSE_ERR;
+  }
+
+  *size = 0;
+  for (size_t i = 1; i < buffer.size; i++) {
+    uint8_t byte = const_slice_get(buffer, i);
+    if (isdigit(byte)) {
+      *size = *size * 10 + byte - '0';
+    } else if (byte == '\r') {
+      i++;
+      if (i >= buffer.size) {
+        return PARSE_MORE;
+      }
+      if (const_slice_get(buffer, i) != '\n') {
+        return PARSE_ERR;
+      }
+      return (ssize_t)i + 1;
+    } else {
+      return PARSE_ERR;
+    }
+  }
+  return PARSE_MORE;
+}
+
+__attribute__((noinline)) static ssize_t parse_blob_str_bytewise(
+    struct const_slice *str, struct const_slice buffer) {
+  uint64_t size;
+  ssize_t res = parse_size_bytewise(RESP_BLOB_STR, &size, buffer);
+  if (res < 0) {
+    return res;
+  }
+  const_slice_advance(&buffer, res);
+  if (buffer.size < size + 2) {
+    return PARSE_MORE;
+  }
+  *str = make_const_slice(buffer.data, size);
+  ssize_t end_res = parse_blob_str_end(make_const_slice(
+      (const uint8_t *)buffer.data + size, buffer.size - size));
+  if (end_res < 0) {
+    return end_res;
+  }
+  return res + (ssize_t)size + end_res;
+}
+
+/** Parse all the requests, returning a checksum of the arguments */
+static uint64_t parse_all(struct const_slice input, bool bytewise) {
+  struct const_slice args[ARGS_MAX];
+  uint64_t checksum = 0;
+  while (input.size > 0) {
+    uint64_t arg_count;
+    ssize_t res;
+    if (bytewise) {
+      res = parse_size_bytewise(RESP_ARRAY, &arg_count, input);
+    } else {
+      uint32_t size;
+      res = parse_array_header(&size, input);
+      arg_count = size;
+    }
+    assert(res > 0 && arg_count <= ARGS_MAX);
+    const_slice_advance(&input, res);
+
+    for (uint32_t i = 0; i < arg_count; i++) {
+      res = bytewise ? parse_blob_str_bytewise(&args[i], input)
+                     : parse_blob_str(&args[i], input);
+      assert(res > 0);
+      const_slice_advance(&input, res);
+      checksum += args[i].size;
+    }
+  }
+  return checksum;
+}
+
+static uint64_t get_nsec(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+static void run(const char *name, struct const_slice input, bool bytewise) {
+  // Warm up
+  uint64_t expected = parse_all(input, bytewise);
+
+  // The fastest trial is the one least disturbed by anything else running
+  uint64_t best = UINT64_MAX;
+  for (int trial = 0; trial < TRIALS; trial++) {
+    uint64_t start = get_nsec();
+    for (int round = 0; round < ROUNDS; round++) {
+      uint64_t checksum = parse_all(input, bytewise);
+      if (checksum != expected) {
+        abort();
+      }
+    }
+    uint64_t elapsed = get_nsec() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf(
+      "%-10s %6.1f ns/request\n", name,
+      (double)best / ((double)ROUNDS * REQ_COUNT));
+}
+
+int main(void) {
+  struct buffer buf;
+  buffer_init(&buf, 4096);
+  build_input(&buf);
+  struct const_slice input = make_const_slice(buf.data, buf.size);
+  printf("%u pipelined requests, %u bytes\n", REQ_COUNT, buf.size);
+
+  // Alternate to spread out any disturbance
+  for (int i = 0; i < 2; i++) {
+    run("bytewise", input, true);
+    run("current", input, false);
+  }
+
+  buffer_destroy(&buf);
+  return 0;
+}
+
+// NOLINTEND(readability-magic-numbers)
@@ -0,0 +1,88 @@
+#include "buf_pool.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "buffer.h"
+#include "list.h"
+#include "types.h"
+
+void buf_pool_init(struct buf_pool *pool) {
+  for (unsigned i = 0; i < BUF_POOL_CLASSES; i++) {
+    list_init(&pool->free[i]);
+    pool->free_count[i] = 0;
+  }
+}
+
+void buf_pool_destroy(struct buf_pool *pool) {
+  for (unsigned i = 0; i < BUF_POOL_CLASSES; i++) {
+    struct list_node *node;
+    while ((node = list_pop(&pool->free[i])) != NULL) {
+      free(node);
+    }
+    pool->free_count[i] = 0;
+  }
+}
+
+static uint32_t class_size(unsigned size_class) {
+  return (uint32_t)BUF_POOL_MIN_SIZE << size_class;
+}
+
+/** Smallest class which fits `size`, or `BUF_POOL_CLASSES` if none does */
+static unsigned size_class_fitting(uint32_t size) {
+  unsigned size_class = 0;
+  while (size_class < BUF_POOL_CLASSES && class_size(size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+void buf_pool_acquire(
+    struct buf_pool *pool, struct buffer *buf, uint32_t min_cap) {
+  assert(buf->data == NULL);
+  buf->size = 0;
+
+  unsigned size_class = size_class_fitting(min_cap);
+  if (size_class == BUF_POOL_CLASSES) {
+    buf->cap = min_cap;
+    buf->data = malloc(min_cap);
+    assert(buf->data != NULL);
+    return;
+  }
+
+  buf->cap = class_size(size_class);
+  struct list_node *node = list_pop(&pool->free[size_class]);
+  if (node != NULL) {
+    pool->free_count[size_class]--;
+    buf->data = node;
+    return;
+  }
+
+  buf->data = malloc(buf->cap);
+  assert(buf->data != NULL);
+}
+
+void buf_pool_release(struct buf_pool *pool, struct buffer *buf) {
+  if (buf->data == NULL) {
+    return;
+  }
+
+  unsigned size_class = size_class_fitting(buf->cap);
+  bool pooled = size_class < BUF_POOL_CLASSES &&
+                class_size(size_class) == buf->cap &&
+                (pool->free_count[size_class] + 1) * buf->cap <=
+                    BUF_POOL_CLASS_MAX_FREE;
+  if (pooled) {
+    // The free-list node is kept in the unused allocation itself
+    list_push(&pool->free[size_class], buf->data);
+    pool->free_count[size_class]++;
+  } else {
+    free(buf->data);
+  }
+
+  buf->size = 0;
+  buf->cap = 0;
+  buf->data = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef BUF_POOL_H_
+#define BUF_POOL_H_
+
+#include <stdint.h>
+
+#include "buffer.h"
+#include "list.h"
+
+enum {
+  BUF_POOL_MIN_SIZE = 4096,
+  // Power of 2 sizes from the minimum size up to 64 KiB
+  BUF_POOL_CLASSES = 5,
+  BUF_POOL_MAX_SIZE = BUF_POOL_MIN_SIZE << (BUF_POOL_CLASSES - 1),
+  // Memory kept for each size class while it's not in use
+  BUF_POOL_CLASS_MAX_FREE = 1024 * 1024,
+};
+
+/**
+ * Free-lists of buffer allocations in a few size classes.
+ *
+ * Not thread-safe, each event loop has its own.
+ */
+struct buf_pool {
+  struct list free[BUF_POOL_CLASSES];
+  uint32_t free_count[BUF_POOL_CLASSES];
+};
+
+void buf_pool_init(struct buf_pool *pool);
+void buf_pool_destroy(struct buf_pool *pool);
+
+/**
+ * Give the unallocated buffer an allocation of at least `min_cap`.
+ *
+ * Buffers which are grown by doubling their capacity stay within the size
+ * classes, so they can be returned to the pool as well.
+ */
+void buf_pool_acquire(
+    struct buf_pool *pool, struct buffer *buf, uint32_t min_cap);
+
+/**
+ * Return the buffer's allocation to the pool, leaving it unallocated.
+ *
+ * Allocations larger than any size class are freed, so buffers which grew for
+ * a single large message shrink again.
+ */
+void buf_pool_release(struct buf_pool *pool, struct buffer *buf);
+
+#endif
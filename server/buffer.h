@@ -86,6 +86,14 @@ static inline void offset_buf_init(struct offset_buf *buf, uint32_t init_cap) {
   buffer_init(&buf->buf, init_cap);
 }
 
+/** Without an allocation, which has to be given one before use */
+static inline void offset_buf_init_unallocated(struct offset_buf *buf) {
+  buf->start = 0;
+  buf->buf.size = 0;
+  buf->buf.cap = 0;
+  buf->buf.data = NULL;
+}
+
 static inline void offset_buf_destroy(struct offset_buf *buf) {
   buffer_destroy(&buf->buf);
 }
@@ -100,7 +108,7 @@ static inline const void *offset_buf_head(struct offset_buf *buf) {
 /**
  * Size of the data currently available.
  */
-static inline size_t offset_buf_remaining(struct offset_buf *buf) {
+static inline size_t offset_buf_remaining(const struct offset_buf *buf) {
   return buf->buf.size - buf->start;
 }
 
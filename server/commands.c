@@ -5,20 +5,24 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <time.h>
 
 #include "buffer.h"
-#include "hashmap.h"
 #include "object.h"
 #include "protocol.h"
 #include "queue.h"
+#include "reply.h"
 #include "store.h"
 #include "types.h"
 
 enum {
   // Allocation complexity required before async deletion
   ASYNC_DELETE_COMPLEXITY = 1000,
+  // Commands with many keys prefetch the slots of keys this far ahead, so
+  // they're in the cache by the time they're looked up
+  KEY_PREFETCH_DISTANCE = 4,
 };
 
 uint64_t get_monotonic_usec(void) {
@@ -52,52 +56,174 @@ void store_entry_free_maybe_async(
   }
 }
 
+/** Get an owned copy of an argument, which can be kept after the command */
+static string take_arg(struct command_ctx ctx, uint32_t index) {
+  // Small strings are copied either way
+  if (index < ctx.owned_count && !ctx.owned_args[index].is_small) {
+    return string_move(&ctx.owned_args[index]);
+  }
+  return string_dup_slice(ctx.args[index]);
+}
+
+/** The argument at `index` as a key, which is hashed at most once */
+static struct store_key command_key(struct command_ctx ctx, uint32_t index) {
+  if (ctx.key_hashes != NULL) {
+    return make_hashed_store_key(ctx.args[index], ctx.key_hashes[index]);
+  }
+  return make_store_key(ctx.args[index]);
+}
+
+/**
+ * Keys of a command with many of them, every `step`th argument, which are
+ * hashed and prefetched `KEY_PREFETCH_DISTANCE` keys ahead of their lookup.
+ */
+struct key_ring {
+  struct store_key keys[KEY_PREFETCH_DISTANCE];
+  uint32_t step;
+};
+
+static struct store_key *key_ring_entry(struct key_ring *ring, uint32_t index) {
+  return &ring->keys[(index - 1) / ring->step % KEY_PREFETCH_DISTANCE];
+}
+
+/** Prefetch the key at `index`, if the request has that many arguments */
+static void key_ring_prefetch(
+    struct command_ctx ctx, struct key_ring *ring, uint32_t index) {
+  if (index < ctx.arg_count) {
+    struct store_key *key = key_ring_entry(ring, index);
+    *key = command_key(ctx, index);
+    store_prefetch(ctx.store, *key);
+  }
+}
+
+static void key_ring_init(
+    struct command_ctx ctx, struct key_ring *ring, uint32_t step) {
+  ring->step = step;
+  for (uint32_t i = 0; i < KEY_PREFETCH_DISTANCE; i++) {
+    key_ring_prefetch(ctx, ring, 1 + i * step);
+  }
+}
+
+/** Take the key at `index`, which must be the next one */
+static struct store_key key_ring_next(
+    struct command_ctx ctx, struct key_ring *ring, uint32_t index) {
+  struct store_key key = *key_ring_entry(ring, index);
+  key_ring_prefetch(ctx, ring, index + KEY_PREFETCH_DISTANCE * ring->step);
+  return key;
+}
+
 static void do_get(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (found->type != OBJ_STR) {
-    write_simple_err_value(ctx.out_buf, "not string value");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_STR);
     return;
   }
 
-  write_str_value(ctx.out_buf, string_const_slice(&found->str_val));
+  write_stored_str_value(ctx.out, ctx.out_refs, &found->str_val);
+}
+
+static void do_mget(struct command_ctx ctx) {
+  write_array_header(ctx.out, ctx.arg_count - 1);
+  struct key_ring keys;
+  key_ring_init(ctx, &keys, 1);
+  for (uint32_t i = 1; i < ctx.arg_count; i++) {
+    struct object *found = store_get(ctx.store, key_ring_next(ctx, &keys, i));
+    // Other types don't fail the whole command, they're just not strings
+    if (found == NULL || found->type != OBJ_STR) {
+      write_null_value(ctx.out);
+    } else {
+      write_stored_str_value(ctx.out, ctx.out_refs, &found->str_val);
+    }
+  }
 }
 
 static void do_set(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
-  store_set(ctx.store, key, make_string_object(string_move(&ctx.args[2])));
-  write_simple_str_value(ctx.out_buf, "OK");
+  struct store_key key = command_key(ctx, 1);
+  store_set(ctx.store, key, make_string_object(take_arg(ctx, 2)));
+  write_shared_reply(ctx.out, SHARED_OK);
 }
 
-static void do_del(struct command_ctx ctx) {
-  struct store_entry *removed =
-      store_detach(ctx.store, string_const_slice(&ctx.args[1]));
+static void do_mset(struct command_ctx ctx) {
+  struct key_ring keys;
+  key_ring_init(ctx, &keys, 2);
+  for (uint32_t i = 1; i < ctx.arg_count; i += 2) {
+    store_set(
+        ctx.store, key_ring_next(ctx, &keys, i),
+        make_string_object(take_arg(ctx, i + 1)));
+  }
+  write_shared_reply(ctx.out, SHARED_OK);
+}
+
+/** Returns `true` if the key existed */
+static bool del_key(struct command_ctx ctx, struct store_key key) {
+  struct store_entry *removed = store_detach(ctx.store, key);
   if (removed == NULL) {
-    write_int_value(ctx.out_buf, 0);
-    return;
+    return false;
   }
 
   store_entry_free_maybe_async(ctx.async_task_queue, removed);
-  write_int_value(ctx.out_buf, 1);
+  return true;
+}
+
+static void do_del(struct command_ctx ctx) {
+  int_val_t deleted = 0;
+  struct key_ring keys;
+  key_ring_init(ctx, &keys, 1);
+  for (uint32_t i = 1; i < ctx.arg_count; i++) {
+    deleted += del_key(ctx, key_ring_next(ctx, &keys, i));
+  }
+  write_int_value(ctx.out, deleted);
 }
 
 static bool do_keys_append_key_to_value(
     struct const_slice key, struct object *val, void *arg) {
   (void)val;
-  struct buffer *out_buf = arg;
-  write_str_value(out_buf, key);
+  struct reply_out *out = arg;
+  write_str_value(*out, key);
   return true;
 }
 
+/** Whether arrays can be written before knowing how many elements they have */
+static bool can_stream(struct command_ctx ctx) {
+  return ctx.out.proto != PROTO_RESP2;
+}
+
+static void do_hello(struct command_ctx ctx) {
+  // The version is text even when switching away from the binary protocol
+  int_val_t version;
+  if (slice_eq_upper(ctx.args[1], make_str_slice("BINARY"))) {
+    version = PROTO_BINARY;
+  } else if (
+      !parse_int_arg(&version, PROTO_RESP2, ctx.args[1]) ||
+      (version != PROTO_RESP2 && version != PROTO_RESP3)) {
+    write_shared_reply(ctx.out, SHARED_ERR_PROTO);
+    return;
+  }
+
+  // Replies are in the new protocol, starting with this one
+  *ctx.conn_proto = (enum proto_version)version;
+  struct reply_out out = make_reply_out(ctx.out.buf, *ctx.conn_proto);
+  write_array_header(out, 2);
+  write_str_value(out, make_str_slice("proto"));
+  write_int_value(out, version);
+}
+
 static void do_keys(struct command_ctx ctx) {
-  write_array_header(ctx.out_buf, store_size(ctx.store));
+  if (can_stream(ctx)) {
+    write_array_stream_start(ctx.out);
+    store_iter(ctx.store, do_keys_append_key_to_value, &ctx.out);
+    write_stream_end(ctx.out);
+    return;
+  }
 
-  store_iter(ctx.store, do_keys_append_key_to_value, ctx.out_buf);
+  write_array_header(ctx.out, store_size(ctx.store));
+  store_iter(ctx.store, do_keys_append_key_to_value, &ctx.out);
 }
 
 static const char *object_type_name(enum obj_type type) {
@@ -116,14 +242,14 @@ static const char *object_type_name(enum obj_type type) {
 }
 
 static void do_type(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_simple_str_value(ctx.out_buf, "none");
+    write_simple_str_value(ctx.out, "none");
     return;
   }
 
-  write_simple_str_value(ctx.out_buf, object_type_name(found->type));
+  write_simple_str_value(ctx.out, object_type_name(found->type));
 }
 
 enum {
@@ -132,484 +258,515 @@ enum {
 };
 
 static void do_ttl(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, TTL_NOT_FOUND);
+    write_int_value(ctx.out, TTL_NOT_FOUND);
     return;
   }
 
   int64_t expires_at_us = store_object_get_expire(ctx.store, found);
   if (expires_at_us < 0) {
-    write_int_value(ctx.out_buf, TTL_NO_EXPIRE);
+    write_int_value(ctx.out, TTL_NO_EXPIRE);
     return;
   }
 
   uint64_t now = get_monotonic_usec();
   uint64_t ttl =
       (uint64_t)expires_at_us > now ? (expires_at_us - now) / USEC_PER_SEC : 0;
-  write_int_value(ctx.out_buf, (int_val_t)ttl);
+  write_int_value(ctx.out, (int_val_t)ttl);
 }
 
 static void do_expire(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   int_val_t ttl_sec;
-  if (!parse_int_arg(&ttl_sec, string_const_slice(&ctx.args[2]))) {
-    write_simple_err_value(ctx.out_buf, "invalid ttl");
+  if (!parse_int_arg(&ttl_sec, ctx.out.proto, ctx.args[2])) {
+    write_shared_reply(ctx.out, SHARED_ERR_TTL);
     return;
   }
 
   if (ttl_sec <= 0) {
-    // Delegate to the DEL since it might decide to perform async deletion
-    // DEL just uses the first argument, so the context can be passed as-is
-    do_del(ctx);
+    // Deleted like DEL, which might decide to perform async deletion
+    write_int_value(ctx.out, del_key(ctx, key) ? 1 : 0);
     return;
   }
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   uint64_t expires_at_us = get_monotonic_usec() + ttl_sec * USEC_PER_SEC;
   store_object_set_expire(ctx.store, found, (int64_t)expires_at_us);
-  write_int_value(ctx.out_buf, 1);
+  write_int_value(ctx.out, 1);
 }
 
 static void do_persist(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (store_object_get_expire(ctx.store, found) == -1) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
   } else {
     store_object_set_expire(ctx.store, found, -1);
-    write_int_value(ctx.out_buf, 1);
+    write_int_value(ctx.out, 1);
   }
 }
 
 static void do_hget(struct command_ctx ctx) {
-  struct object *outer = store_get(ctx.store, string_const_slice(&ctx.args[1]));
+  struct object *outer = store_get(ctx.store, command_key(ctx, 1));
   if (outer == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (outer->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
   struct const_slice value;
-  if (!hmap_get(outer, string_const_slice(&ctx.args[2]), &value)) {
-    write_null_value(ctx.out_buf);
+  if (!hmap_get(outer, ctx.args[2], &value)) {
+    write_null_value(ctx.out);
     return;
   }
 
-  write_str_value(ctx.out_buf, value);
+  write_str_value(ctx.out, value);
 }
 
-static void do_hset(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
-
-  struct const_slice field = string_const_slice(&ctx.args[2]);
+static void do_hmget(struct command_ctx ctx) {
+  struct object *outer = store_get(ctx.store, command_key(ctx, 1));
+  if (outer != NULL && outer->type != OBJ_HMAP) {
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
+    return;
+  }
 
-  struct object *outer = store_get(ctx.store, key);
-  if (outer == NULL) {
-    // Create new hmap
-    outer = store_set(ctx.store, key, make_hmap_object());
+  write_array_header(ctx.out, ctx.arg_count - 2);
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    struct const_slice value;
+    if (outer != NULL && hmap_get(outer, ctx.args[i], &value)) {
+      write_str_value(ctx.out, value);
+    } else {
+      write_null_value(ctx.out);
+    }
   }
+}
+
+static void do_hset(struct command_ctx ctx) {
+  struct store_key key = command_key(ctx, 1);
+
+  struct object *outer = store_get_or_insert(ctx.store, key, make_hmap_object);
 
   if (outer->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
-  hmap_set(outer, field, string_move(&ctx.args[3]));
-  write_int_value(ctx.out_buf, 1);
+  int_val_t added = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i += 2) {
+    added += hmap_set(outer, ctx.args[i], take_arg(ctx, i + 1));
+  }
+  write_int_value(ctx.out, added);
 }
 
 static void do_hdel(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
-
-  struct const_slice field = string_const_slice(&ctx.args[2]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *outer = store_get(ctx.store, key);
   if (outer == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (outer->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
-  bool deleted = hmap_del(outer, field);
-  write_int_value(ctx.out_buf, deleted ? 1 : 0);
+  int_val_t deleted = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    deleted += hmap_del(outer, ctx.args[i]);
+  }
+  write_int_value(ctx.out, deleted);
 }
 
 static void do_hlen(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
-  write_int_value(ctx.out_buf, hmap_size(found));
+  write_int_value(ctx.out, hmap_size(found));
 }
 
 static bool do_hkeys_append_key_to_value(
     // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
     struct const_slice key, struct const_slice val, void *arg) {
   (void)val;
-  struct buffer *out_buf = arg;
-  write_str_value(out_buf, key);
+  struct reply_out *out = arg;
+  write_str_value(*out, key);
   return true;
 }
 
 static void do_hkeys(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_array_header(ctx.out_buf, 0);
+    write_array_header(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
-  write_array_header(ctx.out_buf, hmap_size(found));
-  hmap_iter(found, do_hkeys_append_key_to_value, ctx.out_buf);
+  write_array_header(ctx.out, hmap_size(found));
+  hmap_iter(found, do_hkeys_append_key_to_value, &ctx.out);
 }
 
 static bool do_hgetall_append_key_val_to_value(
     struct const_slice key, struct const_slice val, void *arg) {
-  struct buffer *out_buf = arg;
-  write_str_value(out_buf, key);
-  write_str_value(out_buf, val);
+  struct reply_out *out = arg;
+  write_str_value(*out, key);
+  write_str_value(*out, val);
   return true;
 }
 
 static void do_hgetall(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_array_header(ctx.out_buf, 0);
+    write_array_header(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HMAP) {
-    write_simple_err_value(ctx.out_buf, "object not a hash map");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HMAP);
     return;
   }
 
-  write_array_header(ctx.out_buf, hmap_size(found) * 2);
-  hmap_iter(found, do_hgetall_append_key_val_to_value, ctx.out_buf);
+  write_array_header(ctx.out, hmap_size(found) * 2);
+  hmap_iter(found, do_hgetall_append_key_val_to_value, &ctx.out);
 }
 
 static void do_sadd(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
-  struct const_slice set_key = string_const_slice(&ctx.args[2]);
-
-  struct object *found = store_get(ctx.store, key);
-  if (found == NULL) {
-    found = store_set(ctx.store, key, make_hset_object());
-  }
+  struct object *found = store_get_or_insert(ctx.store, key, make_hset_object);
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
-  bool added = hset_add(found, set_key);
-  write_int_value(ctx.out_buf, added ? 1 : 0);
+  int_val_t added = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    added += hset_add(found, ctx.args[i]);
+  }
+  write_int_value(ctx.out, added);
 }
 
 static void do_sismember(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
-  struct const_slice set_key = string_const_slice(&ctx.args[2]);
+  struct const_slice set_key = ctx.args[2];
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
   bool contains = hset_contains(found, set_key);
-  write_int_value(ctx.out_buf, contains ? 1 : 0);
+  write_int_value(ctx.out, contains ? 1 : 0);
 }
 
-static void do_srem(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+static void do_smismember(struct command_ctx ctx) {
+  struct object *found = store_get(ctx.store, command_key(ctx, 1));
+  if (found != NULL && found->type != OBJ_HSET) {
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
+    return;
+  }
+
+  write_array_header(ctx.out, ctx.arg_count - 2);
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    bool contains = found != NULL && hset_contains(found, ctx.args[i]);
+    write_int_value(ctx.out, contains ? 1 : 0);
+  }
+}
 
-  struct const_slice set_key = string_const_slice(&ctx.args[2]);
+static void do_srem(struct command_ctx ctx) {
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
-  bool removed = hset_del(found, set_key);
-  write_int_value(ctx.out_buf, removed ? 1 : 0);
+  int_val_t removed = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    removed += hset_del(found, ctx.args[i]);
+  }
+  write_int_value(ctx.out, removed);
 }
 
 static void do_scard(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
-  write_int_value(ctx.out_buf, hset_size(found));
+  write_int_value(ctx.out, hset_size(found));
 }
 
 static void do_srandmember(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
   const struct hset_entry *member = hset_peek(found);
   if (member != NULL) {
-    write_str_value(ctx.out_buf, hset_entry_key(member));
+    write_str_value(ctx.out, hset_entry_key(member));
   } else {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
   }
 }
 
 static void do_spop(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
   struct hset_entry *member = hset_pop(found);
   if (member != NULL) {
-    write_str_value(ctx.out_buf, hset_entry_key(member));
+    write_str_value(ctx.out, hset_entry_key(member));
     hset_entry_free(member);
   } else {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
   }
 }
 
 static bool append_set_key_to_value(struct const_slice key, void *arg) {
-  struct buffer *out_buf = arg;
-  write_str_value(out_buf, key);
+  struct reply_out *out = arg;
+  write_str_value(*out, key);
   return true;
 }
 
 static void do_smembers(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_array_header(ctx.out_buf, 0);
+    write_array_header(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_HSET) {
-    write_simple_err_value(ctx.out_buf, "object not a set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_HSET);
     return;
   }
 
-  write_array_header(ctx.out_buf, hset_size(found));
-  hset_iter(found, append_set_key_to_value, ctx.out_buf);
+  write_array_header(ctx.out, hset_size(found));
+  hset_iter(found, append_set_key_to_value, &ctx.out);
 }
 
 static void do_zscore(struct command_ctx ctx) {
-  struct object *outer = store_get(ctx.store, string_const_slice(&ctx.args[1]));
+  struct object *outer = store_get(ctx.store, command_key(ctx, 1));
   if (outer == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (outer->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
   double score;
-  bool found = zset_score(outer, string_const_slice(&ctx.args[2]), &score);
+  bool found = zset_score(outer, ctx.args[2], &score);
   if (found) {
-    write_float_value(ctx.out_buf, score);
+    write_float_value(ctx.out, score);
   } else {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
   }
 }
 
 static void do_zadd(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
+  // Nothing is added unless all the scores are valid
   double score;
-  if (!parse_float_arg(&score, string_const_slice(&ctx.args[2]))) {
-    write_simple_err_value(ctx.out_buf, "invalid score");
-    return;
+  for (uint32_t i = 2; i < ctx.arg_count; i += 2) {
+    if (!parse_float_arg(&score, ctx.out.proto, ctx.args[i])) {
+      write_shared_reply(ctx.out, SHARED_ERR_SCORE);
+      return;
+    }
   }
 
-  struct const_slice member = string_const_slice(&ctx.args[3]);
-
-  struct object *outer = store_get(ctx.store, key);
-  if (outer == NULL) {
-    // Create new set
-    outer = store_set(ctx.store, key, make_zset_object());
-  }
+  struct object *outer = store_get_or_insert(ctx.store, key, make_zset_object);
 
   if (outer->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
-  bool added = zset_add(outer, member, score);
-  write_int_value(ctx.out_buf, added ? 1 : 0);
+  int_val_t added = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i += 2) {
+    bool valid = parse_float_arg(&score, ctx.out.proto, ctx.args[i]);
+    assert(valid);
+    added += zset_add(outer, ctx.args[i + 1], score);
+  }
+  write_int_value(ctx.out, added);
 }
 
 static void do_zrem(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
-
-  struct const_slice member = string_const_slice(&ctx.args[2]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *outer = store_get(ctx.store, key);
   if (outer == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (outer->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
-  bool deleted = zset_del(outer, member);
-  write_int_value(ctx.out_buf, deleted ? 1 : 0);
+  int_val_t deleted = 0;
+  for (uint32_t i = 2; i < ctx.arg_count; i++) {
+    deleted += zset_del(outer, ctx.args[i]);
+  }
+  write_int_value(ctx.out, deleted);
 }
 
 static void do_zcard(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   struct object *found = store_get(ctx.store, key);
   if (found == NULL) {
-    write_int_value(ctx.out_buf, 0);
+    write_int_value(ctx.out, 0);
     return;
   }
 
   if (found->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
-  write_int_value(ctx.out_buf, zset_size(found));
+  write_int_value(ctx.out, zset_size(found));
 }
 
 static void do_zrank(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
-  struct const_slice member = string_const_slice(&ctx.args[2]);
+  struct const_slice member = ctx.args[2];
 
   struct object *outer = store_get(ctx.store, key);
   if (outer == NULL) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
     return;
   }
 
   if (outer->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
   int_val_t rank = zset_rank(outer, member);
   if (rank < 0) {
-    write_null_value(ctx.out_buf);
+    write_null_value(ctx.out);
   } else {
-    write_int_value(ctx.out_buf, rank);
+    write_int_value(ctx.out, rank);
   }
 }
 
 static void do_zquery(struct command_ctx ctx) {
-  struct const_slice key = string_const_slice(&ctx.args[1]);
+  struct store_key key = command_key(ctx, 1);
 
   double score;
-  if (!parse_float_arg(&score, string_const_slice(&ctx.args[2]))) {
-    write_simple_err_value(ctx.out_buf, "invalid score");
+  if (!parse_float_arg(&score, ctx.out.proto, ctx.args[2])) {
+    write_shared_reply(ctx.out, SHARED_ERR_SCORE);
     return;
   }
 
-  struct const_slice member = string_const_slice(&ctx.args[3]);
+  struct const_slice member = ctx.args[3];
 
   int_val_t offset;
-  if (!parse_int_arg(&offset, string_const_slice(&ctx.args[4]))) {
-    write_simple_err_value(ctx.out_buf, "invalid offset");
+  if (!parse_int_arg(&offset, ctx.out.proto, ctx.args[4])) {
+    write_shared_reply(ctx.out, SHARED_ERR_OFFSET);
     return;
   }
 
   int_val_t limit;
   // NOLINTNEXTLINE(readability-magic-numbers)
-  if (!parse_int_arg(&limit, string_const_slice(&ctx.args[5])) || limit < 0) {
-    write_simple_err_value(ctx.out_buf, "invalid limit");
+  if (!parse_int_arg(&limit, ctx.out.proto, ctx.args[5]) || limit < 0) {
+    write_shared_reply(ctx.out, SHARED_ERR_LIMIT);
     return;
   }
 
   struct object *outer = store_get(ctx.store, key);
   if (outer == NULL) {
-    write_array_header(ctx.out_buf, 0);
+    write_array_header(ctx.out, 0);
     return;
   }
 
   if (outer->type != OBJ_ZSET) {
-    write_simple_err_value(ctx.out_buf, "object not a sorted set");
+    write_shared_reply(ctx.out, SHARED_ERR_NOT_ZSET);
     return;
   }
 
@@ -617,20 +774,31 @@ static void do_zquery(struct command_ctx ctx) {
   start = zset_node_offset(start, offset);
 
   if (start == NULL) {
-    write_array_header(ctx.out_buf, 0);
+    write_array_header(ctx.out, 0);
+    return;
+  }
+
+  if (can_stream(ctx)) {
+    // Nodes are written as the set is walked, so the rank isn't needed
+    write_array_stream_start(ctx.out);
+    for (int_val_t i = 0; i < limit && start != NULL; i++) {
+      write_str_value(ctx.out, zset_node_key(start));
+      write_float_value(ctx.out, zset_node_score(start));
+      start = zset_node_offset(start, 1);
+    }
+    write_stream_end(ctx.out);
     return;
   }
 
-  // The protocol doesn't handle unknown-length arrays, so we have to figure out
-  // the count ahead of time
+  // Counted arrays need the count ahead of time, which takes the rank
   uint32_t max_count = zset_size(outer) - zset_node_rank(outer, start);
   uint32_t count = limit < max_count ? limit : max_count;
 
-  write_array_header(ctx.out_buf, count * 2);
+  write_array_header(ctx.out, count * 2);
   for (uint32_t i = 0; i < count; i++) {
     assert(start != NULL);
-    write_str_value(ctx.out_buf, zset_node_key(start));
-    write_float_value(ctx.out_buf, zset_node_score(start));
+    write_str_value(ctx.out, zset_node_key(start));
+    write_float_value(ctx.out, zset_node_score(start));
 
     start = zset_node_offset(start, 1);
   }
@@ -656,118 +824,252 @@ static void do_shutdown(struct command_ctx ctx) {
 }
 
 static void do_command_not_found(struct command_ctx ctx) {
-  write_simple_err_value(ctx.out_buf, "invalid command");
+  write_shared_reply(ctx.out, SHARED_ERR_COMMAND);
 }
 
 static void do_not_enough_args(struct command_ctx ctx) {
-  write_simple_err_value(ctx.out_buf, "not enough arguments");
+  write_shared_reply(ctx.out, SHARED_ERR_ARGS);
 }
 
 typedef void (*command_handler)(struct command_ctx ctx);
 
-static struct hash_map commands_map;
-
 struct command_entry {
-  struct hash_entry base;
   struct const_slice name;
+  enum req_type req_type;
   uint32_t arg_count;
+  uint32_t arg_step;
+  uint32_t flags;
+  enum command_shard shard;
   command_handler handler;
 };
 
-struct command_key {
-  struct hash_entry base;
-  struct const_slice name;
-};
-
-static bool command_entry_compare(
-    const struct hash_entry *raw_key, const struct hash_entry *raw_entry) {
-  return slice_eq(
-      container_of(raw_key, struct command_key, base)->name,
-      container_of(raw_entry, struct command_entry, base)->name);
-}
-
 struct command_def {
+  // Upper case, but matched regardless of case
   const char *name;
+  enum req_type req_type;
+  // Not including the command itself. Variadic commands take at least this
+  // many arguments, followed by any number of groups of `arg_step` more.
   uint32_t arg_count;
+  uint32_t arg_step;
+  // `enum command_flags`
+  uint32_t flags;
+  enum command_shard shard;
   command_handler handler;
 };
 
 static const struct command_def all_commands[] = {
-    {"GET", 1, do_get},
-    {"SET", 2, do_set},
-    {"DEL", 1, do_del},
-    {"KEYS", 0, do_keys},
-    {"TYPE", 1, do_type},
-
-    {"TTL", 1, do_ttl},
-    {"EXPIRE", 2, do_expire},
-    {"PERSIST", 1, do_persist},
-
-    {"HGET", 2, do_hget},
-    {"HSET", 3, do_hset},
-    {"HDEL", 2, do_hdel},
-    {"HLEN", 1, do_hlen},
-    {"HGETALL", 1, do_hgetall},
-    {"HKEYS", 1, do_hkeys},
-
-    {"SADD", 2, do_sadd},
-    {"SISMEMBER", 2, do_sismember},
-    {"SREM", 2, do_srem},
-    {"SCARD", 1, do_scard},
-    {"SRANDMEMBER", 1, do_srandmember},
-    {"SPOP", 1, do_spop},
-    {"SMEMBERS", 1, do_smembers},
-
-    {"ZSCORE", 2, do_zscore},
-    {"ZADD", 3, do_zadd},
-    {"ZREM", 2, do_zrem},
-    {"ZCARD", 1, do_zcard},
-    {"ZRANK", 2, do_zrank},
-    {"ZQUERY", 5, do_zquery},
-
-    {"SHUTDOWN", 0, do_shutdown},
-    {NULL, 0, NULL},
+    {"HELLO", REQ_HELLO, 1, 0, 0, SHARD_NONE, do_hello},
+
+    {"GET", REQ_GET, 1, 0, CMD_READONLY, SHARD_KEY, do_get},
+    {"MGET", REQ_MGET, 1, 1, CMD_READONLY, SHARD_KEYS, do_mget},
+    {"SET", REQ_SET, 2, 0, CMD_WRITE, SHARD_KEY, do_set},
+    {"MSET", REQ_MSET, 2, 2, CMD_WRITE, SHARD_KEYS, do_mset},
+    {"DEL", REQ_DEL, 1, 1, CMD_WRITE, SHARD_KEYS, do_del},
+    {"KEYS", REQ_KEYS, 0, 0, CMD_READONLY | CMD_MAY_BLOCK, SHARD_ALL, do_keys},
+    {"TYPE", REQ_TYPE, 1, 0, CMD_READONLY, SHARD_KEY, do_type},
+
+    {"TTL", REQ_TTL, 1, 0, CMD_READONLY, SHARD_KEY, do_ttl},
+    {"EXPIRE", REQ_EXPIRE, 2, 0, CMD_WRITE, SHARD_KEY, do_expire},
+    {"PERSIST", REQ_PERSIST, 1, 0, CMD_WRITE, SHARD_KEY, do_persist},
+
+    {"HGET", REQ_HGET, 2, 0, CMD_READONLY, SHARD_KEY, do_hget},
+    {"HMGET", REQ_HMGET, 2, 1, CMD_READONLY, SHARD_KEY, do_hmget},
+    {"HSET", REQ_HSET, 3, 2, CMD_WRITE, SHARD_KEY, do_hset},
+    {"HDEL", REQ_HDEL, 2, 1, CMD_WRITE, SHARD_KEY, do_hdel},
+    {"HLEN", REQ_HLEN, 1, 0, CMD_READONLY, SHARD_KEY, do_hlen},
+    {"HGETALL", REQ_HGETALL, 1, 0, CMD_READONLY | CMD_MAY_BLOCK, SHARD_KEY,
+     do_hgetall},
+    {"HKEYS", REQ_HKEYS, 1, 0, CMD_READONLY | CMD_MAY_BLOCK, SHARD_KEY,
+     do_hkeys},
+
+    {"SADD", REQ_SADD, 2, 1, CMD_WRITE, SHARD_KEY, do_sadd},
+    {"SISMEMBER", REQ_SISMEMBER, 2, 0, CMD_READONLY, SHARD_KEY, do_sismember},
+    {"SMISMEMBER", REQ_SMISMEMBER, 2, 1, CMD_READONLY, SHARD_KEY,
+     do_smismember},
+    {"SREM", REQ_SREM, 2, 1, CMD_WRITE, SHARD_KEY, do_srem},
+    {"SCARD", REQ_SCARD, 1, 0, CMD_READONLY, SHARD_KEY, do_scard},
+    {"SRANDMEMBER", REQ_SRANDMEMBER, 1, 0, CMD_READONLY, SHARD_KEY,
+     do_srandmember},
+    {"SPOP", REQ_SPOP, 1, 0, CMD_WRITE, SHARD_KEY, do_spop},
+    {"SMEMBERS", REQ_SMEMBERS, 1, 0, CMD_READONLY | CMD_MAY_BLOCK, SHARD_KEY,
+     do_smembers},
+
+    {"ZSCORE", REQ_ZSCORE, 2, 0, CMD_READONLY, SHARD_KEY, do_zscore},
+    {"ZADD", REQ_ZADD, 3, 2, CMD_WRITE, SHARD_KEY, do_zadd},
+    {"ZREM", REQ_ZREM, 2, 1, CMD_WRITE, SHARD_KEY, do_zrem},
+    {"ZCARD", REQ_ZCARD, 1, 0, CMD_READONLY, SHARD_KEY, do_zcard},
+    {"ZRANK", REQ_ZRANK, 2, 0, CMD_READONLY, SHARD_KEY, do_zrank},
+    {"ZQUERY", REQ_ZQUERY, 5, 0, CMD_READONLY, SHARD_KEY, do_zquery},
+
+    {"SHUTDOWN", REQ_SHUTDOWN, 0, 0, CMD_MAY_BLOCK, SHARD_NONE, do_shutdown},
+    {NULL, 0, 0, 0, 0, SHARD_NONE, NULL},
 };
 
-// Storage for the hash entries (it's a easier to copy metadata than to
+// Storage for the table entries (it's a easier to copy metadata than to
 // construct it right from the start)
 static struct command_entry
     all_command_entries[sizeof(all_commands) / sizeof(all_commands[0])];
 
-enum { COMMAND_HASH_CAP = 64 };
+// Binary requests are dispatched by type without looking up the name
+static struct command_entry *commands_by_type[UINT8_MAX + 1];
 
-void init_commands(void) {
-  hash_map_init(&commands_map, COMMAND_HASH_CAP);
+enum {
+  // Command names are looked up in a perfect hash table. It's sparse enough
+  // for a multiplier which gives each name its own slot to be found quickly.
+  COMMAND_SLOT_BITS = 8,
+  COMMAND_SLOTS = 1 << COMMAND_SLOT_BITS,
+  COMMAND_SEED_TRIES = 100000,
+};
 
+// Clears the case bit of the name bytes in a name key. Bytes which aren't
+// letters may end up in the wrong slot, but never match a command anyway.
+#define NAME_KEY_CASE_MASK 0xFFFFFFDFDFDFDFDFULL
+
+static struct command_entry *commands_by_name[COMMAND_SLOTS];
+static uint64_t command_name_mult;
+
+/**
+ * Pack the bytes of a name which tell the commands apart: the first 4 bytes,
+ * the last byte and the size.
+ */
+static uint64_t command_name_key(struct const_slice name) {
+  uint32_t head = 0;
+  memcpy(&head, name.data, name.size < sizeof(head) ? name.size : sizeof(head));
+  uint64_t last = name.size > 0 ? const_slice_get(name, name.size - 1) : 0;
+  uint64_t size = (uint8_t)name.size;
+  // NOLINTNEXTLINE(readability-magic-numbers)
+  return (head | last << 32 | size << 40) & NAME_KEY_CASE_MASK;
+}
+
+static uint32_t command_name_slot(uint64_t key) {
+  return (uint32_t)((key * command_name_mult) >> (64 - COMMAND_SLOT_BITS));
+}
+
+/** The next of a sequence of well mixed numbers (splitmix64) */
+static uint64_t next_random(uint64_t *state) {
+  // NOLINTBEGIN(readability-magic-numbers)
+  uint64_t val = (*state += 0x9E3779B97F4A7C15ULL);
+  val = (val ^ (val >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  val = (val ^ (val >> 27)) * 0x94D049BB133111EBULL;
+  return val ^ (val >> 31);
+  // NOLINTEND(readability-magic-numbers)
+}
+
+/** Whether the current multiplier gives each command its own slot */
+static bool fill_commands_by_name(void) {
+  memset((void *)commands_by_name, 0, sizeof(commands_by_name));
+  for (unsigned i = 0; all_commands[i].name != NULL; i++) {
+    struct command_entry *entry = &all_command_entries[i];
+    uint32_t slot = command_name_slot(command_name_key(entry->name));
+    if (commands_by_name[slot] != NULL) {
+      return false;
+    }
+    commands_by_name[slot] = entry;
+  }
+  return true;
+}
+
+/** Search for a multiplier which makes the name lookup a perfect hash */
+static void init_commands_by_name(void) {
+  // Always the same sequence, so the table is the same on each start
+  uint64_t state = 0;
+  for (unsigned i = 0; i < COMMAND_SEED_TRIES; i++) {
+    // Multiplying by an odd number mixes the low bits into the high bits
+    command_name_mult = next_random(&state) | 1;
+    if (fill_commands_by_name()) {
+      return;
+    }
+  }
+  // Only happens if the keys of two names are the same
+  fputs("no perfect hash found for the command names\n", stderr);
+  abort();
+}
+
+void init_commands(void) {
   for (unsigned i = 0; all_commands[i].name != NULL; i++) {
     struct const_slice name_slice = make_str_slice(all_commands[i].name);
+    for (size_t j = 0; j < name_slice.size; j++) {
+      uint8_t byte = const_slice_get(name_slice, j);
+      assert(byte >= 'A' && byte <= 'Z');
+    }
+
     all_command_entries[i] = (struct command_entry){
-        .base.hash_code = slice_hash(name_slice),
         .name = name_slice,
+        .req_type = all_commands[i].req_type,
         .arg_count = all_commands[i].arg_count,
+        .arg_step = all_commands[i].arg_step,
+        .flags = all_commands[i].flags,
+        .shard = all_commands[i].shard,
         .handler = all_commands[i].handler,
     };
 
-    hash_map_insert(&commands_map, &all_command_entries[i].base);
+    assert(commands_by_type[all_commands[i].req_type] == NULL);
+    commands_by_type[all_commands[i].req_type] = &all_command_entries[i];
+  }
+  init_commands_by_name();
+}
+
+static struct command_entry *lookup_command(struct const_slice name) {
+  struct command_entry *found =
+      commands_by_name[command_name_slot(command_name_key(name))];
+  if (found == NULL || !slice_eq_upper(name, found->name)) {
+    return NULL;
   }
+  return found;
+}
+
+/**
+ * Find the command named by the first argument, which is a single
+ * `enum req_type` byte in the binary protocol
+ */
+static struct command_entry *find_command(
+    enum proto_version proto, struct const_slice cmd) {
+  if (proto != PROTO_BINARY) {
+    return lookup_command(cmd);
+  }
+  if (cmd.size != 1) {
+    return NULL;
+  }
+  return commands_by_type[const_slice_get(cmd, 0)];
+}
+
+/** Whether the command takes `arg_count` arguments, besides itself */
+static bool command_takes_args(
+    const struct command_entry *cmd, uint32_t arg_count) {
+  if (arg_count < cmd->arg_count) {
+    return false;
+  }
+  if (cmd->arg_step == 0) {
+    return arg_count == cmd->arg_count;
+  }
+  return (arg_count - cmd->arg_count) % cmd->arg_step == 0;
+}
+
+bool command_get_info(
+    enum proto_version proto, const struct const_slice *args,
+    uint32_t arg_count, struct command_info *info) {
+  assert(arg_count > 0);
+  struct command_entry *cmd = find_command(proto, args[0]);
+  if (cmd == NULL || !command_takes_args(cmd, arg_count - 1)) {
+    return false;
+  }
+  *info = (struct command_info){
+      .shard = cmd->shard,
+      .key_step = cmd->shard == SHARD_KEYS ? cmd->arg_step : 0,
+      .flags = cmd->flags,
+  };
+  return true;
 }
 
 void run_command(struct command_ctx ctx) {
   assert(ctx.arg_count > 0);
-  struct const_slice cmd_name = string_const_slice(&ctx.args[0]);
-  struct command_key key = {
-      .base.hash_code = slice_hash(cmd_name),
-      .name = cmd_name,
-  };
-  struct hash_entry *found =
-      hash_map_get(&commands_map, &key.base, command_entry_compare);
-  if (found == NULL) {
+  struct command_entry *cmd = find_command(ctx.out.proto, ctx.args[0]);
+  if (cmd == NULL) {
     do_command_not_found(ctx);
     return;
   }
 
-  struct command_entry *cmd = container_of(found, struct command_entry, base);
-  if (cmd->arg_count != ctx.arg_count - 1) {
+  if (!command_takes_args(cmd, ctx.arg_count - 1)) {
     do_not_enough_args(ctx);
     return;
   }
@@ -5,21 +5,83 @@
 #include <threads.h>
 
 #include "buffer.h"
+#include "protocol.h"
+#include "reply.h"
 #include "store.h"
 #include "types.h"
 
-#define COMMAND_ARGS_MAX 6
+// Including the command itself. Variadic commands take many arguments, but
+// requests are limited by the query buffer size as well.
+#define COMMAND_ARGS_MAX (1024 * 1024)
 
 struct command_ctx {
   struct store *store;
-  string *args;
+  // Arguments may point into the connection's read buffer, so they have to be
+  // copied to be kept
+  const struct const_slice *args;
   uint32_t arg_count;
-  struct buffer *out_buf;
+  // Arguments received into their own allocation, which can be moved instead
+  // of copied. May be shorter than `args`, and entries which aren't owned are
+  // small strings.
+  string *owned_args;
+  uint32_t owned_count;
+  // Hashes of the key arguments by index, if the shard which received the
+  // request already computed them to route it. May be NULL.
+  const hash_t *key_hashes;
+  // Numeric arguments and replies are in `out.proto`
+  struct reply_out out;
+  // Stored values can be referenced by the reply instead of copied. May be
+  // NULL.
+  struct reply_refs *out_refs;
+  // The protocol negotiated by the connection, which HELLO switches
+  enum proto_version *conn_proto;
   thrd_t async_task_thread;
   struct work_queue *async_task_queue;
 };
 
+/** How a command is routed when the store is split into shards */
+enum command_shard {
+  /** Doesn't access the store, so it runs on whichever shard received it */
+  SHARD_NONE,
+  /** Only accesses the key given as the first argument */
+  SHARD_KEY,
+  /**
+   * Accesses the first argument of each group of repeated arguments as a key.
+   * The keys must all be on the same shard.
+   */
+  SHARD_KEYS,
+  /** Accesses every shard. Replies must be arrays, which are concatenated */
+  SHARD_ALL,
+};
+
+enum command_flags {
+  /** Only reads the store */
+  CMD_READONLY = 1 << 0,
+  /** Changes the store */
+  CMD_WRITE = 1 << 1,
+  /** Takes time in proportion to the data stored, or stops the server */
+  CMD_MAY_BLOCK = 1 << 2,
+};
+
+/** What other parts of the server need to know about a request */
+struct command_info {
+  enum command_shard shard;
+  // Distance between keys for `SHARD_KEYS`
+  uint32_t key_step;
+  // `enum command_flags`
+  uint32_t flags;
+};
+
 void init_commands(void);
+/**
+ * Find the command of a request, whose name is matched regardless of case.
+ *
+ * Returns `false` for unknown commands and wrong argument counts, whose error
+ * reply is generated by `run_command`.
+ */
+bool command_get_info(
+    enum proto_version proto, const struct const_slice *args,
+    uint32_t arg_count, struct command_info *info);
 // TODO: Pass as pointer? The object is fairly small, so passing by value should
 // be fine and makes for slightly cleaner code (. vs ->)
 void run_command(struct command_ctx ctx);
@@ -1,111 +1,304 @@
 #include "hashmap.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "types.h"
 
 enum {
-  MAX_LOAD_FACTOR = 8,
+  // Slots whose control bytes are compared at once
+  GROUP_SIZE = 16,
+  // Load factors are counted in fractions of this
+  LOAD_DENOMINATOR = 8,
+  // Tables are grown once this many eighths of the slots are used, counting
+  // deleted ones
+  MAX_LOAD_EIGHTHS = 7,
+  // Tables are shrunk once less than this many eighths of the slots are used
+  MIN_LOAD_EIGHTHS = 1,
+  // Entries moved and groups looked at by each operation while resizing
   HASH_MAP_RESIZE_MAX_WORK = 128,
+  // Bits of the hash kept in the control byte
+  HASH_CTRL_BITS = 7,
+  // Bytes hashed by each step over longer keys, as two words
+  HASH_BLOCK_SIZE = 2 * sizeof(uint64_t),
+  HASH_HALF_WORD_BITS = sizeof(uint32_t) * CHAR_BIT,
+  HASH_WORD_BITS = sizeof(uint64_t) * CHAR_BIT,
+};
+
+// Odd, with the bits spread out (2^32 / golden ratio)
+#define HASH_CTRL_MULTIPLIER 0x9E3779B1U
+
+enum ctrl_byte {
+  CTRL_EMPTY = -128,
+  CTRL_DELETED = -2,
+  // Slots with an entry have 0-127
+};
+
+static_assert(
+    GROUP_SIZE <= sizeof(uint32_t) * CHAR_BIT, "group masks are too small");
+
+/**
+ * The part of the hash kept in the control byte. The low bits pick the group,
+ * so this mixes in the others to tell apart entries in the same group.
+ */
+static inline int8_t hash_ctrl(hash_t hash_code) {
+  return (int8_t)((uint32_t)(hash_code * HASH_CTRL_MULTIPLIER) >>
+                  (sizeof(uint32_t) * CHAR_BIT - HASH_CTRL_BITS));
+}
+
+/** Bit mask of the slots in the group with the given control byte */
+static inline uint32_t group_match(const int8_t *group, int8_t ctrl) {
+#ifdef __SSE2__
+  __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] == ctrl) << i;
+  }
+  return mask;
+#endif
+}
+
+/** Bit mask of the slots in the group which are empty or deleted */
+static inline uint32_t group_match_free(const int8_t *group) {
+#ifdef __SSE2__
+  // Only these have the sign bit set
+  __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(bytes);
+#else
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] < 0) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline uint32_t ht_group_count(const struct hash_table *table) {
+  return (table->mask + 1) / GROUP_SIZE;
+}
+
+/**
+ * Probe the groups starting at the one picked by the hash. Triangular steps
+ * visit every group since the count is a power of 2.
+ */
+struct probe_seq {
+  uint32_t group;
+  uint32_t step;
 };
 
+static inline struct probe_seq ht_probe_start(
+    const struct hash_table *table, hash_t hash_code) {
+  return (struct probe_seq){
+      .group = hash_code & (ht_group_count(table) - 1),
+      .step = 0,
+  };
+}
+
+static inline void ht_probe_next(
+    const struct hash_table *table, struct probe_seq *seq) {
+  seq->step++;
+  seq->group = (seq->group + seq->step) & (ht_group_count(table) - 1);
+}
+
 static void ht_init(struct hash_table *table, uint32_t cap) {
   assert(cap > 0);
   assert((cap & (cap - 1)) == 0);
+  if (cap < GROUP_SIZE) {
+    cap = GROUP_SIZE;
+  }
   table->mask = cap - 1;
   table->size = 0;
-  table->data = (struct hash_entry **)calloc(sizeof(struct hash_entry *), cap);
-  assert(table->data != NULL);
+  table->deleted = 0;
+  table->first_pos = 0;
+  // Control bytes come first, and keep the slots aligned since the capacity
+  // is a multiple of the group size
+  table->ctrl = malloc(cap + sizeof(struct hash_entry *) * cap);
+  assert(table->ctrl != NULL);
+  memset(table->ctrl, CTRL_EMPTY, cap);
+  table->slots = (struct hash_entry **)(table->ctrl + cap);
 }
 
 static void ht_init_empty(struct hash_table *table) {
   table->mask = 0;
   table->size = 0;
-  table->data = NULL;
+  table->deleted = 0;
+  table->first_pos = 0;
+  table->ctrl = NULL;
+  table->slots = NULL;
 }
 
-static void ht_destroy(struct hash_table *table) { free((void *)table->data); }
+static void ht_destroy(struct hash_table *table) { free(table->ctrl); }
 
-static void ht_insert(struct hash_table *table, struct hash_entry *entry) {
-  uint32_t index = entry->hash_code & table->mask;
-  struct hash_entry *next = table->data[index];
-  entry->next = next;
-  table->data[index] = entry;
+static void ht_set_slot(
+    struct hash_table *table, uint32_t index, struct hash_entry *entry) {
+  table->ctrl[index] = hash_ctrl(entry->hash_code);
+  table->slots[index] = entry;
+}
+
+/** Put an entry in a slot which is empty or deleted */
+static void ht_fill(
+    struct hash_table *table, uint32_t index, struct hash_entry *entry) {
+  assert(table->ctrl[index] < 0);
+  table->deleted -= table->ctrl[index] == CTRL_DELETED;
+  ht_set_slot(table, index, entry);
   table->size++;
+  if (index < table->first_pos) {
+    table->first_pos = index;
+  }
+}
+
+static void ht_insert(struct hash_table *table, struct hash_entry *entry) {
+  struct probe_seq seq = ht_probe_start(table, entry->hash_code);
+  while (true) {
+    const int8_t *group = &table->ctrl[seq.group * GROUP_SIZE];
+    uint32_t free_mask = group_match_free(group);
+    if (free_mask != 0) {
+      ht_fill(table, seq.group * GROUP_SIZE + __builtin_ctz(free_mask), entry);
+      return;
+    }
+    ht_probe_next(table, &seq);
+  }
 }
 
-static struct hash_entry **ht_lookup(
+/**
+ * Returns the slot index of the entry, or -1 if it isn't in the table. In that
+ * case `free_index` is set to where it would be inserted, unless it's NULL.
+ */
+static int64_t ht_find(
     const struct hash_table *table, const struct hash_entry *key,
-    hash_entry_cmp_fn compare) {
-  uint32_t index = key->hash_code & table->mask;
-  struct hash_entry **from = &table->data[index];
-  while (*from != NULL) {
-    if ((*from)->hash_code == key->hash_code && compare(key, *from)) {
-      return from;
+    hash_entry_cmp_fn compare, uint32_t *free_index) {
+  if (table->size == 0 && free_index == NULL) {
+    return -1;
+  }
+
+  bool free_found = false;
+  int8_t ctrl = hash_ctrl(key->hash_code);
+  struct probe_seq seq = ht_probe_start(table, key->hash_code);
+  for (uint32_t i = 0; i < ht_group_count(table); i++) {
+    const int8_t *group = &table->ctrl[seq.group * GROUP_SIZE];
+    uint32_t matches = group_match(group, ctrl);
+    while (matches != 0) {
+      uint32_t index = seq.group * GROUP_SIZE + __builtin_ctz(matches);
+      const struct hash_entry *entry = table->slots[index];
+      if (entry->hash_code == key->hash_code && compare(key, entry)) {
+        return index;
+      }
+      matches &= matches - 1;
+    }
+    // Same as the slot ht_insert would pick
+    if (free_index != NULL && !free_found) {
+      uint32_t free_mask = group_match_free(group);
+      if (free_mask != 0) {
+        *free_index = seq.group * GROUP_SIZE + __builtin_ctz(free_mask);
+        free_found = true;
+      }
+    }
+    // Inserting would have used the empty slot, so the key can't be further
+    if (group_match(group, CTRL_EMPTY) != 0) {
+      return -1;
     }
-    from = &(*from)->next;
+    ht_probe_next(table, &seq);
   }
+  return -1;
+}
 
-  return NULL;
+static inline int64_t ht_lookup(
+    const struct hash_table *table, const struct hash_entry *key,
+    hash_entry_cmp_fn compare) {
+  return ht_find(table, key, compare, NULL);
+}
+
+/** Returns the slot index holding the entry itself, or -1 if there's none */
+static int64_t ht_find_entry(
+    const struct hash_table *table, const struct hash_entry *entry) {
+  int8_t ctrl = hash_ctrl(entry->hash_code);
+  struct probe_seq seq = ht_probe_start(table, entry->hash_code);
+  for (uint32_t i = 0; i < ht_group_count(table); i++) {
+    const int8_t *group = &table->ctrl[seq.group * GROUP_SIZE];
+    uint32_t matches = group_match(group, ctrl);
+    while (matches != 0) {
+      uint32_t index = seq.group * GROUP_SIZE + __builtin_ctz(matches);
+      if (table->slots[index] == entry) {
+        return index;
+      }
+      matches &= matches - 1;
+    }
+    if (group_match(group, CTRL_EMPTY) != 0) {
+      return -1;
+    }
+    ht_probe_next(table, &seq);
+  }
+  return -1;
 }
 
-static struct hash_entry *ht_detach(
-    struct hash_table *table, struct hash_entry **from) {
-  struct hash_entry *node = *from;
-  *from = node->next;
+static struct hash_entry *ht_detach(struct hash_table *table, uint32_t index) {
+  struct hash_entry *entry = table->slots[index];
+  // Probes only continue past full groups. A group with an empty slot never
+  // was full, so nothing can have been placed past it.
+  const int8_t *group = &table->ctrl[index / GROUP_SIZE * GROUP_SIZE];
+  if (group_match(group, CTRL_EMPTY) != 0) {
+    table->ctrl[index] = CTRL_EMPTY;
+  } else {
+    table->ctrl[index] = CTRL_DELETED;
+    table->deleted++;
+  }
   table->size--;
-  return node;
+  return entry;
 }
 
 static struct hash_entry *ht_lookup_detach(
     struct hash_table *table, const struct hash_entry *key,
     hash_entry_cmp_fn compare) {
-  struct hash_entry **location = ht_lookup(table, key, compare);
-  if (location == NULL) {
+  int64_t index = ht_lookup(table, key, compare);
+  if (index < 0) {
     return NULL;
   }
 
-  return ht_detach(table, location);
+  return ht_detach(table, index);
 }
 
-static struct hash_entry *ht_peek(struct hash_table *table) {
+/** Returns the index of the first slot with an entry, or -1 if empty */
+static int64_t ht_first(struct hash_table *table) {
   // Don't need to iterate in this case
   if (table->size == 0) {
-    return NULL;
+    return -1;
   }
 
-  // TODO: Is there a way to optimize this for big, sparse tables?
-  for (uint32_t index = 0; index <= table->mask; index++) {
-    struct hash_entry *entry = table->data[index];
-    if (entry != NULL) {
-      return entry;
+  for (uint32_t group = table->first_pos / GROUP_SIZE;
+       group < ht_group_count(table); group++) {
+    uint32_t full_mask =
+        ~group_match_free(&table->ctrl[group * GROUP_SIZE]) &
+        ((1U << GROUP_SIZE) - 1);
+    if (full_mask != 0) {
+      table->first_pos = group * GROUP_SIZE + __builtin_ctz(full_mask);
+      return table->first_pos;
     }
   }
   assert(false);
 }
 
-static struct hash_entry *ht_pop(struct hash_table *table) {
-  // TODO: Share code with ht_peek?
-
-  // Don't need to iterate in this case
-  if (table->size == 0) {
-    return NULL;
-  }
+static struct hash_entry *ht_peek(struct hash_table *table) {
+  int64_t index = ht_first(table);
+  return index < 0 ? NULL : table->slots[index];
+}
 
-  for (uint32_t index = 0; index <= table->mask; index++) {
-    struct hash_entry *entry = table->data[index];
-    if (entry != NULL) {
-      table->data[index] = entry->next;
-      table->size--;
-      return entry;
-    }
-  }
-  assert(false);
+static struct hash_entry *ht_pop(struct hash_table *table) {
+  int64_t index = ht_first(table);
+  return index < 0 ? NULL : ht_detach(table, index);
 }
 
 static bool ht_iter(
@@ -115,16 +308,9 @@ static bool ht_iter(
   }
 
   for (uint32_t index = 0; index <= table->mask; index++) {
-    struct hash_entry *entry = table->data[index];
-    while (entry != NULL) {
-      // Get the next before before calling the callback in case the
-      // entry is freed
-      struct hash_entry *next = entry->next;
-      if (!iter(entry, arg)) {
-        return false;
-      }
-
-      entry = next;
+    // The callback may free the entry, but the slot stays as it is
+    if (table->ctrl[index] >= 0 && !iter(table->slots[index], arg)) {
+      return false;
     }
   }
 
@@ -139,7 +325,7 @@ void hash_map_init(struct hash_map *map, uint32_t cap) {
 }
 
 static inline bool hash_map_is_resizing(const struct hash_map *map) {
-  return map->old_table.data != NULL;
+  return map->old_table.ctrl != NULL;
 }
 
 static void hash_map_do_resizing(struct hash_map *map) {
@@ -147,19 +333,24 @@ static void hash_map_do_resizing(struct hash_map *map) {
     return;
   }
 
-  unsigned moved_count = 0;
-
-  for (; map->resizing_pos <= map->old_table.mask; map->resizing_pos++) {
-    // Head pointer of the hash, not an insult
-    struct hash_entry **bucket_head = &map->old_table.data[map->resizing_pos];
-    while (*bucket_head != NULL) {
-      struct hash_entry *removed = ht_detach(&map->old_table, bucket_head);
+  // Old tables may be mostly empty when shrinking, so skipping over free
+  // slots counts too
+  unsigned work = 0;
+  for (; map->resizing_pos <= map->old_table.mask;
+       map->resizing_pos += GROUP_SIZE) {
+    if (work >= HASH_MAP_RESIZE_MAX_WORK) {
+      return;
+    }
+    uint32_t full_mask =
+        ~group_match_free(&map->old_table.ctrl[map->resizing_pos]) &
+        ((1U << GROUP_SIZE) - 1);
+    for (; full_mask != 0; full_mask &= full_mask - 1) {
+      struct hash_entry *removed = ht_detach(
+          &map->old_table, map->resizing_pos + __builtin_ctz(full_mask));
       ht_insert(&map->table, removed);
-      moved_count++;
-      if (moved_count > HASH_MAP_RESIZE_MAX_WORK) {
-        return;
-      }
+      work++;
     }
+    work++;
   }
 
   // No early break due to max work
@@ -168,13 +359,43 @@ static void hash_map_do_resizing(struct hash_map *map) {
   ht_init_empty(&map->old_table);
 }
 
+static void hash_map_start_resizing(struct hash_map *map, uint32_t capacity) {
+  assert(!hash_map_is_resizing(map));
+  map->old_table = map->table;
+  ht_init(&map->table, capacity);
+  map->resizing_pos = 0;
+}
+
 static void hash_map_resize_if_needed(struct hash_map *map) {
   uint32_t capacity = map->table.mask + 1;
-  if (map->table.size >= MAX_LOAD_FACTOR * capacity) {
-    assert(!hash_map_is_resizing(map));
-    map->old_table = map->table;
-    ht_init(&map->table, capacity * 2);
-    map->resizing_pos = 0;
+  uint32_t used = map->table.size + map->table.deleted;
+  if (used * LOAD_DENOMINATOR < MAX_LOAD_EIGHTHS * capacity) {
+    return;
+  }
+
+  // Mostly deleted slots only need to be cleaned up, not more of them
+  hash_map_start_resizing(
+      map, map->table.size * 2 >= capacity / 2 ? capacity * 2 : capacity);
+}
+
+static void hash_map_shrink_if_needed(struct hash_map *map) {
+  uint32_t capacity = map->table.mask + 1;
+  if (hash_map_is_resizing(map) || capacity <= GROUP_SIZE ||
+      map->table.size * LOAD_DENOMINATOR >= MIN_LOAD_EIGHTHS * capacity) {
+    return;
+  }
+
+  // Leave room for at least as many inserts as it takes to move the entries,
+  // so that the new table never has to grow before that's done. Large tables
+  // may take a few steps to shrink all the way.
+  uint32_t size = map->table.size;
+  uint32_t moves = (capacity / GROUP_SIZE + size) / HASH_MAP_RESIZE_MAX_WORK;
+  uint32_t new_capacity = GROUP_SIZE;
+  while (new_capacity < 2 * (size + moves + 1)) {
+    new_capacity *= 2;
+  }
+  if (new_capacity < capacity) {
+    hash_map_start_resizing(map, new_capacity);
   }
 }
 
@@ -189,16 +410,18 @@ struct hash_entry *hash_map_get(
     struct hash_map *map, const struct hash_entry *key,
     hash_entry_cmp_fn compare) {
   hash_map_do_resizing(map);
-  struct hash_entry **location = ht_lookup(&map->table, key, compare);
-  if (location == NULL && hash_map_is_resizing(map)) {
-    location = ht_lookup(&map->old_table, key, compare);
+  int64_t index = ht_lookup(&map->table, key, compare);
+  if (index >= 0) {
+    return map->table.slots[index];
   }
 
-  if (location == NULL) {
-    return NULL;
+  if (hash_map_is_resizing(map)) {
+    index = ht_lookup(&map->old_table, key, compare);
+    if (index >= 0) {
+      return map->old_table.slots[index];
+    }
   }
-
-  return *location;
+  return NULL;
 }
 
 void hash_map_insert(struct hash_map *map, struct hash_entry *entry) {
@@ -207,6 +430,42 @@ void hash_map_insert(struct hash_map *map, struct hash_entry *entry) {
   hash_map_do_resizing(map);
 }
 
+struct hash_entry *hash_map_find_slot(
+    struct hash_map *map, const struct hash_entry *key,
+    hash_entry_cmp_fn compare, struct hash_slot *slot) {
+  hash_map_do_resizing(map);
+  int64_t index = ht_find(&map->table, key, compare, &slot->index);
+  if (index >= 0) {
+    return map->table.slots[index];
+  }
+
+  if (hash_map_is_resizing(map)) {
+    index = ht_lookup(&map->old_table, key, compare);
+    if (index >= 0) {
+      return map->old_table.slots[index];
+    }
+  }
+  slot->hash_code = key->hash_code;
+  return NULL;
+}
+
+void hash_map_insert_slot(
+    struct hash_map *map, struct hash_slot slot, struct hash_entry *entry) {
+  assert(entry->hash_code == slot.hash_code);
+  ht_fill(&map->table, slot.index, entry);
+  hash_map_resize_if_needed(map);
+  hash_map_do_resizing(map);
+}
+
+void hash_map_prefetch(const struct hash_map *map, hash_t hash_code) {
+  // The control bytes of the first group, which are all that's needed to
+  // find out that a key is missing
+  const struct hash_table *table = &map->table;
+  uint32_t group = ht_probe_start(table, hash_code).group;
+  __builtin_prefetch(&table->ctrl[group * GROUP_SIZE]);
+  __builtin_prefetch(&table->slots[group * GROUP_SIZE]);
+}
+
 struct hash_entry *hash_map_delete(
     struct hash_map *map, const struct hash_entry *key,
     hash_entry_cmp_fn compare) {
@@ -216,10 +475,27 @@ struct hash_entry *hash_map_delete(
   }
 
   // Move keys after deleting so the deleted entry isn't moved for no reason
+  if (deleted != NULL) {
+    hash_map_shrink_if_needed(map);
+  }
   hash_map_do_resizing(map);
   return deleted;
 }
 
+void hash_map_remove(struct hash_map *map, struct hash_entry *entry) {
+  int64_t index = ht_find_entry(&map->table, entry);
+  if (index >= 0) {
+    ht_detach(&map->table, index);
+  } else {
+    index = ht_find_entry(&map->old_table, entry);
+    assert(index >= 0);
+    ht_detach(&map->old_table, index);
+  }
+
+  hash_map_shrink_if_needed(map);
+  hash_map_do_resizing(map);
+}
+
 struct hash_entry *hash_map_peek(struct hash_map *map) {
   hash_map_do_resizing(map);
   struct hash_entry *found = ht_peek(&map->table);
@@ -235,6 +511,9 @@ struct hash_entry *hash_map_pop(struct hash_map *map) {
   if (found == NULL && hash_map_is_resizing(map)) {
     found = ht_pop(&map->old_table);
   }
+  if (found != NULL) {
+    hash_map_shrink_if_needed(map);
+  }
   return found;
 }
 
@@ -251,16 +530,90 @@ bool hash_map_iter(struct hash_map *map, hash_entry_iter_fn iter, void *arg) {
   return true;
 }
 
-enum {
-  HASH_SEED = 0x811C9DC5,
-  HASH_MULTIPLIER = 0x01000193,
-};
+// Odd constants with the bits spread out, from wyhash
+#define HASH_SECRET_0 0xA0761D6478BD642FULL
+#define HASH_SECRET_1 0xE7037ED1A0B428DBULL
+
+// Fixed until hash_seed_init is called, which tests rely on
+static uint64_t hash_seed = HASH_SECRET_0;
 
-hash_t slice_hash(struct const_slice slice) {
+void hash_seed_init(void) {
+  uint64_t seed;
+  if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+    // Still differs between runs
+    seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << HASH_HALF_WORD_BITS);
+  }
+  hash_seed = seed;
+}
+
+/** Multiply to 128 bits and fold the halves together */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> HASH_WORD_BITS);
+#else
+  uint64_t a_lo = (uint32_t)a;
+  uint64_t a_hi = a >> HASH_HALF_WORD_BITS;
+  uint64_t b_lo = (uint32_t)b;
+  uint64_t b_hi = b >> HASH_HALF_WORD_BITS;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t cross = (lo_lo >> HASH_HALF_WORD_BITS) + (uint32_t)hi_lo + lo_hi;
+  uint64_t low = (cross << HASH_HALF_WORD_BITS) | (uint32_t)lo_lo;
+  uint64_t high = a_hi * b_hi + (hi_lo >> HASH_HALF_WORD_BITS) +
+                  (cross >> HASH_HALF_WORD_BITS);
+  return low ^ high;
+#endif
+}
+
+static inline uint64_t read_u64(const uint8_t *data) {
+  uint64_t val;
+  memcpy(&val, data, sizeof(val));
+  return val;
+}
+
+static inline uint64_t read_u32(const uint8_t *data) {
+  uint32_t val;
+  memcpy(&val, data, sizeof(val));
+  return val;
+}
+
+uint64_t slice_hash64(struct const_slice slice) {
   const uint8_t *data = slice.data;
-  hash_t hash = HASH_SEED;
-  for (size_t i = 0; i < slice.size; i++) {
-    hash = (hash + data[i]) * HASH_MULTIPLIER;
+  size_t size = slice.size;
+  uint64_t seed = hash_seed;
+  uint64_t a;
+  uint64_t b;
+  if (size <= HASH_BLOCK_SIZE) {
+    if (size >= sizeof(uint32_t)) {
+      // Overlapping reads from both ends cover every byte
+      size_t middle = size / sizeof(uint64_t) * sizeof(uint32_t);
+      size_t last = size - sizeof(uint32_t);
+      a = (read_u32(data) << HASH_HALF_WORD_BITS) | read_u32(data + middle);
+      b = (read_u32(data + last) << HASH_HALF_WORD_BITS) |
+          read_u32(data + last - middle);
+    } else if (size > 0) {
+      a = ((uint64_t)data[0] << (2 * CHAR_BIT)) |
+          ((uint64_t)data[size / 2] << CHAR_BIT) | data[size - 1];
+      b = 0;
+    } else {
+      a = 0;
+      b = 0;
+    }
+  } else {
+    // A block at a time, and the last block even if they overlap
+    size_t left = size;
+    while (left > HASH_BLOCK_SIZE) {
+      seed = hash_mix(
+          read_u64(data) ^ HASH_SECRET_1,
+          read_u64(data + sizeof(uint64_t)) ^ seed);
+      data += HASH_BLOCK_SIZE;
+      left -= HASH_BLOCK_SIZE;
+    }
+    a = read_u64(data + left - HASH_BLOCK_SIZE);
+    b = read_u64(data + left - sizeof(uint64_t));
   }
-  return hash;
+  return hash_mix(
+      HASH_SECRET_1 ^ size, hash_mix(a ^ HASH_SECRET_1, b ^ seed));
 }
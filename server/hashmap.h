@@ -10,15 +10,26 @@
 typedef uint32_t hash_t;
 
 struct hash_entry {
-  struct hash_entry *next;
   hash_t hash_code;
 };
 
+/**
+ * Open addressing table. Each slot has a control byte, which is either empty,
+ * deleted or 7 bits of the hash of its entry, so that a whole group of slots
+ * is probed by comparing their control bytes at once.
+ */
 struct hash_table {
-  /** Must be 2^n - 1 */
+  /** Must be 2^n - 1, and at least the size of a group */
   uint32_t mask;
   uint32_t size;
-  struct hash_entry **data;
+  // Slots whose entry was deleted. They can't be made empty since later
+  // entries may have been placed past them.
+  uint32_t deleted;
+  // Slots before this are all free, so looking for the first entry starts
+  // here instead of going over the slots emptied by previous pops
+  uint32_t first_pos;
+  int8_t *ctrl;
+  struct hash_entry **slots;
 };
 
 struct hash_map {
@@ -43,9 +54,33 @@ struct hash_entry *hash_map_get(
     struct hash_map *map, const struct hash_entry *key,
     hash_entry_cmp_fn compare);
 void hash_map_insert(struct hash_map *map, struct hash_entry *entry);
+
+/** Where an entry missing from the map goes */
+struct hash_slot {
+  hash_t hash_code;
+  uint32_t index;
+};
+
+/**
+ * Look up an entry like `hash_map_get`, and if it's missing also find the slot
+ * for inserting it with `hash_map_insert_slot`, so that inserting doesn't
+ * probe again. The map mustn't be changed in between.
+ */
+struct hash_entry *hash_map_find_slot(
+    struct hash_map *map, const struct hash_entry *key,
+    hash_entry_cmp_fn compare, struct hash_slot *slot);
+void hash_map_insert_slot(
+    struct hash_map *map, struct hash_slot slot, struct hash_entry *entry);
+/** Start loading the bucket of a hash into the cache, ahead of a lookup */
+void hash_map_prefetch(const struct hash_map *map, hash_t hash_code);
 struct hash_entry *hash_map_delete(
     struct hash_map *map, const struct hash_entry *key,
     hash_entry_cmp_fn compare);
+/**
+ * Remove an entry which is in the map. Its slot is found by its stored hash,
+ * without comparing keys.
+ */
+void hash_map_remove(struct hash_map *map, struct hash_entry *entry);
 
 struct hash_entry *hash_map_peek(struct hash_map *map);
 struct hash_entry *hash_map_pop(struct hash_map *map);
@@ -53,6 +88,15 @@ struct hash_entry *hash_map_pop(struct hash_map *map);
 typedef bool (*hash_entry_iter_fn)(struct hash_entry *entry, void *arg);
 bool hash_map_iter(struct hash_map *map, hash_entry_iter_fn iter, void *arg);
 
-hash_t slice_hash(struct const_slice slice);
+/** Pick a random seed for hashing, so that collisions can't be planned */
+void hash_seed_init(void);
+
+/** Hash of a slice, with enough bits to split between shards and tables */
+uint64_t slice_hash64(struct const_slice slice);
+
+/** The low bits of the 64-bit hash, which is what tables store */
+static inline hash_t slice_hash(struct const_slice slice) {
+  return (hash_t)slice_hash64(slice);
+}
 
 #endif
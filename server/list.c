@@ -1,5 +1,6 @@
 #include "list.h"
 
+#include <assert.h>
 #include <stdlib.h>
 
 void dlist_init(struct dlist *list) {
@@ -53,6 +54,23 @@ struct dlist_node *dlist_pop_front(struct dlist *list) {
 
 void dlist_detach(struct dlist *list, struct dlist_node *item) {
   (void)list;
+  dlist_unlink(item);
+}
+
+void dlist_unlink(struct dlist_node *item) {
   item->next->prev = item->prev;
   item->prev->next = item->next;
 }
+
+void dlist_move_all(struct dlist *dest, struct dlist *src) {
+  assert(dlist_empty(dest));
+  if (dlist_empty(src)) {
+    return;
+  }
+
+  dest->head.next = src->head.next;
+  dest->head.prev = src->head.prev;
+  dest->head.next->prev = &dest->head;
+  dest->head.prev->next = &dest->head;
+  dlist_init(src);
+}
@@ -59,5 +59,9 @@ void dlist_push_back(struct dlist *list, struct dlist_node *item);
 struct dlist_node *dlist_pop_front(struct dlist *list);
 struct dlist_node *dlist_peek_front(struct dlist *list);
 void dlist_detach(struct dlist *list, struct dlist_node *item);
+/** Detach an item without knowing which list it's in */
+void dlist_unlink(struct dlist_node *item);
+/** Move all items from `src` to the empty list `dest` */
+void dlist_move_all(struct dlist *dest, struct dlist *src);
 
 #endif
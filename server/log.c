@@ -0,0 +1,255 @@
+#include "log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+enum {
+  RING_MASK = LOG_RING_SIZE - 1,
+  // Room for the timestamp, level and error description of a line
+  LINE_MAX_SIZE = LOG_MSG_MAX + 192,
+  OUT_BUF_SIZE = 64 * 1024,
+  ERR_DESC_MAX = 128,
+  TIME_STR_MAX = 32,
+
+  // How long the logging thread sleeps once it has written everything
+  IDLE_SLEEP_NS = 10 * 1000 * 1000,
+  NSEC_PER_USEC = 1000,
+  USEC_PER_MSEC = 1000,
+  USEC_PER_SEC = 1000000,
+};
+
+static_assert((LOG_RING_SIZE & RING_MASK) == 0, "ring size must be 2^n");
+
+struct log_record {
+  uint64_t time_us;
+  enum log_level level;
+  // `errno` value to describe after the message, or 0
+  int err;
+  char msg[LOG_MSG_MAX];
+};
+
+/**
+ * Messages of a single thread. Only that thread produces and only the logging
+ * thread (or whoever flushes) consumes, so no locks are needed.
+ */
+struct log_ring {
+  struct log_ring *next;
+  atomic_uint head;
+  atomic_uint tail;
+  // Messages which didn't fit since the last flush
+  atomic_uint dropped;
+  struct log_record records[LOG_RING_SIZE];
+};
+
+atomic_int log_min_level = LOG_INFO;
+static uint32_t log_sample_rate = 1;
+
+static once_flag lock_once = ONCE_FLAG_INIT;
+// Held while consuming, and for registering rings
+static mtx_t consumer_lock;
+static struct log_ring *rings;
+// Only used with the consumer lock held
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_size;
+
+static thread_local struct log_ring *thread_ring;
+static thread_local uint32_t request_count;
+
+static const char *const level_names[] = {
+    [LOG_DEBUG] = "DEBUG",
+    [LOG_INFO] = "INFO",
+    [LOG_WARN] = "WARN",
+    [LOG_ERROR] = "ERROR",
+};
+
+static void init_lock(void) {
+  int res = mtx_init(&consumer_lock, mtx_plain);
+  assert(res == thrd_success);
+}
+
+static struct log_ring *get_thread_ring(void) {
+  if (thread_ring != NULL) {
+    return thread_ring;
+  }
+
+  struct log_ring *ring = malloc(sizeof(*ring));
+  assert(ring != NULL);
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+
+  call_once(&lock_once, init_lock);
+  mtx_lock(&consumer_lock);
+  ring->next = rings;
+  rings = ring;
+  mtx_unlock(&consumer_lock);
+
+  thread_ring = ring;
+  return ring;
+}
+
+static uint64_t get_realtime_usec(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * USEC_PER_SEC +
+         (uint64_t)now.tv_nsec / NSEC_PER_USEC;
+}
+
+static void log_vwrite(
+    enum log_level level, int err, const char *format, va_list args) {
+  struct log_ring *ring = get_thread_ring();
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail - head == LOG_RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  struct log_record *record = &ring->records[tail & RING_MASK];
+  record->time_us = get_realtime_usec();
+  record->level = level;
+  record->err = err;
+  vsnprintf(record->msg, sizeof(record->msg), format, args);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void log_write(enum log_level level, int err, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  log_vwrite(level, err, format, args);
+  va_end(args);
+}
+
+void log_msg(enum log_level level, const char *format, ...) {
+  if (!log_enabled(level)) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  log_vwrite(level, 0, format, args);
+  va_end(args);
+}
+
+void log_errno(enum log_level level, const char *msg) {
+  int err = errno;
+  if (!log_enabled(level)) {
+    return;
+  }
+  log_write(level, err, "%s", msg);
+}
+
+bool log_sample_request(void) {
+  request_count++;
+  if (request_count < log_sample_rate) {
+    return false;
+  }
+  request_count = 0;
+  return true;
+}
+
+static void out_flush(void) {
+  fwrite(out_buf, 1, out_size, stderr);
+  fflush(stderr);
+  out_size = 0;
+}
+
+static void out_append_record(const struct log_record *record) {
+  if (out_size + LINE_MAX_SIZE > OUT_BUF_SIZE) {
+    out_flush();
+  }
+
+  time_t sec = (time_t)(record->time_us / USEC_PER_SEC);
+  unsigned msec = (unsigned)(record->time_us % USEC_PER_SEC / USEC_PER_MSEC);
+  struct tm tm;
+  char time_str[TIME_STR_MAX];
+  localtime_r(&sec, &tm);
+  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+
+  char err_desc[ERR_DESC_MAX] = "";
+  if (record->err != 0 &&
+      strerror_r(record->err, err_desc, sizeof(err_desc)) != 0) {
+    snprintf(err_desc, sizeof(err_desc), "error %d", record->err);
+  }
+
+  int len = snprintf(
+      out_buf + out_size, OUT_BUF_SIZE - out_size, "%s.%03u %s %s%s%s\n",
+      time_str, msec, level_names[record->level], record->msg,
+      record->err != 0 ? ": " : "", err_desc);
+  assert(len > 0 && (size_t)len < LINE_MAX_SIZE);
+  out_size += (size_t)len;
+}
+
+/** Write out a ring's messages, returning whether there were any */
+static bool drain_ring(struct log_ring *ring) {
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  for (unsigned pos = head; pos != tail; pos++) {
+    out_append_record(&ring->records[pos & RING_MASK]);
+  }
+  atomic_store_explicit(&ring->head, tail, memory_order_release);
+
+  unsigned dropped =
+      atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+  if (dropped > 0) {
+    struct log_record record = {
+        .time_us = get_realtime_usec(),
+        .level = LOG_WARN,
+    };
+    snprintf(record.msg, sizeof(record.msg), "dropped %u messages", dropped);
+    out_append_record(&record);
+  }
+  return head != tail || dropped > 0;
+}
+
+static bool flush_rings(void) {
+  call_once(&lock_once, init_lock);
+  mtx_lock(&consumer_lock);
+  bool any = false;
+  for (struct log_ring *ring = rings; ring != NULL; ring = ring->next) {
+    any |= drain_ring(ring);
+  }
+  if (out_size > 0) {
+    out_flush();
+  }
+  mtx_unlock(&consumer_lock);
+  return any;
+}
+
+void log_flush(void) { flush_rings(); }
+
+static int run_log_thread(void *arg) {
+  (void)arg;
+  struct timespec idle_sleep = {.tv_nsec = IDLE_SLEEP_NS};
+  while (true) {
+    // Keep going while messages are coming in fast
+    if (!flush_rings()) {
+      thrd_sleep(&idle_sleep, NULL);
+    }
+  }
+  return 0;
+}
+
+void log_init(enum log_level min_level, uint32_t sample_rate) {
+  assert(sample_rate > 0);
+  atomic_store_explicit(&log_min_level, min_level, memory_order_relaxed);
+  log_sample_rate = sample_rate;
+
+  int res = atexit(log_flush);
+  assert(res == 0);
+
+  thrd_t thread;
+  res = thrd_create(&thread, run_log_thread, NULL);
+  assert(res == thrd_success);
+  res = thrd_detach(thread);
+  assert(res == thrd_success);
+}
@@ -0,0 +1,63 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum log_level {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARN,
+  LOG_ERROR,
+  // Only used as the minimum level, to log nothing
+  LOG_NONE,
+};
+
+enum {
+  // Longer messages are truncated
+  LOG_MSG_MAX = 240,
+  // Messages buffered per thread before new ones are dropped
+  LOG_RING_SIZE = 1024,
+};
+
+extern atomic_int log_min_level;
+
+/**
+ * Start the thread which writes messages to stderr, which are only buffered
+ * until then.
+ *
+ * Per-request messages are only logged for 1 in `sample_rate` requests.
+ */
+void log_init(enum log_level min_level, uint32_t sample_rate);
+
+static inline bool log_enabled(enum log_level level) {
+  return (int)level >=
+         atomic_load_explicit(&log_min_level, memory_order_relaxed);
+}
+
+/**
+ * Whether to log the current request, to only log a sample of them.
+ *
+ * Must only be called once per request, after checking the level.
+ */
+bool log_sample_request(void);
+
+/**
+ * Buffer a message to be written by the logging thread.
+ *
+ * Never blocks, messages are dropped if the thread's buffer is full.
+ */
+__attribute__((format(printf, 2, 3))) void log_msg(
+    enum log_level level, const char *format, ...);
+
+/** Like `perror`, with the error description added by the logging thread */
+void log_errno(enum log_level level, const char *msg);
+
+/**
+ * Write all buffered messages. Also done on exit, so that nothing is lost on
+ * shutdown.
+ */
+void log_flush(void);
+
+#endif
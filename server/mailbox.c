@@ -0,0 +1,32 @@
+#include "mailbox.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+bool mailbox_push(struct mailbox *box, struct mailbox_node *node) {
+  struct mailbox_node *head =
+      atomic_load_explicit(&box->head, memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &box->head, &head, node, memory_order_release, memory_order_relaxed));
+
+  return head == NULL;
+}
+
+struct mailbox_node *mailbox_take_all(struct mailbox *box) {
+  // Taking the whole stack at once avoids ABA problems with a single consumer
+  struct mailbox_node *stack =
+      atomic_exchange_explicit(&box->head, NULL, memory_order_acquire);
+
+  // Reverse to get FIFO order
+  struct mailbox_node *list = NULL;
+  while (stack != NULL) {
+    struct mailbox_node *next = stack->next;
+    stack->next = list;
+    list = stack;
+    stack = next;
+  }
+  return list;
+}
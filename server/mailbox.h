@@ -0,0 +1,42 @@
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Intrusive, lock-free, multi-producer single-consumer queue.
+ *
+ * Producers push onto a Treiber stack. The consumer takes the whole stack at
+ * once and reverses it, so messages from a single producer are received in
+ * the order they were sent.
+ */
+struct mailbox_node {
+  struct mailbox_node *next;
+};
+
+struct mailbox {
+  _Atomic(struct mailbox_node *) head;
+};
+
+static inline void mailbox_init(struct mailbox *box) {
+  atomic_init(&box->head, NULL);
+}
+
+/**
+ * Push a message. Safe to call from any thread.
+ *
+ * Returns `true` if the mailbox was empty beforehand, meaning the consumer may
+ * need to be woken up.
+ */
+bool mailbox_push(struct mailbox *box, struct mailbox_node *node);
+
+/**
+ * Remove all messages, returned as a list in the order they were pushed.
+ *
+ * Only one thread may consume from a mailbox.
+ */
+struct mailbox_node *mailbox_take_all(struct mailbox *box);
+
+#endif
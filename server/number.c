@@ -0,0 +1,362 @@
+#include "number.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  DECIMAL_BASE = 10,
+  // More digits than this may not fit in 64 bits
+  UINT64_DIGITS_MAX = 19,
+  // Largest power of 10 which is exactly representable as a double
+  EXACT_POW10_MAX = 22,
+  // Exponents further out than this are all 0 or infinity anyway
+  EXPONENT_MAX = 100000,
+  // Numbers which are parsed from a copy on the stack
+  PARSE_COPY_SIZE = 64,
+  // Most decimals tried before searching for the shortest representation
+  SHORT_DECIMALS_MAX = 17,
+};
+
+// Doubles up to this are integers which are exactly representable
+#define EXACT_INT_MAX 0x1p53
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t pow10_u64[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+static const double pow10_exact[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static_assert(
+    sizeof(pow10_exact) / sizeof(pow10_exact[0]) == EXACT_POW10_MAX + 1,
+    "missing powers of 10");
+
+static size_t count_digits(uint64_t val) {
+  // Estimate from the number of bits (1233 / 4096 ~ log10(2)), then correct
+  // by one. `| 1` gives 0 a digit without changing the count of others.
+  uint64_t odd = val | 1;
+  unsigned bits = 64 - __builtin_clzll(odd);
+  unsigned estimate = bits * 1233 >> 12;
+  return estimate + (odd >= pow10_u64[estimate]);
+}
+
+size_t number_format_uint(char *out, uint64_t val) {
+  size_t len = count_digits(val);
+  // Fill in two digits at a time from the end
+  char *pos = out + len;
+  while (val >= DECIMAL_BASE * DECIMAL_BASE) {
+    pos -= 2;
+    memcpy(pos, &digit_pairs[val % (DECIMAL_BASE * DECIMAL_BASE) * 2], 2);
+    val /= DECIMAL_BASE * DECIMAL_BASE;
+  }
+  if (val >= DECIMAL_BASE) {
+    memcpy(out, &digit_pairs[val * 2], 2);
+  } else {
+    *out = (char)('0' + val);
+  }
+  return len;
+}
+
+size_t number_format_int(char *out, int64_t val) {
+  if (val < 0) {
+    *out = '-';
+    return 1 + number_format_uint(out + 1, 0 - (uint64_t)val);
+  }
+  return number_format_uint(out, (uint64_t)val);
+}
+
+/** Write `digits / 10^decimals` with a decimal point */
+static size_t format_decimal(
+    char *out, bool negative, uint64_t digits, int decimals) {
+  char *pos = out;
+  if (negative) {
+    *pos++ = '-';
+  }
+
+  char digit_str[NUMBER_UINT_MAX_LEN];
+  size_t count = number_format_uint(digit_str, digits);
+  if (count > (size_t)decimals) {
+    size_t integral = count - decimals;
+    memcpy(pos, digit_str, integral);
+    pos += integral;
+    *pos++ = '.';
+    memcpy(pos, digit_str + integral, decimals);
+    pos += decimals;
+  } else {
+    *pos++ = '0';
+    *pos++ = '.';
+    memset(pos, '0', decimals - count);
+    pos += decimals - count;
+    memcpy(pos, digit_str, count);
+    pos += count;
+  }
+  *pos = '\0';
+  return pos - out;
+}
+
+/**
+ * Find the fewest decimals with which some decimal number has `val` as its
+ * nearest double, which makes it the shortest representation. Returns 0 if
+ * that needs more digits than fit in a double's mantissa.
+ */
+static size_t format_short_decimal(char *out, double val) {
+  double abs_val = fabs(val);
+  for (int decimals = 1; decimals <= SHORT_DECIMALS_MAX; decimals++) {
+    double scaled = abs_val * pow10_exact[decimals];
+    if (scaled >= EXACT_INT_MAX) {
+      return 0;
+    }
+
+    // Dividing two exact values rounds correctly, like parsing would. The
+    // rounded product can be off by one from the decimal's digits.
+    double rounded = nearbyint(scaled);
+    const double candidates[] = {rounded, rounded - 1, rounded + 1};
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+      if (candidates[i] / pow10_exact[decimals] == abs_val) {
+        return format_decimal(
+            out, val < 0, (uint64_t)candidates[i], decimals);
+      }
+    }
+  }
+  return 0;
+}
+
+size_t number_format_double(char *out, double val) {
+  if (isnan(val)) {
+    memcpy(out, "nan", sizeof("nan"));
+    return sizeof("nan") - 1;
+  }
+  if (isinf(val)) {
+    const char *str = val < 0 ? "-inf" : "inf";
+    size_t len = strlen(str);
+    memcpy(out, str, len + 1);
+    return len;
+  }
+
+  if (val == 0 && signbit(val)) {
+    memcpy(out, "-0", sizeof("-0"));
+    return sizeof("-0") - 1;
+  }
+  // Scores are often integers, which don't need a search
+  if (val == trunc(val) && fabs(val) <= EXACT_INT_MAX) {
+    size_t len = number_format_int(out, (int64_t)val);
+    out[len] = '\0';
+    return len;
+  }
+
+  size_t len = format_short_decimal(out, val);
+  if (len > 0) {
+    return len;
+  }
+
+  // Any decimal with up to DBL_DIG digits survives a round trip through a
+  // double, so if one reads back as `val` it's also the shortest
+  int printed;
+  for (int precision = DBL_DIG; precision < DBL_DECIMAL_DIG; precision++) {
+    printed = snprintf(out, NUMBER_DOUBLE_BUF_SIZE, "%.*g", precision, val);
+    assert(printed > 0 && printed < NUMBER_DOUBLE_BUF_SIZE);
+    if (strtod(out, NULL) == val) {
+      return printed;
+    }
+  }
+  printed =
+      snprintf(out, NUMBER_DOUBLE_BUF_SIZE, "%.*g", DBL_DECIMAL_DIG, val);
+  assert(printed > 0 && printed < NUMBER_DOUBLE_BUF_SIZE);
+  return printed;
+}
+
+bool number_parse_int(int64_t *val, const char *data, size_t size) {
+  const char *pos = data;
+  const char *end = data + size;
+  bool negative = false;
+  if (pos < end && (*pos == '+' || *pos == '-')) {
+    negative = *pos == '-';
+    pos++;
+  }
+  if (pos == end) {
+    return false;
+  }
+
+  // Leading zeros don't count towards the digits which fit
+  while (pos < end && *pos == '0') {
+    pos++;
+  }
+  if (end - pos > UINT64_DIGITS_MAX) {
+    return false;
+  }
+
+  uint64_t res = 0;
+  for (; pos < end; pos++) {
+    uint8_t digit = (uint8_t)(*pos - '0');
+    if (digit >= DECIMAL_BASE) {
+      return false;
+    }
+    res = res * DECIMAL_BASE + digit;
+  }
+
+  if (negative) {
+    if (res > (uint64_t)INT64_MAX + 1) {
+      return false;
+    }
+    *val = res == 0 ? 0 : -(int64_t)(res - 1) - 1;
+  } else {
+    if (res > INT64_MAX) {
+      return false;
+    }
+    *val = (int64_t)res;
+  }
+  return true;
+}
+
+/** Correctly rounded parsing of any number which was already validated */
+static double parse_double_slow(const char *data, size_t size) {
+  char stack_copy[PARSE_COPY_SIZE];
+  char *copy = size < sizeof(stack_copy) ? stack_copy : malloc(size + 1);
+  assert(copy != NULL);
+  memcpy(copy, data, size);
+  copy[size] = '\0';
+
+  char *end;
+  double res = strtod(copy, &end);
+  assert(end == copy + size);
+
+  if (copy != stack_copy) {
+    free(copy);
+  }
+  return res;
+}
+
+bool number_parse_double(double *val, const char *data, size_t size) {
+  const char *pos = data;
+  const char *end = data + size;
+  bool negative = false;
+  if (pos < end && (*pos == '+' || *pos == '-')) {
+    negative = *pos == '-';
+    pos++;
+  }
+
+  if (end - pos == 3 && memcmp(pos, "inf", 3) == 0) {
+    *val = negative ? -INFINITY : INFINITY;
+    return true;
+  }
+  if (size == 3 && memcmp(data, "nan", 3) == 0) {
+    *val = NAN;
+    return true;
+  }
+
+  // Up to 19 significant digits, and the power of 10 to multiply them by
+  uint64_t mantissa = 0;
+  unsigned mantissa_digits = 0;
+  int exponent = 0;
+  bool truncated = false;
+  bool any_digits = false;
+  bool fraction = false;
+  for (; pos < end; pos++) {
+    if (*pos == '.' && !fraction) {
+      fraction = true;
+      continue;
+    }
+    uint8_t digit = (uint8_t)(*pos - '0');
+    if (digit >= DECIMAL_BASE) {
+      break;
+    }
+
+    any_digits = true;
+    if (mantissa_digits < UINT64_DIGITS_MAX) {
+      mantissa = mantissa * DECIMAL_BASE + digit;
+      // Leading zeros aren't significant
+      mantissa_digits += mantissa != 0;
+      exponent -= fraction;
+    } else {
+      truncated |= digit != 0;
+      exponent += !fraction;
+    }
+  }
+  if (!any_digits) {
+    return false;
+  }
+
+  if (pos < end && (*pos == 'e' || *pos == 'E')) {
+    pos++;
+    bool exponent_negative = false;
+    if (pos < end && (*pos == '+' || *pos == '-')) {
+      exponent_negative = *pos == '-';
+      pos++;
+    }
+    if (pos == end) {
+      return false;
+    }
+
+    int explicit_exponent = 0;
+    for (; pos < end; pos++) {
+      uint8_t digit = (uint8_t)(*pos - '0');
+      if (digit >= DECIMAL_BASE) {
+        return false;
+      }
+      if (explicit_exponent < EXPONENT_MAX) {
+        explicit_exponent = explicit_exponent * DECIMAL_BASE + digit;
+      }
+    }
+    exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+  }
+  if (pos != end) {
+    return false;
+  }
+
+  // Both the mantissa and the power of 10 are exact, so a single operation
+  // rounds correctly
+  if (!truncated && mantissa <= (uint64_t)EXACT_INT_MAX &&
+      exponent >= -EXACT_POW10_MAX && exponent <= EXACT_POW10_MAX) {
+    double res = (double)mantissa;
+    if (exponent < 0) {
+      res /= pow10_exact[-exponent];
+    } else {
+      res *= pow10_exact[exponent];
+    }
+    *val = negative ? -res : res;
+    return true;
+  }
+
+  *val = parse_double_slow(data, size);
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  // Longest formatted numbers, without a null terminator
+  NUMBER_UINT_MAX_LEN = 20,
+  NUMBER_INT_MAX_LEN = 20,
+  // Room needed by `number_format_double`, including a null terminator
+  NUMBER_DOUBLE_BUF_SIZE = 32,
+};
+
+/** Write the decimal digits of `val`, returning how many were written */
+size_t number_format_uint(char *out, uint64_t val);
+size_t number_format_int(char *out, int64_t val);
+/**
+ * Write the shortest representation of `val` which parses back to the same
+ * value, or nan, inf or -inf.
+ *
+ * Also writes a null terminator, which isn't included in the returned length.
+ */
+size_t number_format_double(char *out, double val);
+
+/** Parse a whole string as a decimal integer, rejecting overflow */
+bool number_parse_int(int64_t *val, const char *data, size_t size);
+/**
+ * Parse a whole string as a decimal number, with an optional exponent, or as
+ * nan, inf or -inf. The result is correctly rounded.
+ */
+bool number_parse_double(double *val, const char *data, size_t size);
+
+#endif
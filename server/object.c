@@ -75,10 +75,11 @@ struct hmap_key {
   struct const_slice key;
 };
 
-static struct hmap_entry *hmap_entry_alloc(struct const_slice key, string val) {
+static struct hmap_entry *hmap_entry_alloc(
+    struct const_slice key, hash_t hash_code, string val) {
   struct hmap_entry *ent = malloc(sizeof(*ent) + key.size);
   assert(ent != NULL);
-  ent->entry.hash_code = slice_hash(key);
+  ent->entry.hash_code = hash_code;
   inline_string_init_slice(&ent->key, key);
   ent->val = val;
   return ent;
@@ -116,7 +117,6 @@ bool hmap_get(
   assert(obj->type == OBJ_HMAP);
   struct hash_map *map = obj->hmap_val;
 
-  // TODO: Re-structure hashmap API to avoid double hashing when inserting?
   struct hmap_key key_ent = {
       .entry.hash_code = slice_hash(key),
       .key = key,
@@ -132,34 +132,36 @@ bool hmap_get(
   return true;
 }
 
-void hmap_set(struct object *obj, struct const_slice key, string val) {
+bool hmap_set(struct object *obj, struct const_slice key, string val) {
   assert(obj->type == OBJ_HMAP);
   struct hash_map *map = obj->hmap_val;
 
-  // TODO: Re-structure hashmap API to avoid double hashing when inserting?
   struct hmap_key key_ent = {
       .entry.hash_code = slice_hash(key),
       .key = key,
   };
 
+  struct hash_slot slot;
   struct hash_entry *existing =
-      hash_map_get(map, &key_ent.entry, hmap_entry_compare);
+      hash_map_find_slot(map, &key_ent.entry, hmap_entry_compare, &slot);
   if (existing == NULL) {
-    struct hmap_entry *new_ent = hmap_entry_alloc(key, val);
-    hash_map_insert(map, &new_ent->entry);
-  } else {
-    struct hmap_entry *existing_ent =
-        container_of(existing, struct hmap_entry, entry);
-    string_destroy(&existing_ent->val);
-    existing_ent->val = val;
+    struct hmap_entry *new_ent =
+        hmap_entry_alloc(key, key_ent.entry.hash_code, val);
+    hash_map_insert_slot(map, slot, &new_ent->entry);
+    return true;
   }
+
+  struct hmap_entry *existing_ent =
+      container_of(existing, struct hmap_entry, entry);
+  string_destroy(&existing_ent->val);
+  existing_ent->val = val;
+  return false;
 }
 
 bool hmap_del(struct object *obj, struct const_slice key) {
   assert(obj->type == OBJ_HMAP);
   struct hash_map *map = obj->hmap_val;
 
-  // TODO: Re-structure hashmap API to avoid double hashing when inserting?
   struct hmap_key key_ent = {
       .entry.hash_code = slice_hash(key),
       .key = key,
@@ -216,10 +218,11 @@ struct object make_hset_object(void) {
   return obj;
 }
 
-static struct hset_entry *hset_entry_alloc(struct const_slice key) {
+static struct hset_entry *hset_entry_alloc(
+    struct const_slice key, hash_t hash_code) {
   struct hset_entry *ent = malloc(sizeof(*ent) + key.size);
   assert(ent != NULL);
-  ent->entry.hash_code = slice_hash(key);
+  ent->entry.hash_code = hash_code;
   inline_string_init_slice(&ent->key, key);
   return ent;
 }
@@ -244,12 +247,22 @@ static bool hset_entry_free_iter(struct hash_entry *raw_ent, void *arg) {
 }
 
 bool hset_add(struct object *obj, struct const_slice key) {
-  if (hset_contains(obj, key)) {
+  assert(obj->type == OBJ_HSET);
+  struct hash_map *set = obj->hmap_val;
+
+  struct hset_key key_ent = {
+      .entry.hash_code = slice_hash(key),
+      .key = key,
+  };
+
+  struct hash_slot slot;
+  if (hash_map_find_slot(set, &key_ent.entry, hset_entry_compare, &slot) !=
+      NULL) {
     return false;
   }
 
-  struct hset_entry *new = hset_entry_alloc(key);
-  hash_map_insert(obj->hmap_val, &new->entry);
+  struct hset_entry *new = hset_entry_alloc(key, key_ent.entry.hash_code);
+  hash_map_insert_slot(set, slot, &new->entry);
   return true;
 }
 
@@ -410,10 +423,11 @@ static int zset_key_compare(
       key->key, key->score, zset_node_key(node), node->score);
 }
 
-static struct zset_node *zset_node_alloc(struct const_slice key, double score) {
+static struct zset_node *zset_node_alloc(
+    struct const_slice key, hash_t hash_code, double score) {
   struct zset_node *node = malloc(sizeof(*node) + key.size);
   assert(node != NULL);
-  node->hash_base.hash_code = slice_hash(key);
+  node->hash_base.hash_code = hash_code;
   avl_init(&node->avl_base);
   inline_string_init_slice(&node->key, key);
   node->score = score;
@@ -470,10 +484,12 @@ bool zset_add(struct object *obj, struct const_slice key, double score) {
       .key = key,
   };
 
-  struct hash_entry *found = hash_map_get(map, &key_ent.base, zset_node_eq);
+  struct hash_slot slot;
+  struct hash_entry *found =
+      hash_map_find_slot(map, &key_ent.base, zset_node_eq, &slot);
   if (found == NULL) {
-    struct zset_node *new = zset_node_alloc(key, score);
-    hash_map_insert(map, &new->hash_base);
+    struct zset_node *new = zset_node_alloc(key, key_ent.base.hash_code, score);
+    hash_map_insert_slot(map, slot, &new->hash_base);
     avl_insert(&obj->tree_val, &new->avl_base, zset_node_compare);
     return true;
   }
@@ -50,7 +50,8 @@ void object_destroy(struct object obj);
 
 bool hmap_get(
     struct object *obj, struct const_slice key, struct const_slice *val);
-void hmap_set(struct object *obj, struct const_slice key, string val);
+/** Returns `true` if the field was added, `false` if it was updated */
+bool hmap_set(struct object *obj, struct const_slice key, string val);
 bool hmap_del(struct object *obj, struct const_slice key);
 int_val_t hmap_size(struct object *obj);
 
@@ -1,150 +1,82 @@
 #include "protocol.h"
 
 #include <assert.h>
-#include <ctype.h>
-#include <math.h>
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "buffer.h"
+#include "number.h"
+#include "reply.h"
 #include "types.h"
 
 enum {
   PARSE_INT_BASE = 10,
+  // Sizes never have more digits, so that they can't overflow
+  SIZE_DIGITS_MAX = 19,
+  // Bytes searched at once for the end of a size
+  SIZE_SCAN_SIZE = 16,
 };
 
-// Re-implementations of strtol, strtod, etc. which respect input slice size
-
-static bool parse_int_helper(int_val_t *val, struct const_slice *input) {
-  if (input->size == 0) {
-    return false;
-  }
-
-  bool negative = false;
-  uint8_t prefix = const_slice_get(*input, 0);
-  if (prefix == '+') {
-    const_slice_advance(input, 1);
-  } else if (prefix == '-') {
-    negative = true;
-    const_slice_advance(input, 1);
-  }
-
-  *val = 0;
-  size_t index;
-  for (index = 0; index < input->size; index++) {
-    uint8_t byte = const_slice_get(*input, index);
-    if (!isdigit(byte)) {
-      break;
+bool parse_int_arg(
+    int_val_t *val, enum proto_version proto, struct const_slice input) {
+  if (proto == PROTO_BINARY) {
+    if (input.size != sizeof(*val)) {
+      return false;
     }
-    *val = *val * PARSE_INT_BASE + byte - '0';
-  }
-  const_slice_advance(input, index);
-
-  if (negative) {
-    *val = -*val;
-  }
-  return true;
-}
-
-bool parse_int_arg(int_val_t *val, struct const_slice input) {
-  if (!parse_int_helper(val, &input)) {
-    return false;
+    memcpy(val, input.data, sizeof(*val));
+    return true;
   }
-
-  return input.size == 0;
+  return number_parse_int(val, input.data, input.size);
 }
 
-static void parse_float_fractional(double *val, struct const_slice *input) {
-#define ONE_TENTH 0.1
-  size_t index = 0;
-  for (double scalar = ONE_TENTH; index < input->size;
-       index++, scalar *= ONE_TENTH) {
-#undef ONE_TENTH
-    uint8_t byte = const_slice_get(*input, index);
-    if (!isdigit(byte)) {
-      break;
+bool parse_float_arg(
+    double *val, enum proto_version proto, struct const_slice input) {
+  if (proto == PROTO_BINARY) {
+    if (input.size != sizeof(*val)) {
+      return false;
     }
-    *val += (byte - '0') * scalar;
-  }
-
-  const_slice_advance(input, index);
-}
-
-static bool parse_float_exponent(double *val, struct const_slice *input) {
-  int_val_t exponent;
-  if (!parse_int_helper(&exponent, input)) {
-    return false;
-  }
-
-  *val *= pow(PARSE_INT_BASE, (double)exponent);
-  return true;
-}
-
-bool parse_float_arg(double *val, struct const_slice input) {
-  if (input.size == 0) {
-    return false;
-  }
-
-  // TODO: Check for nan/inf later since they are probably rare?
-  if (slice_eq(input, make_const_slice("nan", 3))) {
-    *val = NAN;
+    memcpy(val, input.data, sizeof(*val));
     return true;
   }
-  if (slice_eq(input, make_const_slice("inf", 3))) {
-    *val = INFINITY;
-    return true;
-  }
-  if (slice_eq(input, make_const_slice("-inf", 4))) {
-    *val = -INFINITY;
-    return true;
-  }
-
-  bool negative = false;
-  uint8_t prefix = const_slice_get(input, 0);
-  if (prefix == '+') {
-    const_slice_advance(&input, 1);
-  } else if (prefix == '-') {
-    negative = true;
-    const_slice_advance(&input, 1);
-  }
-
-  // Integral part
-  *val = 0;
-  size_t index;
-  for (index = 0; index < input.size; index++) {
-    uint8_t byte = const_slice_get(input, index);
-    if (!isdigit(byte)) {
-      break;
-    }
-    *val = *val * PARSE_INT_BASE + byte - '0';
-  }
-  const_slice_advance(&input, index);
-
-  if (input.size > 0 && const_slice_get(input, 0) == '.') {
-    const_slice_advance(&input, 1);
-    parse_float_fractional(val, &input);
-  }
+  return number_parse_double(val, input.data, input.size);
+}
 
-  if (input.size > 0 && tolower(const_slice_get(input, 0)) == 'e') {
-    const_slice_advance(&input, 1);
-    if (!parse_float_exponent(val, &input)) {
+static bool parse_digits(
+    uint64_t *restrict val, const uint8_t *digits, size_t count) {
+  uint64_t res = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t digit = digits[i] - '0';
+    if (digit >= PARSE_INT_BASE) {
       return false;
     }
+    res = res * PARSE_INT_BASE + digit;
   }
-
-  if (input.size > 0) {
-    return false;
-  }
-
-  if (negative) {
-    *val = -*val;
-  }
+  *val = res;
   return true;
 }
 
+/**
+ * Find the \r ending a size with a single vector compare, or return -1 if
+ * there isn't one in the next 16 bytes. `data` must have at least that many.
+ */
+static ssize_t find_size_end(const uint8_t *data) {
+#ifdef __SSE2__
+  __m128i chunk = _mm_loadu_si128((const __m128i *)data);
+  unsigned mask =
+      (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+  return mask == 0 ? -1 : __builtin_ctz(mask);
+#else
+  const uint8_t *end = memchr(data, '\r', SIZE_SCAN_SIZE);
+  return end == NULL ? -1 : end - data;
+#endif
+}
+
 /**
  * Check a type byte and parse the size of the object (including the \r\n).
  */
@@ -157,17 +89,32 @@ static ssize_t parse_size(
     return PARSE_ERR;
   }
 
+  // Sizes are almost always followed by more data, so that the digits can be
+  // found without checking each byte
+  const uint8_t *digits = (const uint8_t *)buffer.data + 1;
+  if (buffer.size > SIZE_SCAN_SIZE + 1) {
+    ssize_t count = find_size_end(digits);
+    if (count >= 0) {
+      if (!parse_digits(size, digits, count) ||
+          digits[count + 1] != '\n') {
+        return PARSE_ERR;
+      }
+      // The type byte, digits, \r and \n
+      return count + 3;
+    }
+  }
+
   *size = 0;
   // Start after the type byte
   for (size_t i = 1; i < buffer.size; i++) {
     uint8_t byte = const_slice_get(buffer, i);
-    if (isdigit(byte)) {
-      *size = *size * PARSE_INT_BASE + byte - '0';
-    } else if (byte == '\r') {
-      if (i == 0) {
+    uint8_t digit = byte - '0';
+    if (digit < PARSE_INT_BASE) {
+      if (i > SIZE_DIGITS_MAX) {
         return PARSE_ERR;
       }
-
+      *size = *size * PARSE_INT_BASE + digit;
+    } else if (byte == '\r') {
       i++;
       if (i >= buffer.size) {
         return PARSE_MORE;
@@ -200,9 +147,43 @@ ssize_t parse_array_header(uint32_t *size, struct const_slice buffer) {
   return res;
 }
 
+/** Match a fixed header or marker at the start of the buffer */
+static ssize_t parse_literal(struct const_slice buffer, const char *literal) {
+  if (buffer.size == 0) {
+    return PARSE_MORE;
+  }
+  size_t size = strlen(literal);
+  size_t cmp_size = buffer.size < size ? buffer.size : size;
+  if (memcmp(buffer.data, literal, cmp_size) != 0) {
+    return PARSE_ERR;
+  }
+  if (cmp_size < size) {
+    return PARSE_MORE;
+  }
+  return (ssize_t)size;
+}
+
+ssize_t parse_blob_str_header(uint64_t *size, struct const_slice buffer) {
+  return parse_size(RESP_BLOB_STR, size, buffer);
+}
+
+ssize_t parse_blob_str_end(struct const_slice buffer) {
+  if (buffer.size < 2) {
+    return PARSE_MORE;
+  }
+
+  if (const_slice_get(buffer, 0) != '\r') {
+    return PARSE_ERR;
+  }
+  if (const_slice_get(buffer, 1) != '\n') {
+    return PARSE_ERR;
+  }
+  return 2;
+}
+
 ssize_t parse_blob_str(struct const_slice *str, struct const_slice buffer) {
   uint64_t str_size;
-  ssize_t res = parse_size(RESP_BLOB_STR, &str_size, buffer);
+  ssize_t res = parse_blob_str_header(&str_size, buffer);
   if (res < 0) {
     return res;
   }
@@ -212,15 +193,91 @@ ssize_t parse_blob_str(struct const_slice *str, struct const_slice buffer) {
     return PARSE_MORE;
   }
 
-  if (const_slice_get(buffer, str_size) != '\r') {
-    return PARSE_ERR;
+  struct const_slice end = buffer;
+  const_slice_advance(&end, str_size);
+  ssize_t end_res = parse_blob_str_end(end);
+  if (end_res < 0) {
+    return end_res;
+  }
+
+  *str = make_const_slice(buffer.data, str_size);
+  return res + (ssize_t)str_size + end_res;
+}
+
+ssize_t parse_bin_req_header(
+    proto_size_t *frame_size, uint8_t *req_type, struct const_slice buffer) {
+  if (buffer.size < PROTO_HEADER_SIZE + 1) {
+    return PARSE_MORE;
   }
-  if (const_slice_get(buffer, str_size + 1) != '\n') {
+  memcpy(frame_size, buffer.data, PROTO_SIZE_SIZE);
+  // The frame always includes the command
+  if (*frame_size == 0) {
     return PARSE_ERR;
   }
+  *req_type = const_slice_get(buffer, PROTO_HEADER_SIZE);
+  return PROTO_HEADER_SIZE + 1;
+}
 
+ssize_t parse_bin_str_header(uint64_t *size, struct const_slice buffer) {
+  if (buffer.size < PROTO_SIZE_SIZE) {
+    return PARSE_MORE;
+  }
+  proto_size_t str_size;
+  memcpy(&str_size, buffer.data, PROTO_SIZE_SIZE);
+  *size = str_size;
+  return PROTO_SIZE_SIZE;
+}
+
+ssize_t parse_bin_str(struct const_slice *str, struct const_slice buffer) {
+  uint64_t str_size;
+  ssize_t res = parse_bin_str_header(&str_size, buffer);
+  if (res < 0) {
+    return res;
+  }
+  const_slice_advance(&buffer, res);
+
+  if (buffer.size < str_size) {
+    return PARSE_MORE;
+  }
   *str = make_const_slice(buffer.data, str_size);
-  return res + (ssize_t)str_size + 2;
+  return res + (ssize_t)str_size;
+}
+
+static const char bin_stream_end[] = {RESP_STREAM_END, '\0'};
+
+ssize_t parse_reply_array_header(
+    enum proto_version proto, uint32_t *size, struct const_slice buffer) {
+  if (proto == PROTO_BINARY) {
+    if (buffer.size < 1 + PROTO_SIZE_SIZE) {
+      return PARSE_MORE;
+    }
+    if (const_slice_get(buffer, 0) != RESP_ARRAY) {
+      return PARSE_ERR;
+    }
+    memcpy(size, (const uint8_t *)buffer.data + 1, PROTO_SIZE_SIZE);
+    return 1 + PROTO_SIZE_SIZE;
+  }
+
+  ssize_t res = parse_array_header(size, buffer);
+  if (res != PARSE_ERR) {
+    return res;
+  }
+  res = parse_literal(buffer, RESP_ARRAY_STREAM_START);
+  if (res > 0) {
+    *size = PROTO_SIZE_STREAMED;
+  }
+  return res;
+}
+
+ssize_t parse_reply_stream_end(
+    enum proto_version proto, struct const_slice buffer) {
+  return parse_literal(
+      buffer, proto == PROTO_BINARY ? bin_stream_end : RESP_STREAM_END_MARKER);
+}
+
+uint32_t reply_stream_end_size(enum proto_version proto) {
+  return proto == PROTO_BINARY ? sizeof(bin_stream_end) - 1
+                               : sizeof(RESP_STREAM_END_MARKER) - 1;
 }
 
 static void write_end(struct buffer *out) {
@@ -228,84 +285,269 @@ static void write_end(struct buffer *out) {
   buffer_append_byte(out, '\n');
 }
 
-void write_null_value(struct buffer *out) {
-  buffer_append_byte(out, RESP_NULL);
-  write_end(out);
+/** End a value, which only text protocols do */
+static void write_value_end(struct reply_out out) {
+  if (out.proto != PROTO_BINARY) {
+    write_end(out.buf);
+  }
 }
 
-void write_bool_value(struct buffer *out, bool val) {
-  buffer_append_byte(out, RESP_BOOLEAN);
-  buffer_append_byte(out, val ? 't' : 'f');
-  write_end(out);
+#define write_literal(out, str) buffer_append((out), (str), sizeof(str) - 1)
+
+/** A reply in each encoding, so that it can be written with a single copy */
+struct shared_reply_data {
+  const char *text;
+  const char *binary;
+  uint8_t text_size;
+  uint8_t binary_size;
+};
+
+// Binary sizes have to be spelled out, since they can't be generated from the
+// string. The tests check these against the regular encoding.
+#define SHARED_REPLY(type, str, bin_size)                                   \
+  {                                                                         \
+      .text = type str "\r\n",                                              \
+      .binary = type bin_size str,                                          \
+      .text_size = sizeof(type str "\r\n") - 1,                             \
+      .binary_size = sizeof(type bin_size str) - 1,                         \
+  }
+
+static const struct shared_reply_data shared_replies[] = {
+    [SHARED_OK] = SHARED_REPLY("+", "OK", "\2\0\0\0"),
+    [SHARED_ERR_COMMAND] = SHARED_REPLY("-", "invalid command", "\17\0\0\0"),
+    [SHARED_ERR_ARGS] =
+        SHARED_REPLY("-", "not enough arguments", "\24\0\0\0"),
+    [SHARED_ERR_NOT_STR] = SHARED_REPLY("-", "not string value", "\20\0\0\0"),
+    [SHARED_ERR_NOT_HMAP] =
+        SHARED_REPLY("-", "object not a hash map", "\25\0\0\0"),
+    [SHARED_ERR_NOT_HSET] =
+        SHARED_REPLY("-", "object not a set", "\20\0\0\0"),
+    [SHARED_ERR_NOT_ZSET] =
+        SHARED_REPLY("-", "object not a sorted set", "\27\0\0\0"),
+    [SHARED_ERR_PROTO] =
+        SHARED_REPLY("-", "unsupported protocol version", "\34\0\0\0"),
+    [SHARED_ERR_TTL] = SHARED_REPLY("-", "invalid ttl", "\13\0\0\0"),
+    [SHARED_ERR_SCORE] = SHARED_REPLY("-", "invalid score", "\15\0\0\0"),
+    [SHARED_ERR_OFFSET] = SHARED_REPLY("-", "invalid offset", "\16\0\0\0"),
+    [SHARED_ERR_LIMIT] = SHARED_REPLY("-", "invalid limit", "\15\0\0\0"),
+};
+
+static_assert(
+    sizeof(shared_replies) / sizeof(shared_replies[0]) == SHARED_REPLY_COUNT,
+    "missing shared replies");
+
+void write_shared_reply(struct reply_out out, enum shared_reply reply) {
+  assert(reply < SHARED_REPLY_COUNT);
+  const struct shared_reply_data *data = &shared_replies[reply];
+  if (out.proto == PROTO_BINARY) {
+    buffer_append(out.buf, data->binary, data->binary_size);
+  } else {
+    buffer_append(out.buf, data->text, data->text_size);
+  }
 }
 
-static void write_format_str(
-    struct buffer *out, enum resp_type type, const char *fmt, ...) {
-  buffer_append_byte(out, type);
-
-  // This seems to be a bug in the linter where it sometimes reports this
-  // va_list usage as invalid
-  // NOLINTBEGIN(clang-analyzer-valist.Uninitialized)
-  va_list args;
-  va_start(args, fmt);
-  // First try in case the buffer already has enough space available
-  int required_size =
-      vsnprintf(buffer_tail(out), buffer_remaining(out), fmt, args);
-  va_end(args);
-
-  assert(required_size >= 0);
-  if ((uint32_t)required_size > buffer_remaining(out)) {
-    // Write again if truncated
-    // Include +2 to make sure no second expansion is needed for \r\n
-    buffer_ensure_cap(out, required_size + 2);
-
-    va_start(args, fmt);
-    required_size =
-        vsnprintf(buffer_tail(out), buffer_remaining(out), fmt, args);
-    va_end(args);
-    // NOLINTEND(clang-analyzer-valist.Uninitialized)
-
-    assert(required_size >= 0);
-    assert((uint32_t)required_size <= buffer_remaining(out));
-  }
-  buffer_inc_size(out, required_size);
-  write_end(out);
+// The digits of small numbers followed by \r\n, padded to the same size so
+// they're copied with a fixed size
+#define DIGITS_10(prefix)                                             \
+  prefix "0\r\n", prefix "1\r\n", prefix "2\r\n", prefix "3\r\n",         \
+      prefix "4\r\n", prefix "5\r\n", prefix "6\r\n", prefix "7\r\n",     \
+      prefix "8\r\n", prefix "9\r\n"
+#define DIGITS_100(prefix)                                                \
+  DIGITS_10(prefix "0"), DIGITS_10(prefix "1"), DIGITS_10(prefix "2"),    \
+      DIGITS_10(prefix "3"), DIGITS_10(prefix "4"), DIGITS_10(prefix "5"), \
+      DIGITS_10(prefix "6"), DIGITS_10(prefix "7"), DIGITS_10(prefix "8"), \
+      DIGITS_10(prefix "9")
+
+static const char shared_uints[SHARED_UINT_COUNT][SHARED_UINT_SIZE] = {
+    // 0-9
+    DIGITS_10(""),
+    // 10-99
+    DIGITS_10("1"),
+    DIGITS_10("2"),
+    DIGITS_10("3"),
+    DIGITS_10("4"),
+    DIGITS_10("5"),
+    DIGITS_10("6"),
+    DIGITS_10("7"),
+    DIGITS_10("8"),
+    DIGITS_10("9"),
+    // 100-999
+    DIGITS_100("1"),
+    DIGITS_100("2"),
+    DIGITS_100("3"),
+    DIGITS_100("4"),
+    DIGITS_100("5"),
+    DIGITS_100("6"),
+    DIGITS_100("7"),
+    DIGITS_100("8"),
+    DIGITS_100("9"),
+};
+
+/** Write a number below `SHARED_UINT_COUNT` as text, with its type */
+static void write_shared_uint(
+    struct buffer *out, enum resp_type type, uint32_t val) {
+  assert(val < SHARED_UINT_COUNT);
+  buffer_ensure_cap(out, 1 + SHARED_UINT_SIZE);
+  char *tail = buffer_tail(out);
+  tail[0] = (char)type;
+  memcpy(tail + 1, shared_uints[val], SHARED_UINT_SIZE);
+  // Digits and \r\n
+  buffer_inc_size(out, 1 + 3 + (val >= 10) + (val >= 100));
 }
 
-void write_int_value(struct buffer *out, int_val_t n) {
-  write_format_str(out, RESP_NUMBER, "%ld", n);
+void write_null_value(struct reply_out out) {
+  if (out.proto == PROTO_BINARY) {
+    buffer_append_byte(out.buf, RESP_NULL);
+    return;
+  }
+  write_literal(out.buf, "_\r\n");
 }
 
-void write_float_value(struct buffer *out, double val) {
-  if (isnan(val)) {
-    write_format_str(out, RESP_DOUBLE, "nan");
-  } else if (isinf(val)) {
-    write_format_str(out, RESP_DOUBLE, val < 0 ? "-inf" : "inf");
+void write_bool_value(struct reply_out out, bool val) {
+  if (out.proto == PROTO_BINARY) {
+    const uint8_t bin[] = {RESP_BOOLEAN, val};
+    buffer_append(out.buf, bin, sizeof(bin));
+    return;
+  }
+  if (val) {
+    write_literal(out.buf, "#t\r\n");
   } else {
-    write_format_str(out, RESP_DOUBLE, "%g", val);
+    write_literal(out.buf, "#f\r\n");
   }
 }
 
-void write_simple_str_value(struct buffer *out, const char *str) {
-  buffer_append_byte(out, RESP_SIMPLE_STR);
-  // TODO: Assert str doesn't contain \r or \n
-  buffer_append_slice(out, make_str_slice(str));
+/** Write a binary value as it's represented in memory */
+static void write_bin_value(
+    struct buffer *out, enum resp_type type, const void *val, uint32_t size) {
+  buffer_ensure_cap(out, 1 + size);
+  char *tail = buffer_tail(out);
+  tail[0] = (char)type;
+  memcpy(tail + 1, val, size);
+  buffer_inc_size(out, 1 + size);
+}
+
+/**
+ * Start writing a number of up to `max_len` bytes, returning where it goes.
+ * Must be followed by `write_number_end`.
+ */
+static char *write_number_start(
+    struct buffer *out, enum resp_type type, uint32_t max_len) {
+  buffer_ensure_cap(out, 1 + max_len + 2);
+  char *tail = buffer_tail(out);
+  tail[0] = (char)type;
+  return tail + 1;
+}
+
+static void write_number_end(struct buffer *out, size_t len) {
+  buffer_inc_size(out, 1 + len);
   write_end(out);
 }
 
-void write_simple_err_value(struct buffer *out, const char *str) {
-  buffer_append_byte(out, RESP_SIMPLE_ERR);
+/** Write the size of a string or array */
+static void write_size_with_type(
+    struct reply_out out, enum resp_type type, proto_size_t size) {
+  if (out.proto == PROTO_BINARY) {
+    write_bin_value(out.buf, type, &size, sizeof(size));
+    return;
+  }
+  if (size < SHARED_UINT_COUNT) {
+    write_shared_uint(out.buf, type, size);
+    return;
+  }
+  char *digits = write_number_start(out.buf, type, NUMBER_UINT_MAX_LEN);
+  write_number_end(out.buf, number_format_uint(digits, size));
+}
+
+void write_int_value(struct reply_out out, int_val_t n) {
+  if (out.proto == PROTO_BINARY) {
+    write_bin_value(out.buf, RESP_NUMBER, &n, sizeof(n));
+    return;
+  }
+  if (n >= 0 && n < SHARED_UINT_COUNT) {
+    write_shared_uint(out.buf, RESP_NUMBER, n);
+    return;
+  }
+  char *digits = write_number_start(out.buf, RESP_NUMBER, NUMBER_INT_MAX_LEN);
+  write_number_end(out.buf, number_format_int(digits, n));
+}
+
+void write_float_value(struct reply_out out, double val) {
+  if (out.proto == PROTO_BINARY) {
+    write_bin_value(out.buf, RESP_DOUBLE, &val, sizeof(val));
+    return;
+  }
+  // Also leaves room for the null terminator
+  char *digits =
+      write_number_start(out.buf, RESP_DOUBLE, NUMBER_DOUBLE_BUF_SIZE);
+  write_number_end(out.buf, number_format_double(digits, val));
+}
+
+/** Write a string which can't contain line endings with text protocols */
+static void write_simple_value(
+    struct reply_out out, enum resp_type type, const char *str) {
+  struct const_slice slice = make_str_slice(str);
+  if (out.proto == PROTO_BINARY) {
+    write_size_with_type(out, type, slice.size);
+    buffer_append_slice(out.buf, slice);
+    return;
+  }
+
   // TODO: Assert str doesn't contain \r or \n
-  buffer_append_slice(out, make_str_slice(str));
-  write_end(out);
+  buffer_ensure_cap(out.buf, 1 + slice.size + 2);
+  char *tail = buffer_tail(out.buf);
+  tail[0] = (char)type;
+  memcpy(tail + 1, slice.data, slice.size);
+  memcpy(tail + 1 + slice.size, "\r\n", 2);
+  buffer_inc_size(out.buf, 1 + slice.size + 2);
 }
 
-void write_str_value(struct buffer *out, struct const_slice str) {
-  write_format_str(out, RESP_BLOB_STR, "%lu", str.size);
-  buffer_append_slice(out, str);
-  write_end(out);
+void write_simple_str_value(struct reply_out out, const char *str) {
+  write_simple_value(out, RESP_SIMPLE_STR, str);
+}
+
+void write_simple_err_value(struct reply_out out, const char *str) {
+  write_simple_value(out, RESP_SIMPLE_ERR, str);
+}
+
+void write_str_value(struct reply_out out, struct const_slice str) {
+  write_size_with_type(out, RESP_BLOB_STR, str.size);
+  buffer_append_slice(out.buf, str);
+  write_value_end(out);
+}
+
+void write_stored_str_value(
+    struct reply_out out, struct reply_refs *refs, const string *str) {
+  if (refs == NULL) {
+    write_str_value(out, string_const_slice(str));
+    return;
+  }
+
+  write_size_with_type(out, RESP_BLOB_STR, string_size(str));
+  if (!reply_refs_push(refs, out.buf, str)) {
+    buffer_append_slice(out.buf, string_const_slice(str));
+  }
+  write_value_end(out);
+}
+
+void write_array_header(struct reply_out out, uint32_t arr_size) {
+  write_size_with_type(out, RESP_ARRAY, arr_size);
 }
 
-void write_array_header(struct buffer *out, uint32_t arr_size) {
-  write_format_str(out, RESP_ARRAY, "%u", arr_size);
+void write_array_stream_start(struct reply_out out) {
+  assert(out.proto != PROTO_RESP2);
+  if (out.proto == PROTO_BINARY) {
+    write_size_with_type(out, RESP_ARRAY, PROTO_SIZE_STREAMED);
+    return;
+  }
+  buffer_append(
+      out.buf, RESP_ARRAY_STREAM_START, sizeof(RESP_ARRAY_STREAM_START) - 1);
+}
+
+void write_stream_end(struct reply_out out) {
+  if (out.proto == PROTO_BINARY) {
+    buffer_append_byte(out.buf, RESP_STREAM_END);
+    return;
+  }
+  buffer_append(
+      out.buf, RESP_STREAM_END_MARKER, sizeof(RESP_STREAM_END_MARKER) - 1);
 }
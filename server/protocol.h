@@ -7,12 +7,36 @@
 #include <sys/types.h>
 
 #include "buffer.h"
+#include "reply.h"
 #include "types.h"
 
+/*
+ * The binary protocol has the same types as RESP3, but sizes and numbers are
+ * little-endian binary instead of text, and there are no line endings.
+ *
+ * Requests are frames of a `proto_size_t` size followed by that many bytes:
+ * the `enum req_type` of the command as a single byte, and then each argument
+ * as a `proto_size_t` size and its data. Numeric arguments are an `int64_t` or
+ * a `double`.
+ *
+ * Replies are an `enum resp_type` byte followed by:
+ * - Null: nothing
+ * - Boolean: a byte of 0 or 1
+ * - Number: an `int64_t`
+ * - Double: a `double`
+ * - Strings and errors: a `proto_size_t` size and the data
+ * - Array: a `proto_size_t` count and the elements. Streamed arrays have a
+ *   count of `PROTO_SIZE_STREAMED` and end with a `RESP_STREAM_END` byte.
+ */
 typedef uint32_t proto_size_t;
 
 #define PROTO_SIZE_SIZE (sizeof(proto_size_t))
 #define PROTO_HEADER_SIZE PROTO_SIZE_SIZE
+#define PROTO_SIZE_STREAMED UINT32_MAX
+
+static_assert(
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+    "the binary protocol is written in native byte order");
 
 enum resp_type {
   RESP_NULL = '_',
@@ -23,8 +47,35 @@ enum resp_type {
   RESP_SIMPLE_ERR = '-',
   RESP_BLOB_STR = '$',
   RESP_ARRAY = '*',
+  // Ends an aggregate whose size wasn't known up front
+  RESP_STREAM_END = '.',
+};
+
+/** Protocols which can be negotiated with HELLO */
+enum proto_version {
+  // Aggregates always start with their size
+  PROTO_RESP2 = 2,
+  // Aggregates may also be streamed
+  PROTO_RESP3 = 3,
+  // Like RESP3, but with the binary encoding described above
+  PROTO_BINARY = 4,
 };
 
+/** Where a reply is written, and in which protocol */
+struct reply_out {
+  struct buffer *buf;
+  enum proto_version proto;
+};
+
+static inline struct reply_out make_reply_out(
+    struct buffer *buf, enum proto_version proto) {
+  return (struct reply_out){.buf = buf, .proto = proto};
+}
+
+// Header of a streamed array, and the marker ending it
+#define RESP_ARRAY_STREAM_START "*?\r\n"
+#define RESP_STREAM_END_MARKER ".\r\n"
+
 // Helpers for deserializing
 
 enum parse_result {
@@ -35,20 +86,89 @@ enum parse_result {
 
 ssize_t parse_array_header(uint32_t *size, struct const_slice buffer);
 ssize_t parse_blob_str(struct const_slice *str, struct const_slice buffer);
-
-bool parse_int_arg(int_val_t *val, struct const_slice input);
-bool parse_float_arg(double *val, struct const_slice input);
+/**
+ * Parse only the header of a blob string, giving the size of the data which
+ * follows it.
+ */
+ssize_t parse_blob_str_header(uint64_t *size, struct const_slice buffer);
+/** Parse the \r\n following the data of a blob string */
+ssize_t parse_blob_str_end(struct const_slice buffer);
+
+/** Parse the size and command of a binary request frame */
+ssize_t parse_bin_req_header(
+    proto_size_t *frame_size, uint8_t *req_type, struct const_slice buffer);
+/** Parse the size of a binary string, which is followed by its data */
+ssize_t parse_bin_str_header(uint64_t *size, struct const_slice buffer);
+ssize_t parse_bin_str(struct const_slice *str, struct const_slice buffer);
+
+/**
+ * Parse the header of an array reply, which is how replies from shards are
+ * merged. Streamed arrays are reported with a size of `PROTO_SIZE_STREAMED`.
+ */
+ssize_t parse_reply_array_header(
+    enum proto_version proto, uint32_t *size, struct const_slice buffer);
+/** Parse the marker which ends a streamed array reply */
+ssize_t parse_reply_stream_end(
+    enum proto_version proto, struct const_slice buffer);
+/** Size of the marker ending a streamed array */
+uint32_t reply_stream_end_size(enum proto_version proto);
+
+/** Parse a numeric argument, which is binary in the binary protocol */
+bool parse_int_arg(
+    int_val_t *val, enum proto_version proto, struct const_slice input);
+bool parse_float_arg(
+    double *val, enum proto_version proto, struct const_slice input);
 
 // Helpers for serializing
 
-void write_null_value(struct buffer *out);
-void write_bool_value(struct buffer *out, bool val);
-void write_int_value(struct buffer *out, int_val_t n);
-void write_float_value(struct buffer *out, double val);
-void write_simple_str_value(struct buffer *out, const char *str);
-void write_simple_err_value(struct buffer *out, const char *str);
-void write_str_value(struct buffer *out, struct const_slice str);
-void write_array_header(struct buffer *out, uint32_t arr_size);
+/** Replies which are encoded ahead of time */
+enum shared_reply {
+  SHARED_OK,
+  SHARED_ERR_COMMAND,
+  SHARED_ERR_ARGS,
+  SHARED_ERR_NOT_STR,
+  SHARED_ERR_NOT_HMAP,
+  SHARED_ERR_NOT_HSET,
+  SHARED_ERR_NOT_ZSET,
+  SHARED_ERR_PROTO,
+  SHARED_ERR_TTL,
+  SHARED_ERR_SCORE,
+  SHARED_ERR_OFFSET,
+  SHARED_ERR_LIMIT,
+  SHARED_REPLY_COUNT,
+};
+
+enum {
+  // Text numbers below this are copied from a table
+  SHARED_UINT_COUNT = 1000,
+  // Room for the digits and \r\n of each of them
+  SHARED_UINT_SIZE = 8,
+};
+
+/** Write a shared reply, which is a single copy */
+void write_shared_reply(struct reply_out out, enum shared_reply reply);
+void write_null_value(struct reply_out out);
+void write_bool_value(struct reply_out out, bool val);
+void write_int_value(struct reply_out out, int_val_t n);
+void write_float_value(struct reply_out out, double val);
+void write_simple_str_value(struct reply_out out, const char *str);
+void write_simple_err_value(struct reply_out out, const char *str);
+void write_str_value(struct reply_out out, struct const_slice str);
+/**
+ * Write a stored string, referencing its data instead of copying it if `refs`
+ * is given and the string is large enough.
+ */
+void write_stored_str_value(
+    struct reply_out out, struct reply_refs *refs, const string *str);
+void write_array_header(struct reply_out out, uint32_t arr_size);
+/**
+ * Start an array whose elements are written as they're found, without
+ * counting them first. It must be ended with `write_stream_end`.
+ *
+ * Not available with `PROTO_RESP2`.
+ */
+void write_array_stream_start(struct reply_out out);
+void write_stream_end(struct reply_out out);
 
 enum req_type {
   REQ_GET = 0,
@@ -58,6 +178,10 @@ enum req_type {
   REQ_TTL = 4,
   REQ_EXPIRE = 5,
   REQ_PERSIST = 6,
+  REQ_HELLO = 7,
+  REQ_TYPE = 8,
+  REQ_MGET = 9,
+  REQ_MSET = 10,
 
   REQ_HGET = 16,
   REQ_HSET = 17,
@@ -65,6 +189,7 @@ enum req_type {
   REQ_HLEN = 19,
   REQ_HKEYS = 20,
   REQ_HGETALL = 21,
+  REQ_HMGET = 22,
 
   REQ_SADD = 32,
   REQ_SISMEMBER = 33,
@@ -73,6 +198,7 @@ enum req_type {
   REQ_SRANDMEMBER = 36,
   REQ_SPOP = 37,
   REQ_SMEMBERS = 38,
+  REQ_SMISMEMBER = 39,
 
   REQ_ZSCORE = 48,
   REQ_ZADD = 49,
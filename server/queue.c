@@ -27,7 +27,9 @@ void work_queue_push(struct work_queue *queue, struct work_task task) {
   mtx_lock(&queue->lock);
 
   if (queue->head > 0 && queue->head + queue->size == queue->cap) {
-    memmove(queue->data, &queue->data[queue->head], queue->size);
+    memmove(
+        queue->data, &queue->data[queue->head],
+        sizeof(queue->data[0]) * queue->size);
     queue->head = 0;
   } else if (queue->size == queue->cap) {
     // Can't use re-alloc since the data will be moved inside the allocation
@@ -54,7 +56,9 @@ void work_queue_push_front(struct work_queue *queue, struct work_task task) {
 
   if (queue->head == 0) {
     if (queue->size < queue->cap) {
-      memmove(&queue->data[1], &queue->data[0], queue->size);
+      memmove(
+          &queue->data[1], &queue->data[0],
+          sizeof(queue->data[0]) * queue->size);
     } else {
       // Can't use re-alloc since the data will be moved inside the allocation
       uint32_t new_cap = queue->cap * 2;
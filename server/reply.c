@@ -0,0 +1,159 @@
+#include "reply.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include "buffer.h"
+#include "types.h"
+
+enum {
+  REPLY_REFS_INIT_CAP = 8,
+};
+
+void reply_refs_init(struct reply_refs *refs) {
+  refs->count = 0;
+  // Allocated on first use since most replies don't reference anything
+  refs->cap = 0;
+  refs->refs = NULL;
+  refs->sent_count = 0;
+  refs->sent_size = 0;
+  refs->unsent_size = 0;
+}
+
+void reply_refs_destroy(struct reply_refs *refs) {
+  for (uint32_t i = refs->sent_count; i < refs->count; i++) {
+    string_shared_data_release(refs->refs[i].owner);
+  }
+  free(refs->refs);
+}
+
+static void reply_refs_add(struct reply_refs *refs, struct reply_ref ref) {
+  if (refs->count == refs->cap) {
+    refs->cap = refs->cap == 0 ? REPLY_REFS_INIT_CAP : refs->cap * 2;
+    refs->refs = realloc(refs->refs, sizeof(refs->refs[0]) * refs->cap);
+    assert(refs->refs != NULL);
+  }
+
+  assert(refs->count == 0 || refs->refs[refs->count - 1].offset <= ref.offset);
+  refs->refs[refs->count++] = ref;
+  refs->unsent_size += ref.data.size;
+}
+
+bool reply_refs_push(
+    struct reply_refs *refs, const struct buffer *buf, const string *str) {
+  struct string_shared_data *owner = string_share(str);
+  if (owner == NULL) {
+    return false;
+  }
+
+  reply_refs_add(
+      refs, (struct reply_ref){
+                .offset = buf->size,
+                .owner = owner,
+                .data = string_const_slice(str),
+            });
+  return true;
+}
+
+void reply_refs_move(
+    struct reply_refs *dest, uint32_t base_offset, struct reply_refs *src) {
+  assert(src->sent_count == 0);
+  for (uint32_t i = 0; i < src->count; i++) {
+    struct reply_ref ref = src->refs[i];
+    ref.offset += base_offset;
+    reply_refs_add(dest, ref);
+  }
+
+  src->count = 0;
+  src->unsent_size = 0;
+}
+
+size_t reply_remaining(
+    const struct offset_buf *buf, const struct reply_refs *refs) {
+  return (buf->buf.size - buf->start) + refs->unsent_size;
+}
+
+/** End of the buffer data which is sent before the next reference */
+static uint32_t reply_next_ref_offset(
+    const struct offset_buf *buf, const struct reply_refs *refs,
+    uint32_t ref_index) {
+  if (ref_index < refs->count) {
+    return refs->refs[ref_index].offset;
+  }
+  return buf->buf.size;
+}
+
+int reply_fill_iov(
+    const struct offset_buf *buf, const struct reply_refs *refs,
+    struct iovec *iov, int max_iov) {
+  const uint8_t *data = buf->buf.data;
+  uint32_t pos = buf->start;
+  uint32_t ref_index = refs->sent_count;
+  size_t ref_sent = refs->sent_size;
+
+  int iov_count = 0;
+  while (iov_count < max_iov) {
+    uint32_t end = reply_next_ref_offset(buf, refs, ref_index);
+    if (end > pos) {
+      iov[iov_count++] = (struct iovec){
+          .iov_base = (void *)(data + pos),
+          .iov_len = end - pos,
+      };
+      pos = end;
+      continue;
+    }
+
+    if (ref_index == refs->count) {
+      break;
+    }
+
+    const struct reply_ref *ref = &refs->refs[ref_index];
+    iov[iov_count++] = (struct iovec){
+        .iov_base = (void *)((const uint8_t *)ref->data.data + ref_sent),
+        .iov_len = ref->data.size - ref_sent,
+    };
+    ref_index++;
+    ref_sent = 0;
+  }
+
+  return iov_count;
+}
+
+void reply_advance(
+    struct offset_buf *buf, struct reply_refs *refs, size_t size) {
+  while (size > 0) {
+    if (refs->sent_count < refs->count &&
+        buf->start == refs->refs[refs->sent_count].offset) {
+      struct reply_ref *ref = &refs->refs[refs->sent_count];
+      size_t ref_remaining = ref->data.size - refs->sent_size;
+      size_t sent = size < ref_remaining ? size : ref_remaining;
+      refs->sent_size += sent;
+      refs->unsent_size -= sent;
+      size -= sent;
+
+      if (refs->sent_size == ref->data.size) {
+        string_shared_data_release(ref->owner);
+        refs->sent_count++;
+        refs->sent_size = 0;
+      }
+      continue;
+    }
+
+    uint32_t end = reply_next_ref_offset(buf, refs, refs->sent_count);
+    assert(end > buf->start);
+    uint32_t sent = size < end - buf->start ? size : end - buf->start;
+    offset_buf_advance(buf, sent);
+    size -= sent;
+  }
+
+  if (buf->start == buf->buf.size && refs->sent_count == refs->count) {
+    offset_buf_reset(buf);
+    refs->count = 0;
+    refs->sent_count = 0;
+    refs->sent_size = 0;
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef REPLY_H_
+#define REPLY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "buffer.h"
+#include "types.h"
+
+/**
+ * Data spliced into a reply instead of being copied into its buffer.
+ *
+ * The data is kept alive by a reference to the string it came from until it
+ * has been sent.
+ */
+struct reply_ref {
+  // Position in the reply buffer where the data is inserted
+  uint32_t offset;
+  struct string_shared_data *owner;
+  struct const_slice data;
+};
+
+/**
+ * References spliced into a reply buffer, in order of their offsets.
+ *
+ * Together with the buffer, this makes up a reply which is sent with a single
+ * gathering write.
+ */
+struct reply_refs {
+  uint32_t count;
+  uint32_t cap;
+  struct reply_ref *refs;
+
+  // First reference which hasn't been sent completely, and how much of it has
+  // been sent
+  uint32_t sent_count;
+  size_t sent_size;
+  // Size of the referenced data not sent yet
+  size_t unsent_size;
+};
+
+void reply_refs_init(struct reply_refs *refs);
+/** Releases all references, including those which were not sent. */
+void reply_refs_destroy(struct reply_refs *refs);
+
+static inline bool reply_refs_empty(const struct reply_refs *refs) {
+  return refs->count == 0;
+}
+
+/**
+ * Splice the string's data in at the current end of `buf`.
+ *
+ * Returns `false` if the string's data can't be referenced, in which case it
+ * has to be copied.
+ */
+bool reply_refs_push(
+    struct reply_refs *refs, const struct buffer *buf, const string *str);
+
+/**
+ * Move all references from `src` into `dest`, where the buffer of `src` was
+ * appended to the buffer of `dest` at `base_offset`.
+ */
+void reply_refs_move(
+    struct reply_refs *dest, uint32_t base_offset, struct reply_refs *src);
+
+/** Size of the reply which still has to be sent */
+size_t reply_remaining(
+    const struct offset_buf *buf, const struct reply_refs *refs);
+
+/**
+ * Fill `iov` with the parts of the reply which still have to be sent.
+ *
+ * Returns the number of entries used, which is at most `max_iov`.
+ */
+int reply_fill_iov(
+    const struct offset_buf *buf, const struct reply_refs *refs,
+    struct iovec *iov, int max_iov);
+
+/**
+ * Mark `size` bytes of the reply as sent, releasing the references which were
+ * sent completely.
+ *
+ * Both the buffer and references are reset once everything has been sent.
+ */
+void reply_advance(
+    struct offset_buf *buf, struct reply_refs *refs, size_t size);
+
+#endif
@@ -1,42 +1,128 @@
+// Needed for SO_REUSEPORT and CPU affinity
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
-#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <threads.h>
 #include <unistd.h>
 
+#include "buf_pool.h"
 #include "buffer.h"
 #include "commands.h"
-#include "heap.h"
+#include "hashmap.h"
 #include "list.h"
+#include "log.h"
+#include "mailbox.h"
 #include "protocol.h"
 #include "queue.h"
+#include "reply.h"
 #include "store.h"
+#include "timer_wheel.h"
 #include "types.h"
+#include "uring.h"
 
 enum {
-  PORT = 1234,
+  DEFAULT_PORT = 1234,
+  LISTEN_MAX = 16,
+  UNIX_MODE_BASE = 8,
+  UNIX_MODE_MAX = 07777,
 
   MAX_EVENTS = 256,
 
-  READ_BUF_INIT_CAP = 4096,
   // Minimum amount of space in the buffer before expanding
   READ_BUF_MIN_CAP = 4096,
+  // Shared by all connections of a loop for receiving whole requests
+  READ_SCRATCH_SIZE = 64 * 1024,
+  // Receiving stops while more than this is buffered and can't be processed
+  READ_PAUSE_SIZE = 256 * 1024,
+
+  // Larger arguments are received directly into their own allocation
+  ARG_STREAM_MIN_SIZE = 64 * 1024,
+  ARG_MAX_SIZE = 512 * 1024 * 1024,
+  // Arguments which fit in the parser itself, without an allocation
+  REQ_INLINE_ARGS = 8,
 
   WRITE_BUF_INIT_CAP = 4096,
+  // Flush replies early once this much output is buffered
+  WRITE_BUF_FLUSH_SIZE = 64 * 1024,
+  // Maximum number of buffer pieces and referenced values sent at once
+  WRITE_IOV_MAX = 16,
+
+  // Maximum pipelined requests handled before letting other connections run
+  PIPELINE_MAX_REQS = 128,
 
   CONN_TIMEOUT_US = 60 * USEC_PER_SEC,
 
   EXPIRE_MAX_WORK = 20,
+
+  SHARD_REPLY_INIT_CAP = 256,
+  GATHER_BUF_INIT_CAP = 1024,
+
+  MAX_THREADS = 256,
+  // One for each event loop and one for the async worker
+  MAX_PINNED_CPUS = MAX_THREADS + 1,
+  PARSE_COUNT_BASE = 10,
+  // Longest command name included in request logs
+  LOG_CMD_MAX = 32,
+  // How often busy-polling loops report how much they spun
+  BUSY_POLL_REPORT_US = 10 * 1000 * 1000,
+  MAX_CLIENTS_MAX = 1000000,
+  OVERLOAD_LATENCY_MS_MAX = 60 * 1000,
+  // Iteration latency is averaged with a weight of 1/2^shift for the latest
+  OVERLOAD_AVG_SHIFT = 2,
+  // How long a loop keeps shedding load after its latency was last too high
+  OVERLOAD_HOLD_US = 1000 * 1000,
+  // Room for the error sent to a rejected client
+  ADMIT_ERR_MAX = 64,
+  PERCENT = 100,
+  KIB_SHIFT = 10,
+  MIB_SHIFT = 20,
+  GIB_SHIFT = 30,
+
+  URING_ENTRIES = 256,
+  URING_RECV_BUF_GROUP = 0,
+  URING_RECV_BUF_COUNT = 256,
+  URING_RECV_BUF_SIZE = 4096,
+};
+
+// Sent to clients while their event loop is shedding load
+static const char OVERLOADED_ERR[] = "BUSY server is overloaded";
+// Sent for requests whose keys can't be handled by a single shard
+static const char CROSS_SHARD_ERR[] =
+    "CROSSSHARD keys in request are on different shards";
+
+enum io_backend {
+  IO_BACKEND_EPOLL,
+  IO_BACKEND_URING,
+};
+
+/** Operation type, stored in the low bits of io_uring user data */
+enum uring_op {
+  URING_OP_ACCEPT = 0,
+  URING_OP_MAILBOX = 1,
+  URING_OP_RECV = 2,
+  URING_OP_SEND = 3,
+  URING_OP_CANCEL = 4,
+
+  URING_OP_MASK = 7,
 };
 
 enum conn_state {
@@ -45,13 +131,39 @@ enum conn_state {
   CONN_PROCESS_REQ,
   CONN_WAIT_WRITE,
   CONN_WRITE_RES,
+  // Waiting for replies from other shards
+  CONN_WAIT_REMOTE,
+  // Requests may still be buffered, but other connections get to run first
+  CONN_YIELD,
   CONN_CLOSE,
+  // Waiting for outstanding io_uring operations before closing
+  CONN_WAIT_CLOSE,
 };
 
+/**
+ * Arguments of the next request, borrowed from the read buffer.
+ *
+ * The arguments are only valid until the read buffer changes, so incomplete
+ * requests are parsed again from the start once more data arrives.
+ */
 struct req_parser {
-  int arg_count;
-  string args[COMMAND_ARGS_MAX];
-  int parsed_args;
+  uint32_t arg_count;
+  // Points to `inline_args` unless the request has more arguments than fit
+  struct const_slice *args;
+  uint32_t args_cap;
+  struct const_slice inline_args[REQ_INLINE_ARGS];
+  // Size of the whole request in the read buffer
+  uint32_t size;
+
+  // Large arguments received directly into their own allocation. Only their
+  // headers are kept in the read buffer. Allocated with the first one, and
+  // the other `owned_cap` entries are empty small strings.
+  string *owned_args;
+  uint32_t owned_cap;
+  // Whether data is currently received into `owned_args[stream_index]`
+  bool streaming;
+  uint32_t stream_index;
+  size_t stream_size;
 };
 
 struct conn {
@@ -62,194 +174,676 @@ struct conn {
 
   int fd;
   enum conn_state state;
-  uint64_t idle_start_us;
-  struct dlist_node timeout_node;
+  // Expires once the connection has been idle for too long
+  struct timer idle_timer;
+  // Armed while the pending output is over the soft limit
+  struct timer output_limit_timer;
 
+  // Buffers are only allocated while data is in flight
   struct offset_buf read_buf;
+  // The read buffer is memory shared by the loop, which is only valid until
+  // the connection stops running
+  bool read_buf_borrowed;
   struct req_parser req_parser;
+  // Starts out as RESP2 until the client switches with HELLO
+  enum proto_version proto;
 
   struct offset_buf write_buf;
+  // Values spliced into the output without copying them into `write_buf`
+  struct reply_refs write_refs;
+
+  // Requests handled since the connection was last woken up
+  uint32_t batch_reqs;
+  // Node in the list of yielded connections
+  struct dlist_node ready_node;
+
+  // Number of replies from other shards still to be received
+  uint32_t pending_replies;
+  // The peer went away while replies were pending, so the connection is
+  // closed once they have all been received
+  bool close_pending;
+  // Merged array elements for requests sent to all shards
+  uint32_t gather_count;
+  struct buffer gather_buf;
+
+  // io_uring operations which still reference the connection
+  uint32_t uring_ops;
+  bool recv_armed;
+  // Receiving is stopped while too much data is buffered
+  bool recv_paused;
+  bool send_pending;
+  // Referenced by the pending send
+  struct msghdr send_msg;
+  struct iovec send_iov[WRITE_IOV_MAX];
+};
+
+/** Limits on the data buffered for each connection, 0 for no limit */
+struct conn_limits {
+  // Unprocessed input, including arguments being received
+  uint64_t query_max;
+  // Pending output over which the connection is closed right away
+  uint64_t output_hard;
+  // Pending output which the connection may only stay over for a while
+  uint64_t output_soft;
+  uint64_t output_soft_us;
+};
+
+/** Address of a TCP or Unix socket to accept connections on */
+struct listen_addr {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  // Permissions of a Unix socket, or -1 to leave them as created
+  int unix_mode;
+};
+
+struct server_config {
+  unsigned threads;
+  enum io_backend backend;
+  struct conn_limits limits;
+  unsigned listen_count;
+  struct listen_addr listen_addrs[LISTEN_MAX];
+  enum log_level log_level;
+  uint32_t log_sample_rate;
+  bool busy_poll;
+  // Maximum number of connected clients, 0 for no limit
+  unsigned max_clients;
+  // Iteration latency over which an event loop sheds load, 0 to never
+  uint64_t overload_latency_us;
+  // CPUs for the event loops in order, then for the async worker
+  unsigned cpu_count;
+  int cpus[MAX_PINNED_CPUS];
+};
+
+struct listener {
+  const struct listen_addr *addr;
+  int fd;
 };
 
+struct server_group;
+
+/**
+ * A single event loop and the shard of the store it owns.
+ *
+ * Nothing in here is shared between threads except for the mailbox.
+ */
 struct server_state {
-  int socket_fd;
+  struct server_group *group;
+  unsigned shard_id;
+  // CPU to pin the loop's thread to, or -1
+  int cpu;
+
+  unsigned listener_count;
+  struct listener listeners[LISTEN_MAX];
   int epoll_fd;
 
+  struct uring ring;
+  struct uring_buf_ring recv_bufs;
+  // Target for reading the mailbox eventfd
+  uint64_t mailbox_count;
+
   struct store store;
 
   // Free-list of connection objects
   struct list free_conn_pool;
+  // Allocations for connection buffers
+  struct buf_pool buf_pool;
+  uint8_t *recv_scratch;
+  // Hashes of the keys of the request being dispatched, by argument index
+  hash_t *key_hashes;
+  uint32_t key_hashes_cap;
   // Active connections
   struct dlist active_conns;
 
-  struct dlist idle_timeouts;
+  struct timer_wheel idle_timeouts;
+  struct timer_wheel output_limit_timeouts;
+  // Connections which yielded with requests possibly still buffered
+  struct dlist ready_conns;
+
+  // Requests and replies from other shards
+  struct mailbox mailbox;
+  // eventfd for waking up the loop when the mailbox becomes non-empty
+  int mailbox_fd;
+
+  // Set while iterations of the loop take too long, to reject new connections
+  // and requests
+  bool overloaded;
+  // Moving average of iteration latency, scaled by 2^OVERLOAD_AVG_SHIFT
+  uint64_t iter_avg_scaled_us;
+  // Time before which an overloaded loop keeps shedding load
+  uint64_t shed_until_us;
+
+  // Time spent by a busy-polling loop since its last report
+  uint64_t spin_us;
+  uint64_t work_us;
+  uint64_t report_start_us;
+  uint64_t iter_end_us;
+};
+
+/** State shared by all event loops */
+struct server_group {
+  enum io_backend backend;
+  struct conn_limits limits;
+  unsigned listen_count;
+  struct listen_addr listen_addrs[LISTEN_MAX];
+  // Poll for events without ever blocking
+  bool busy_poll;
+  unsigned max_clients;
+  uint64_t overload_latency_us;
+  // Connections open on all event loops
+  atomic_uint client_count;
+  unsigned shard_count;
+  struct server_state *shards;
 
   thrd_t async_task_thread;
   struct work_queue async_task_queue;
+  int async_task_cpu;
+};
+
+enum shard_msg_type {
+  SHARD_MSG_REQ,
+  SHARD_MSG_RES,
+};
+
+/**
+ * Request forwarded to the shard owning its key. The same object is sent back
+ * to the origin with the reply.
+ */
+struct shard_msg {
+  struct mailbox_node node;
+  enum shard_msg_type type;
+
+  struct server_state *origin;
+  struct conn *conn;
+  // Copied from the connection, which may change it while the message is
+  // in flight
+  enum proto_version proto;
+
+  uint32_t arg_count;
+  string *args;
+  // Computed by the origin to route the request. May be NULL.
+  hash_t *key_hashes;
+
+  struct buffer out;
+  struct reply_refs out_refs;
 };
 
 [[noreturn]] static void die_errno(const char *msg) {
+  // Keep the messages leading up to the error before it
+  log_flush();
   perror(msg);
   exit(EXIT_FAILURE);
 }
 
-static int set_nonblocking(int fildes) {
-  int flags = fcntl(fildes, F_GETFL);
-  if (flags == -1) {
-    return -1;
+static void print_listen_addr(const struct sockaddr *addr, socklen_t len) {
+  if (addr->sa_family == AF_UNIX) {
+    const struct sockaddr_un *unix_addr = (const struct sockaddr_un *)addr;
+    log_msg(LOG_INFO, "listening on %s", unix_addr->sun_path);
+    return;
   }
 
-  flags = fcntl(fildes, F_SETFL, flags | O_NONBLOCK);
-  if (flags == -1) {
-    return -1;
+  char host[NI_MAXHOST];
+  char port[NI_MAXSERV];
+  int res = getnameinfo(
+      addr, len, host, sizeof(host), port, sizeof(port),
+      NI_NUMERICHOST | NI_NUMERICSERV);
+  if (res != 0) {
+    log_msg(LOG_INFO, "listening on unknown address");
+    return;
   }
+  if (addr->sa_family == AF_INET6) {
+    log_msg(LOG_INFO, "listening on [%s]:%s", host, port);
+  } else {
+    log_msg(LOG_INFO, "listening on %s:%s", host, port);
+  }
+}
 
-  return 0;
+/** Remove a socket file left behind by a previous run */
+static void remove_stale_unix_socket(const char *path) {
+  struct stat path_stat;
+  if (lstat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+    if (unlink(path) == -1) {
+      die_errno("failed to remove stale socket");
+    }
+  }
 }
 
 // TODO Return error to caller instead of dying?
-static int setup_socket(void) {
+static int setup_socket(
+    const struct listen_addr *listen_addr, bool reuse_port) {
   // result variable used for various syscalls
   int res;
 
-  int socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  const struct sockaddr *addr = (const struct sockaddr *)&listen_addr->addr;
+  bool is_unix = addr->sa_family == AF_UNIX;
+  int socket_fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
   if (socket_fd == -1) {
     die_errno("failed to open socket");
   }
 
   int val = 1;
-  res = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-  if (res == -1) {
-    die_errno("failed to configure socket");
+  if (!is_unix) {
+    res = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    if (res == -1) {
+      die_errno("failed to configure socket");
+    }
   }
 
-  struct sockaddr_in addr = {
-      .sin_family = AF_INET,
-      .sin_port = ntohs(PORT),
-      .sin_addr = {ntohl(INADDR_LOOPBACK)},
-  };
-  res = bind(socket_fd, (const struct sockaddr *)&addr, sizeof(addr));
+  // Each event loop has its own listening socket and the kernel balances
+  // new connections between them
+  if (reuse_port) {
+    res = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    if (res == -1) {
+      die_errno("failed to configure socket");
+    }
+  }
+
+  if (addr->sa_family == AF_INET6) {
+    // Don't also take the IPv4 port, which may be listened on separately
+    res = setsockopt(socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &val, sizeof(val));
+    if (res == -1) {
+      die_errno("failed to configure socket");
+    }
+  }
+
+  const char *unix_path = ((const struct sockaddr_un *)addr)->sun_path;
+  if (is_unix) {
+    remove_stale_unix_socket(unix_path);
+  }
+
+  res = bind(socket_fd, addr, listen_addr->addr_len);
   if (res == -1) {
     die_errno("failed to bind socket");
   }
 
+  if (is_unix && listen_addr->unix_mode >= 0) {
+    res = chmod(unix_path, (mode_t)listen_addr->unix_mode);
+    if (res == -1) {
+      die_errno("failed to set socket permissions");
+    }
+  }
+
   res = listen(socket_fd, SOMAXCONN);
   if (res == -1) {
     die_errno("failed to listen on socket");
   }
 
-  struct sockaddr_in bound_addr;
+  struct sockaddr_storage bound_addr;
   socklen_t bound_addr_size = sizeof(bound_addr);
   res =
       getsockname(socket_fd, (struct sockaddr *)&bound_addr, &bound_addr_size);
-  if (res == 0 && bound_addr.sin_family == AF_INET) {
-    char addr_name[INET_ADDRSTRLEN];
-    const char *addr_res =
-        inet_ntop(AF_INET, &bound_addr.sin_addr, addr_name, sizeof(addr_name));
-    if (addr_res == NULL) {
-      perror("failed to get bound address name");
-    }
-
-    unsigned short addr_port = ntohs(bound_addr.sin_port);
-    fprintf(stderr, "listening on %s:%d\n", addr_name, addr_port);
+  if (res == 0) {
+    print_listen_addr((const struct sockaddr *)&bound_addr, bound_addr_size);
   } else {
-    fprintf(stderr, "listening on unknown address\n");
+    log_msg(LOG_INFO, "listening on unknown address");
   }
 
   return socket_fd;
 }
 
 static void req_parser_init(struct req_parser *parser) {
-  parser->arg_count = -1;
-  parser->parsed_args = 0;
+  parser->arg_count = 0;
+  parser->args = parser->inline_args;
+  parser->args_cap = REQ_INLINE_ARGS;
+  parser->size = 0;
+  parser->owned_args = NULL;
+  parser->owned_cap = 0;
+  parser->streaming = false;
+}
+
+/** Drop the current request, including any arguments it owns */
+static void req_parser_reset(struct req_parser *parser) {
+  for (uint32_t i = 0; i < parser->owned_cap; i++) {
+    string_destroy(&parser->owned_args[i]);
+  }
+  free(parser->owned_args);
+  if (parser->args != parser->inline_args) {
+    free(parser->args);
+  }
+  req_parser_init(parser);
+}
+
+static bool req_parser_owns(const struct req_parser *parser, uint32_t index) {
+  // Owned arguments are always too large to be small strings
+  return index < parser->owned_cap && !parser->owned_args[index].is_small;
+}
+
+/** Make room for the argument at `index`, keeping the ones before it */
+static void req_parser_reserve(struct req_parser *parser, uint32_t index) {
+  if (index < parser->args_cap) {
+    return;
+  }
+
+  uint32_t new_cap = parser->args_cap * 2;
+  struct const_slice *new_args;
+  if (parser->args == parser->inline_args) {
+    new_args = malloc(sizeof(*new_args) * new_cap);
+    assert(new_args != NULL);
+    memcpy(new_args, parser->inline_args, sizeof(parser->inline_args));
+  } else {
+    new_args = realloc(parser->args, sizeof(*new_args) * new_cap);
+    assert(new_args != NULL);
+  }
+  parser->args = new_args;
+  parser->args_cap = new_cap;
+}
+
+/** Make room for the owned argument at `index` */
+static void req_parser_reserve_owned(
+    struct req_parser *parser, uint32_t index) {
+  if (index < parser->owned_cap) {
+    return;
+  }
+
+  uint32_t new_cap = parser->args_cap;
+  assert(index < new_cap);
+  string *new_owned =
+      realloc(parser->owned_args, sizeof(*new_owned) * new_cap);
+  assert(new_owned != NULL);
+  for (uint32_t i = parser->owned_cap; i < new_cap; i++) {
+    new_owned[i] = string_create(0);
+  }
+  parser->owned_args = new_owned;
+  parser->owned_cap = new_cap;
+}
+
+/**
+ * Copy received data into the argument being streamed.
+ *
+ * Returns how much of `data` was used.
+ */
+static size_t req_parser_stream(
+    struct req_parser *parser, struct const_slice data) {
+  assert(parser->streaming);
+  string *arg = &parser->owned_args[parser->stream_index];
+  size_t remaining = string_size(arg) - parser->stream_size;
+  size_t used = data.size < remaining ? data.size : remaining;
+  memcpy(string_data(arg) + parser->stream_size, data.data, used);
+
+  parser->stream_size += used;
+  if (parser->stream_size == string_size(arg)) {
+    parser->streaming = false;
+  }
+  return used;
 }
 
 static void conn_init(struct conn *conn, int fildes) {
   conn->fd = fildes;
   conn->state = CONN_READ_REQ;
-  conn->idle_start_us = get_monotonic_usec();
+  timer_init(&conn->idle_timer);
+  timer_init(&conn->output_limit_timer);
 
-  offset_buf_init(&conn->read_buf, READ_BUF_INIT_CAP);
+  offset_buf_init_unallocated(&conn->read_buf);
+  conn->read_buf_borrowed = false;
   req_parser_init(&conn->req_parser);
+  conn->proto = PROTO_RESP2;
+
+  offset_buf_init_unallocated(&conn->write_buf);
+  reply_refs_init(&conn->write_refs);
+  conn->batch_reqs = 0;
+
+  conn->pending_replies = 0;
+  conn->close_pending = false;
+  conn->gather_count = 0;
+  conn->gather_buf.data = NULL;
+
+  conn->uring_ops = 0;
+  conn->recv_armed = false;
+  conn->recv_paused = false;
+  conn->send_pending = false;
+}
+
+static void conn_release_read_buf(
+    struct server_state *server, struct conn *conn) {
+  if (!conn->read_buf_borrowed) {
+    buf_pool_release(&server->buf_pool, &conn->read_buf.buf);
+  }
+  conn->read_buf_borrowed = false;
+  offset_buf_init_unallocated(&conn->read_buf);
+}
 
-  offset_buf_init(&conn->write_buf, WRITE_BUF_INIT_CAP);
+/** Move unprocessed input out of borrowed memory into a pooled buffer */
+static void conn_own_read_buf(struct server_state *server, struct conn *conn) {
+  if (!conn->read_buf_borrowed) {
+    return;
+  }
+
+  struct const_slice input = offset_buf_head_slice(&conn->read_buf);
+  conn_release_read_buf(server, conn);
+  if (input.size > 0) {
+    buf_pool_acquire(&server->buf_pool, &conn->read_buf.buf, input.size);
+    buffer_append_slice(&conn->read_buf.buf, input);
+  }
+}
+
+static void conn_acquire_write_buf(
+    struct server_state *server, struct conn *conn) {
+  if (conn->write_buf.buf.data == NULL) {
+    buf_pool_acquire(
+        &server->buf_pool, &conn->write_buf.buf, WRITE_BUF_INIT_CAP);
+  }
+}
+
+static void uring_update_recv(struct server_state *server, struct conn *conn);
+
+/**
+ * Arm the timer which closes the connection if it stays over the output soft
+ * limit for too long.
+ */
+static void conn_update_output_limit_timer(
+    struct server_state *server, struct conn *conn) {
+  const struct conn_limits *limits = &server->group->limits;
+  struct timer *timer = &conn->output_limit_timer;
+  size_t pending = reply_remaining(&conn->write_buf, &conn->write_refs);
+  if (limits->output_soft == 0 || pending <= limits->output_soft) {
+    timer_wheel_cancel(&server->output_limit_timeouts, timer);
+  } else if (!timer_armed(timer)) {
+    timer_wheel_arm(
+        &server->output_limit_timeouts, timer,
+        get_monotonic_usec() + limits->output_soft_us);
+  }
+}
+
+/**
+ * Called once the connection stops running until its next event. Input left in
+ * borrowed memory is moved out, and buffers without any data go back to the
+ * pool so idle connections don't hold on to them.
+ */
+static void conn_park(struct server_state *server, struct conn *conn) {
+  conn_own_read_buf(server, conn);
+  if (offset_buf_remaining(&conn->read_buf) == 0) {
+    conn_release_read_buf(server, conn);
+  }
+
+  if (!conn->send_pending &&
+      reply_remaining(&conn->write_buf, &conn->write_refs) == 0) {
+    buf_pool_release(&server->buf_pool, &conn->write_buf.buf);
+    conn->write_buf.start = 0;
+  }
+
+  if (conn->state == CONN_WAIT_CLOSE) {
+    return;
+  }
+  conn_update_output_limit_timer(server, conn);
+  if (server->group->backend == IO_BACKEND_URING) {
+    uring_update_recv(server, conn);
+  }
 }
 
 /**
  * Free resources, but not the whole connection object since it can be re-used
  */
-static void conn_cleanup(struct conn *conn) {
+static void conn_cleanup(struct server_state *server, struct conn *conn) {
   conn->fd = -1;
-  offset_buf_destroy(&conn->read_buf);
-  offset_buf_destroy(&conn->write_buf);
+  conn_release_read_buf(server, conn);
+  req_parser_reset(&conn->req_parser);
+  buf_pool_release(&server->buf_pool, &conn->write_buf.buf);
+  reply_refs_destroy(&conn->write_refs);
 }
 
 static int run_worker_thread(void *arg);
 
-static void server_state_setup(struct server_state *server) {
-  server->socket_fd = setup_socket();
+static void server_state_setup(
+    struct server_state *server, struct server_group *group,
+    unsigned shard_id, int cpu) {
+  server->group = group;
+  server->shard_id = shard_id;
+  server->cpu = cpu;
+
+  server->listener_count = group->listen_count;
+  for (unsigned i = 0; i < group->listen_count; i++) {
+    struct listener *listener = &server->listeners[i];
+    listener->addr = &group->listen_addrs[i];
+    // Unix sockets can't share their path, so a single one is shared by all
+    // event loops instead
+    bool is_unix = listener->addr->addr.ss_family == AF_UNIX;
+    if (is_unix && shard_id > 0) {
+      listener->fd = group->shards[0].listeners[i].fd;
+    } else {
+      listener->fd =
+          setup_socket(listener->addr, !is_unix && group->shard_count > 1);
+    }
+  }
+
+  uint64_t now_us = get_monotonic_usec();
+  store_init(&server->store, now_us);
+  list_init(&server->free_conn_pool);
+  buf_pool_init(&server->buf_pool);
+  server->recv_scratch = NULL;
+  server->key_hashes = NULL;
+  server->key_hashes_cap = 0;
+  dlist_init(&server->active_conns);
+
+  timer_wheel_init(&server->idle_timeouts, now_us);
+  timer_wheel_init(&server->output_limit_timeouts, now_us);
+  dlist_init(&server->ready_conns);
+
+  server->overloaded = false;
+  server->iter_avg_scaled_us = 0;
+  server->shed_until_us = 0;
+  server->spin_us = 0;
+  server->work_us = 0;
+  server->report_start_us = now_us;
+  server->iter_end_us = now_us;
+
+  mailbox_init(&server->mailbox);
+  server->mailbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (server->mailbox_fd == -1) {
+    die_errno("failed to create eventfd");
+  }
+
+  // The io_uring is set up by the thread running the loop since it can only
+  // be used by a single thread
+  server->epoll_fd = -1;
+  if (group->backend != IO_BACKEND_EPOLL) {
+    return;
+  }
 
   server->epoll_fd = epoll_create1(0);
   if (server->epoll_fd == -1) {
     die_errno("failed to create epoll group");
   }
 
-  // Setup listening socket
-  struct epoll_event listen_event;
-  listen_event.events = EPOLLIN | EPOLLET;
-  listen_event.data.ptr = NULL;  // Tag to indicate the listening socket
-  int res = epoll_ctl(
-      server->epoll_fd, EPOLL_CTL_ADD, server->socket_fd, &listen_event);
+  // io_uring parses from its provided buffers instead
+  server->recv_scratch = malloc(READ_SCRATCH_SIZE);
+  assert(server->recv_scratch != NULL);
+
+  // Setup listening sockets
+  int res;
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    struct listener *listener = &server->listeners[i];
+    struct epoll_event listen_event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.ptr = listener,
+    };
+    // Only wake up one of the loops sharing the socket
+    if (listener->addr->addr.ss_family == AF_UNIX) {
+      listen_event.events |= EPOLLEXCLUSIVE;
+    }
+    res = epoll_ctl(
+        server->epoll_fd, EPOLL_CTL_ADD, listener->fd, &listen_event);
+    if (res == -1) {
+      die_errno("failed to add socket to epoll group");
+    }
+  }
+
+  struct epoll_event mailbox_event = {
+      .events = EPOLLIN | EPOLLET,
+      // Tag to indicate the mailbox
+      .data.ptr = &server->mailbox,
+  };
+  res = epoll_ctl(
+      server->epoll_fd, EPOLL_CTL_ADD, server->mailbox_fd, &mailbox_event);
   if (res == -1) {
-    die_errno("failed to add socket to epoll group");
+    die_errno("failed to add eventfd to epoll group");
   }
+}
 
-  store_init(&server->store);
-  list_init(&server->free_conn_pool);
-  dlist_init(&server->active_conns);
+static void server_group_setup(
+    struct server_group *group, const struct server_config *config) {
+  init_commands();
 
-  dlist_init(&server->idle_timeouts);
+  group->backend = config->backend;
+  group->limits = config->limits;
+  group->listen_count = config->listen_count;
+  memcpy(
+      group->listen_addrs, config->listen_addrs,
+      sizeof(config->listen_addrs[0]) * config->listen_count);
+  group->busy_poll = config->busy_poll;
+  group->max_clients =
+      config->max_clients == 0 ? UINT_MAX : config->max_clients;
+  group->overload_latency_us = config->overload_latency_us;
+  atomic_init(&group->client_count, 0);
+  group->shard_count = config->threads;
+  group->shards = malloc(sizeof(group->shards[0]) * group->shard_count);
+  assert(group->shards != NULL);
+  // All shards must be ready before any loop starts sending messages
+  for (unsigned i = 0; i < group->shard_count; i++) {
+    int cpu = i < config->cpu_count ? config->cpus[i] : -1;
+    server_state_setup(&group->shards[i], group, i, cpu);
+  }
 
-  work_queue_init(&server->async_task_queue);
-  res = thrd_create(
+  work_queue_init(&group->async_task_queue);
+  group->async_task_cpu = group->shard_count < config->cpu_count
+                              ? config->cpus[group->shard_count]
+                              : -1;
+  int res = thrd_create(
       // TODO: Figure out memory management. objects are not individually heap
       // allocated, so their metadata needs to be copied into the free list?
-      &server->async_task_thread, run_worker_thread, &server->async_task_queue);
+      &group->async_task_thread, run_worker_thread, group);
   assert(res == thrd_success);
-
-  init_commands();
 }
 
 static int get_next_delay_ms(struct server_state *server) {
-  struct dlist_node *timeout_node = dlist_peek_front(&server->idle_timeouts);
-  if (timeout_node == NULL) {
+  if (!dlist_empty(&server->ready_conns) || server->group->busy_poll) {
+    return 0;
+  }
+
+  struct timer_wheel *wheels[] = {
+      &server->idle_timeouts,
+      &server->output_limit_timeouts,
+      &server->store.expires,
+  };
+  int64_t next_us = -1;
+  for (size_t i = 0; i < sizeof(wheels) / sizeof(wheels[0]); i++) {
+    int64_t wheel_next_us = timer_wheel_next_expiry(wheels[i]);
+    if (wheel_next_us >= 0 && (next_us < 0 || wheel_next_us < next_us)) {
+      next_us = wheel_next_us;
+    }
+  }
+  if (next_us < 0) {
     // Forever if there are no timeouts
     return -1;
   }
 
   uint64_t now_us = get_monotonic_usec();
-
-  // Idle timeouts
-  struct conn *next_timeout_conn =
-      container_of(timeout_node, struct conn, timeout_node);
-  uint64_t next_timeout_us = next_timeout_conn->idle_start_us + CONN_TIMEOUT_US;
-  if (next_timeout_us < now_us) {
+  if ((uint64_t)next_us <= now_us) {
     return 0;
   }
 
-  int next_delay = (int)((next_timeout_us - now_us) / USEC_PER_MSEC);
-
-  // Expire timeouts
-  if (!heap_empty(&server->store.expires)) {
-    uint64_t next_expire_us = heap_peek_min(&server->store.expires).value;
-    if (next_expire_us < now_us) {
-      return 0;
-    }
-
-    next_delay = (int)((next_expire_us - now_us) / USEC_PER_MSEC);
-  }
-
-  return next_delay;
+  // Rounded up to not wake up before anything is due
+  uint64_t delay_ms =
+      ((uint64_t)next_us - now_us + USEC_PER_MSEC - 1) / USEC_PER_MSEC;
+  return delay_ms < INT_MAX ? (int)delay_ms : INT_MAX;
 }
 
 static struct conn *get_available_conn(struct server_state *server) {
@@ -265,14 +859,15 @@ static struct conn *get_available_conn(struct server_state *server) {
 }
 
 static void free_conn(struct server_state *server, struct conn *conn) {
+  atomic_fetch_sub_explicit(
+      &server->group->client_count, 1, memory_order_relaxed);
   dlist_detach(&server->active_conns, &conn->active_list_node);
   list_push(&server->free_conn_pool, &conn->free_list_node);
 
-  dlist_detach(&server->idle_timeouts, &conn->timeout_node);
+  timer_wheel_cancel(&server->idle_timeouts, &conn->idle_timer);
+  timer_wheel_cancel(&server->output_limit_timeouts, &conn->output_limit_timer);
 
-  // TODO: Skip freeing buffers since they can be reused? Maybe only free them
-  // if they are large?
-  conn_cleanup(conn);
+  conn_cleanup(server, conn);
 }
 
 enum read_result {
@@ -282,49 +877,89 @@ enum read_result {
   READ_MORE = -4,
 };
 
-/**
- * Fill read buffer with data from `fd`.
- *
- * The full buffer capacity is requested from `fd`, although this may read less
- * than the full capacity.
- */
-static enum read_result read_buf_fill(
-    int conn_fd, struct offset_buf *read_buf) {
-  // Make room for full message.
-  // TODO: Better heuristic for when to move data back
-  offset_buf_reset_start(read_buf);
-
-  // TODO: Better heuristic for when/how much to grow buffer
-  uint32_t cap = offset_buf_cap(read_buf);
-  if (cap < READ_BUF_MIN_CAP) {
-    offset_buf_grow(read_buf, READ_BUF_MIN_CAP);
-  }
-  cap = offset_buf_cap(read_buf);
-  // TODO: This could happen if the client sends a too-big message
-  assert(cap >= READ_BUF_MIN_CAP);
-
-  ssize_t n_read;
+static enum read_result recv_some(
+    int conn_fd, void *data, size_t size, size_t *n_read) {
+  ssize_t res;
   // Repeat for EINTR
   do {
-    n_read = recv(conn_fd, offset_buf_tail(read_buf), cap, 0);
-  } while (n_read == -1 && errno == EINTR);
+    res = recv(conn_fd, data, size, 0);
+  } while (res == -1 && errno == EINTR);
 
-  if (n_read == -1) {
+  if (res == -1) {
     if (errno == EAGAIN) {
       return READ_MORE;
     }
     return READ_IO_ERR;
   }
 
-  if (n_read == 0) {
+  if (res == 0) {
     return READ_EOF;
   }
 
-  assert(n_read > 0);
-  offset_buf_inc_size(read_buf, n_read);
+  *n_read = res;
   return READ_OK;
 }
 
+/**
+ * Fill read buffer with data from the connection.
+ *
+ * The full buffer capacity is requested from `fd`, although this may read less
+ * than the full capacity.
+ */
+static enum read_result read_buf_fill(
+    struct server_state *server, struct conn *conn) {
+  struct offset_buf *read_buf = &conn->read_buf;
+  if (offset_buf_remaining(read_buf) == 0) {
+    // Requests usually arrive whole, so they can be handled straight from the
+    // loop's scratch buffer without the connection needing its own
+    conn_release_read_buf(server, conn);
+    read_buf->buf = (struct buffer){
+        .size = 0,
+        .cap = READ_SCRATCH_SIZE,
+        .data = server->recv_scratch,
+    };
+    conn->read_buf_borrowed = true;
+  } else {
+    conn_own_read_buf(server, conn);
+    // Make room for full message.
+    // TODO: Better heuristic for when to move data back
+    offset_buf_reset_start(read_buf);
+
+    // TODO: Better heuristic for when/how much to grow buffer
+    if (offset_buf_cap(read_buf) < READ_BUF_MIN_CAP) {
+      offset_buf_grow(read_buf, READ_BUF_MIN_CAP);
+    }
+  }
+  uint32_t cap = offset_buf_cap(read_buf);
+  // TODO: This could happen if the client sends a too-big message
+  assert(cap >= READ_BUF_MIN_CAP);
+
+  size_t n_read;
+  enum read_result res =
+      recv_some(conn->fd, offset_buf_tail(read_buf), cap, &n_read);
+  if (res == READ_OK) {
+    offset_buf_inc_size(read_buf, n_read);
+  }
+  return res;
+}
+
+/** Receive the rest of a streamed argument directly into its allocation */
+static enum read_result stream_arg_fill(
+    int conn_fd, struct req_parser *parser) {
+  string *arg = &parser->owned_args[parser->stream_index];
+  size_t n_read;
+  enum read_result res = recv_some(
+      conn_fd, string_data(arg) + parser->stream_size,
+      string_size(arg) - parser->stream_size, &n_read);
+  if (res == READ_OK) {
+    parser->stream_size += n_read;
+    if (parser->stream_size == string_size(arg)) {
+      parser->streaming = false;
+    }
+  }
+  return res;
+}
+
 enum send_result {
   SEND_OK = 0,
   SEND_IO_ERR = -1,
@@ -332,108 +967,609 @@ enum send_result {
 };
 
 static enum send_result write_buf_flush(
-    int conn_fd, struct offset_buf *write_buf) {
-  size_t remaining = offset_buf_remaining(write_buf);
-  assert(remaining > 0);
+    int conn_fd, struct offset_buf *write_buf, struct reply_refs *write_refs) {
+  assert(reply_remaining(write_buf, write_refs) > 0);
 
-  ssize_t n_write;
+  // A single write may not cover the whole reply, so keep going until the
+  // socket is full. Edge-triggered polling only reports it as writable again
+  // after that.
   do {
-    n_write =
-        send(conn_fd, offset_buf_head(write_buf), remaining, MSG_NOSIGNAL);
-  } while (n_write == -1 && errno == EINTR);
-
-  if (n_write == -1) {
-    if (errno == EAGAIN) {
-      return SEND_MORE;
+    struct iovec iov[WRITE_IOV_MAX];
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen =
+            reply_fill_iov(write_buf, write_refs, iov, WRITE_IOV_MAX),
+    };
+    ssize_t n_write;
+    do {
+      n_write = sendmsg(conn_fd, &msg, MSG_NOSIGNAL);
+    } while (n_write == -1 && errno == EINTR);
+
+    if (n_write == -1) {
+      if (errno == EAGAIN) {
+        return SEND_MORE;
+      }
+      return SEND_IO_ERR;
     }
-    return SEND_IO_ERR;
-  }
 
-  assert(n_write > 0);
-  offset_buf_advance(write_buf, n_write);
-  remaining = offset_buf_remaining(write_buf);
-  if (remaining == 0) {
-    offset_buf_reset(write_buf);
-    return SEND_OK;
+    assert(n_write > 0);
+    reply_advance(write_buf, write_refs, n_write);
+  } while (reply_remaining(write_buf, write_refs) > 0);
+
+  return SEND_OK;
+}
+
+/**
+ * State once nothing more can be processed until more data arrives. Replies to
+ * the requests processed so far are flushed together first.
+ */
+static enum conn_state conn_wait_read_state(const struct conn *conn) {
+  if (reply_remaining(&conn->write_buf, &conn->write_refs) > 0) {
+    return CONN_WRITE_RES;
   }
-  return SEND_MORE;
+  return CONN_WAIT_READ;
 }
 
-static void handle_read_req(struct conn *conn) {
-  enum read_result res = read_buf_fill(conn->fd, &conn->read_buf);
+static void handle_read_req(struct server_state *server, struct conn *conn) {
+  if (server->group->backend == IO_BACKEND_URING) {
+    // A multishot receive is always armed, so just wait for it
+    conn->state = conn_wait_read_state(conn);
+    return;
+  }
+
+  struct req_parser *parser = &conn->req_parser;
+  enum read_result res;
+  if (parser->streaming) {
+    res = stream_arg_fill(conn->fd, parser);
+  } else {
+    res = read_buf_fill(server, conn);
+  }
   switch (res) {
     case READ_OK:
-      conn->state = CONN_PROCESS_REQ;
+      // Nothing can be parsed until the argument has been received
+      conn->state = parser->streaming ? CONN_READ_REQ : CONN_PROCESS_REQ;
       break;
     case READ_IO_ERR:
-      perror("failed to read from socket");
+      log_errno(LOG_WARN, "failed to read from socket");
       conn->state = CONN_CLOSE;
       break;
     case READ_EOF:
-      fprintf(stderr, "socket EOF [%d]\n", conn->fd);
+      log_msg(LOG_DEBUG, "socket EOF [%d]", conn->fd);
       conn->state = CONN_CLOSE;
       break;
     case READ_MORE:
-      conn->state = CONN_WAIT_READ;
+      conn->state = conn_wait_read_state(conn);
       break;
     default:
       assert(false);
   }
 }
 
-static enum parse_result run_req_parser(struct conn *conn) {
+/**
+ * Switch to receiving an incomplete argument directly into its own allocation.
+ *
+ * `data` is the start of the argument's data, which extends to the end of the
+ * read buffer.
+ */
+static enum parse_result req_parser_start_stream(
+    struct conn *conn, uint32_t index, uint64_t size, struct const_slice data) {
+  if (size > ARG_MAX_SIZE) {
+    return PARSE_ERR;
+  }
+
   struct req_parser *parser = &conn->req_parser;
+  req_parser_reserve_owned(parser, index);
+  parser->owned_args[index] = string_create(size);
+  parser->streaming = true;
+  parser->stream_index = index;
+  parser->stream_size = 0;
+  req_parser_stream(parser, data);
+
+  // Only the header stays in the read buffer
+  conn->read_buf.buf.size -= data.size;
+  return PARSE_MORE;
+}
 
-  ssize_t res;
-  if (parser->arg_count < 0) {
-    uint32_t arg_count;
-    res =
-        parse_array_header(&arg_count, offset_buf_head_slice(&conn->read_buf));
+/** Parse the header and end of an argument whose data was streamed */
+static ssize_t parse_owned_arg(
+    struct req_parser *parser, enum proto_version proto, uint32_t index,
+    struct const_slice input) {
+  uint64_t size;
+  ssize_t header_res = proto == PROTO_BINARY
+                           ? parse_bin_str_header(&size, input)
+                           : parse_blob_str_header(&size, input);
+  assert(header_res > 0);
+  assert(size == string_size(&parser->owned_args[index]));
+  const_slice_advance(&input, header_res);
+
+  if (parser->streaming && parser->stream_index == index) {
+    return PARSE_MORE;
+  }
+
+  // Binary strings have nothing after their data
+  ssize_t end_res = proto == PROTO_BINARY ? 0 : parse_blob_str_end(input);
+  if (end_res < 0) {
+    return end_res;
+  }
+
+  parser->args[index] = string_const_slice(&parser->owned_args[index]);
+  return header_res + end_res;
+}
+
+/**
+ * Parse a binary request frame. The command is kept as its single type byte,
+ * which commands are looked up by.
+ */
+static enum parse_result run_bin_req_parser(struct conn *conn) {
+  struct req_parser *parser = &conn->req_parser;
+  struct const_slice input = offset_buf_head_slice(&conn->read_buf);
+  size_t input_size = input.size;
+
+  proto_size_t frame_size;
+  uint8_t req_type;
+  ssize_t res = parse_bin_req_header(&frame_size, &req_type, input);
+  if (res < 0) {
+    return res;
+  }
+  parser->args[0] = make_const_slice(
+      (const uint8_t *)input.data + PROTO_HEADER_SIZE, sizeof(req_type));
+  const_slice_advance(&input, res);
+
+  // Arguments take up the rest of the frame
+  uint64_t remaining = frame_size - sizeof(req_type);
+  uint32_t arg_count = 1;
+  for (; remaining > 0; arg_count++) {
+    if (arg_count >= COMMAND_ARGS_MAX || remaining < PROTO_SIZE_SIZE) {
+      return PARSE_ERR;
+    }
+    req_parser_reserve(parser, arg_count);
+    uint64_t size;
+    ssize_t header_res = parse_bin_str_header(&size, input);
+    if (header_res < 0) {
+      return header_res;
+    }
+    if (size > remaining - header_res) {
+      return PARSE_ERR;
+    }
+
+    if (req_parser_owns(parser, arg_count)) {
+      res = parse_owned_arg(parser, PROTO_BINARY, arg_count, input);
+    } else {
+      res = parse_bin_str(&parser->args[arg_count], input);
+      if (res == PARSE_MORE && size >= ARG_STREAM_MIN_SIZE) {
+        const_slice_advance(&input, header_res);
+        return req_parser_start_stream(conn, arg_count, size, input);
+      }
+    }
     if (res < 0) {
       return res;
     }
-    offset_buf_advance(&conn->read_buf, res);
+    // Only the header of owned arguments is in the read buffer
+    const_slice_advance(&input, res);
+    remaining -= header_res + size;
+  }
 
-    if (arg_count == 0 || arg_count > COMMAND_ARGS_MAX) {
-      return PARSE_ERR;
-    }
+  parser->arg_count = arg_count;
+  parser->size = input_size - input.size;
+  return PARSE_OK;
+}
+
+static enum parse_result run_req_parser(struct conn *conn) {
+  if (conn->proto == PROTO_BINARY) {
+    return run_bin_req_parser(conn);
+  }
+
+  struct req_parser *parser = &conn->req_parser;
+  struct const_slice input = offset_buf_head_slice(&conn->read_buf);
+  size_t input_size = input.size;
+
+  uint32_t arg_count;
+  ssize_t res = parse_array_header(&arg_count, input);
+  if (res < 0) {
+    return res;
+  }
+  const_slice_advance(&input, res);
 
-    parser->arg_count = (int)arg_count;
+  if (arg_count == 0 || arg_count > COMMAND_ARGS_MAX) {
+    return PARSE_ERR;
   }
 
-  while (parser->parsed_args < parser->arg_count) {
-    struct const_slice ref_arg;
-    res = parse_blob_str(&ref_arg, offset_buf_head_slice(&conn->read_buf));
+  for (uint32_t i = 0; i < arg_count; i++) {
+    req_parser_reserve(parser, i);
+    if (req_parser_owns(parser, i)) {
+      res = parse_owned_arg(parser, PROTO_RESP2, i, input);
+      if (res < 0) {
+        return res;
+      }
+      const_slice_advance(&input, res);
+      continue;
+    }
+
+    // Only commands which store an argument need to copy it
+    res = parse_blob_str(&parser->args[i], input);
+    if (res == PARSE_MORE) {
+      uint64_t size;
+      ssize_t header_res = parse_blob_str_header(&size, input);
+      if (header_res > 0 && size >= ARG_STREAM_MIN_SIZE &&
+          input.size - header_res < size) {
+        const_slice_advance(&input, header_res);
+        return req_parser_start_stream(conn, i, size, input);
+      }
+    }
     if (res < 0) {
       return res;
     }
-    offset_buf_advance(&conn->read_buf, res);
-    // "duplicate" the string, with small-string-optimization. Only "large"
-    // strings need allocations
-    // TODO: Don't allocate for large strings until the read buffer is reset (or
-    // the data is needed long-term). (Need some smart CoW for this to work)
-    parser->args[parser->parsed_args++] = string_dup_slice(ref_arg);
+    const_slice_advance(&input, res);
   }
 
+  parser->arg_count = arg_count;
+  parser->size = input_size - input.size;
   return PARSE_OK;
 }
 
-static void reset_req_parser(struct req_parser *parser) {
-  for (int i = 0; i < parser->parsed_args; i++) {
-    string_destroy(&parser->args[i]);
-  }
-  req_parser_init(parser);
+static struct command_ctx make_command_ctx(
+    struct server_state *server, const struct const_slice *args,
+    uint32_t arg_count, string *owned_args, uint32_t owned_count,
+    const hash_t *key_hashes, struct buffer *out_buf,
+    struct reply_refs *out_refs, enum proto_version *conn_proto) {
+  return (struct command_ctx){
+      .store = &server->store,
+      .arg_count = arg_count,
+      .args = args,
+      .owned_args = owned_args,
+      .owned_count = owned_count,
+      .key_hashes = key_hashes,
+      .out = make_reply_out(out_buf, *conn_proto),
+      .out_refs = out_refs,
+      .conn_proto = conn_proto,
+      .async_task_thread = server->group->async_task_thread,
+      .async_task_queue = &server->group->async_task_queue,
+  };
+}
+
+static void shard_msg_send(struct server_state *target, struct shard_msg *msg) {
+  if (mailbox_push(&target->mailbox, &msg->node)) {
+    // Only wake up the target when the mailbox goes from empty to non-empty
+    uint64_t incr = 1;
+    ssize_t res = write(target->mailbox_fd, &incr, sizeof(incr));
+    if (res == -1) {
+      log_errno(LOG_ERROR, "failed to wake up shard");
+    }
+  }
+}
+
+static struct shard_msg *shard_msg_alloc(
+    struct server_state *origin, struct conn *conn) {
+  struct shard_msg *msg = malloc(sizeof(*msg));
+  assert(msg != NULL);
+  msg->type = SHARD_MSG_REQ;
+  msg->origin = origin;
+  msg->conn = conn;
+  msg->proto = conn->proto;
+  msg->arg_count = 0;
+  msg->args = NULL;
+  msg->key_hashes = NULL;
+  return msg;
+}
+
+static void shard_msg_alloc_args(struct shard_msg *msg, uint32_t arg_count) {
+  msg->arg_count = arg_count;
+  msg->args = malloc(sizeof(*msg->args) * arg_count);
+  assert(msg->args != NULL);
+}
+
+static void shard_msg_free(struct shard_msg *msg) {
+  free(msg->args);
+  free(msg->key_hashes);
+  buffer_destroy(&msg->out);
+  reply_refs_destroy(&msg->out_refs);
+  free(msg);
+}
+
+/**
+ * Get the part of a key which picks its shard. Keys with a non-empty `{tag}`
+ * only use the tag, so that related keys can be kept on the same shard.
+ */
+static struct const_slice key_hash_tag(struct const_slice key) {
+  ssize_t start = slice_index_of(key, '{');
+  if (start < 0) {
+    return key;
+  }
+
+  struct const_slice tag = key;
+  const_slice_advance(&tag, start + 1);
+  ssize_t end = slice_index_of(tag, '}');
+  if (end <= 0) {
+    return key;
+  }
+  tag.size = end;
+  return tag;
+}
+
+/**
+ * Pick the shard owning a key, and set `hash_code` to its hash within the
+ * shard so that it isn't hashed again.
+ *
+ * This uses the high half of the hash since the low half is what each
+ * shard's hash map stores.
+ */
+static unsigned key_shard(
+    const struct server_group *group, struct const_slice key,
+    hash_t *hash_code) {
+  uint64_t hash = slice_hash64(key);
+  *hash_code = (hash_t)hash;
+  struct const_slice tag = key_hash_tag(key);
+  if (tag.size != key.size) {
+    hash = slice_hash64(tag);
+  }
+  return (unsigned)(((hash >> 32) * group->shard_count) >> 32);
+}
+
+/**
+ * Hash every `key_step`th argument of the request as a key, into
+ * `server->key_hashes`.
+ *
+ * Returns the shard owning the keys, or -1 if they're on different shards.
+ */
+static int hash_req_keys(
+    struct server_state *server, const struct req_parser *parser,
+    uint32_t key_step) {
+  if (parser->arg_count > server->key_hashes_cap) {
+    free(server->key_hashes);
+    server->key_hashes_cap = parser->arg_count;
+    server->key_hashes =
+        malloc(sizeof(*server->key_hashes) * server->key_hashes_cap);
+    assert(server->key_hashes != NULL);
+  }
+
+  const struct server_group *group = server->group;
+  unsigned shard_id =
+      key_shard(group, parser->args[1], &server->key_hashes[1]);
+  for (uint32_t i = 1 + key_step; key_step > 0 && i < parser->arg_count;
+       i += key_step) {
+    if (key_shard(group, parser->args[i], &server->key_hashes[i]) !=
+        shard_id) {
+      return -1;
+    }
+  }
+  return (int)shard_id;
+}
+
+/** Run the request in the message, replacing its arguments with the reply */
+static void shard_msg_run(struct server_state *server, struct shard_msg *msg) {
+  struct const_slice *args = malloc(sizeof(*args) * msg->arg_count);
+  assert(args != NULL);
+  for (uint32_t i = 0; i < msg->arg_count; i++) {
+    args[i] = string_const_slice(&msg->args[i]);
+  }
+
+  buffer_init(&msg->out, SHARD_REPLY_INIT_CAP);
+  reply_refs_init(&msg->out_refs);
+  // All arguments are owned by the message
+  run_command(make_command_ctx(
+      server, args, msg->arg_count, msg->args, msg->arg_count,
+      msg->key_hashes, &msg->out, &msg->out_refs, &msg->proto));
+  for (uint32_t i = 0; i < msg->arg_count; i++) {
+    string_destroy(&msg->args[i]);
+  }
+  free(args);
+  free(msg->args);
+  msg->args = NULL;
+}
+
+/** Run a request from another shard and send the reply back */
+static void handle_shard_req(
+    struct server_state *server, struct shard_msg *msg) {
+  shard_msg_run(server, msg);
+
+  msg->type = SHARD_MSG_RES;
+  shard_msg_send(msg->origin, msg);
+}
+
+/**
+ * Add a shard's reply to the connection's output.
+ *
+ * Returns `true` once all pending replies have been received.
+ */
+static bool conn_add_shard_reply(
+    struct server_state *server, struct conn *conn, struct shard_msg *msg) {
+  assert(conn->pending_replies > 0);
+  conn->pending_replies--;
+  conn_acquire_write_buf(server, conn);
+
+  if (conn->gather_buf.data == NULL) {
+    // Values referenced by the reply are valid on any thread
+    uint32_t base_offset = conn->write_buf.buf.size;
+    buffer_append_slice(&conn->write_buf.buf, buffer_const_slice(&msg->out));
+    reply_refs_move(&conn->write_refs, base_offset, &msg->out_refs);
+    return conn->pending_replies == 0;
+  }
+
+  // Merging doesn't keep track of references, so commands sent to all shards
+  // must copy their output
+  assert(reply_refs_empty(&msg->out_refs));
+
+  struct const_slice reply = buffer_const_slice(&msg->out);
+  uint32_t count;
+  ssize_t res = parse_reply_array_header(msg->proto, &count, reply);
+  if (res >= 0) {
+    const_slice_advance(&reply, res);
+  }
+  if (res >= 0 && count == PROTO_SIZE_STREAMED) {
+    // Only the elements are kept, the merged array is streamed as well
+    assert(msg->proto != PROTO_RESP2);
+    uint32_t end_size = reply_stream_end_size(msg->proto);
+    reply.size -= end_size;
+    struct const_slice end =
+        make_const_slice((const uint8_t *)reply.data + reply.size, end_size);
+    assert(parse_reply_stream_end(msg->proto, end) > 0);
+  } else if (res >= 0) {
+    conn->gather_count += count;
+  }
+  // Errors from any shard are passed along as-is
+  buffer_append_slice(&conn->gather_buf, reply);
+
+  if (conn->pending_replies > 0) {
+    return false;
+  }
+
+  struct reply_out out = make_reply_out(&conn->write_buf.buf, msg->proto);
+  if (msg->proto != PROTO_RESP2) {
+    write_array_stream_start(out);
+  } else {
+    write_array_header(out, conn->gather_count);
+  }
+  buffer_append_slice(out.buf, buffer_const_slice(&conn->gather_buf));
+  if (msg->proto != PROTO_RESP2) {
+    write_stream_end(out);
+  }
+  buffer_destroy(&conn->gather_buf);
+  conn->gather_buf.data = NULL;
+  conn->gather_count = 0;
+  return true;
+}
+
+static void forward_req(
+    struct server_state *server, struct conn *conn, unsigned shard_id) {
+  struct req_parser *parser = &conn->req_parser;
+  struct shard_msg *msg = shard_msg_alloc(server, conn);
+  shard_msg_alloc_args(msg, parser->arg_count);
+  msg->key_hashes = malloc(sizeof(*msg->key_hashes) * parser->arg_count);
+  assert(msg->key_hashes != NULL);
+  memcpy(
+      msg->key_hashes, server->key_hashes,
+      sizeof(*msg->key_hashes) * parser->arg_count);
+  for (uint32_t i = 0; i < parser->arg_count; i++) {
+    if (req_parser_owns(parser, i)) {
+      msg->args[i] = string_move(&parser->owned_args[i]);
+    } else {
+      msg->args[i] = string_dup_slice(parser->args[i]);
+    }
+  }
+
+  conn->pending_replies = 1;
+  shard_msg_send(&server->group->shards[shard_id], msg);
+}
+
+static void broadcast_req(struct server_state *server, struct conn *conn) {
+  struct req_parser *parser = &conn->req_parser;
+  struct server_group *group = server->group;
+
+  buffer_init(&conn->gather_buf, GATHER_BUF_INIT_CAP);
+  conn->gather_count = 0;
+  conn->pending_replies = group->shard_count;
+
+  for (unsigned i = 0; i < group->shard_count; i++) {
+    struct shard_msg *msg = shard_msg_alloc(server, conn);
+    if (i == server->shard_id) {
+      // Run directly with the borrowed arguments. Other replies can't have been
+      // received yet, so this never completes the request.
+      buffer_init(&msg->out, SHARD_REPLY_INIT_CAP);
+      reply_refs_init(&msg->out_refs);
+      run_command(make_command_ctx(
+          server, parser->args, parser->arg_count, NULL, 0, NULL, &msg->out,
+          &msg->out_refs, &msg->proto));
+      bool done = conn_add_shard_reply(server, conn, msg);
+      assert(!done);
+      shard_msg_free(msg);
+      continue;
+    }
+
+    shard_msg_alloc_args(msg, parser->arg_count);
+    for (uint32_t arg = 0; arg < parser->arg_count; arg++) {
+      msg->args[arg] = string_dup_slice(parser->args[arg]);
+    }
+    shard_msg_send(&group->shards[i], msg);
+  }
+}
+
+/**
+ * Run the parsed request locally or send it to the shard(s) which own its
+ * data.
+ *
+ * Returns `true` if the reply is available immediately.
+ */
+static bool dispatch_req(struct server_state *server, struct conn *conn) {
+  struct req_parser *parser = &conn->req_parser;
+  struct server_group *group = server->group;
+
+  // Fail fast instead of adding to the work of a loop which is behind
+  if (server->overloaded) {
+    conn_acquire_write_buf(server, conn);
+    write_simple_err_value(
+        make_reply_out(&conn->write_buf.buf, conn->proto), OVERLOADED_ERR);
+    return true;
+  }
+
+  // Errors are generated on the receiving shard
+  struct command_info info = {.shard = SHARD_NONE};
+  const hash_t *key_hashes = NULL;
+  if (group->shard_count > 1 &&
+      !command_get_info(conn->proto, parser->args, parser->arg_count, &info)) {
+    info.shard = SHARD_NONE;
+  }
+
+  switch (info.shard) {
+    case SHARD_NONE:
+      break;
+    case SHARD_KEY:
+    case SHARD_KEYS: {
+      int shard_id = hash_req_keys(server, parser, info.key_step);
+      if (shard_id < 0) {
+        conn_acquire_write_buf(server, conn);
+        write_simple_err_value(
+            make_reply_out(&conn->write_buf.buf, conn->proto),
+            CROSS_SHARD_ERR);
+        return true;
+      }
+      if ((unsigned)shard_id == server->shard_id) {
+        key_hashes = server->key_hashes;
+        break;
+      }
+      forward_req(server, conn, shard_id);
+      return false;
+    }
+    case SHARD_ALL:
+      broadcast_req(server, conn);
+      return false;
+    default:
+      assert(false);
+  }
+
+  conn_acquire_write_buf(server, conn);
+  run_command(make_command_ctx(
+      server, parser->args, parser->arg_count, parser->owned_args,
+      parser->owned_cap, key_hashes, &conn->write_buf.buf, &conn->write_refs,
+      &conn->proto));
+  return true;
+}
+
+/** Size of the input received for requests which weren't processed yet */
+static uint64_t conn_query_size(struct conn *conn) {
+  const struct req_parser *parser = &conn->req_parser;
+  uint64_t size = offset_buf_remaining(&conn->read_buf);
+  for (uint32_t i = 0; i < parser->owned_cap; i++) {
+    size += string_size(&parser->owned_args[i]);
+  }
+  return size;
 }
 
 static void handle_process_req(struct server_state *server, struct conn *conn) {
   enum parse_result parsed_res = run_req_parser(conn);
+  uint64_t query_max = server->group->limits.query_max;
   switch (parsed_res) {
     case PARSE_ERR:
-      fprintf(stderr, "invalid message\n");
-      reset_req_parser(&conn->req_parser);
+      log_msg(LOG_WARN, "invalid message from client [%d]", conn->fd);
       conn->state = CONN_CLOSE;
       return;
     case PARSE_MORE:
+      if (query_max > 0 && conn_query_size(conn) > query_max) {
+        log_msg(
+            LOG_WARN, "closing connection [%d] over the query buffer limit",
+            conn->fd);
+        conn->state = CONN_CLOSE;
+        return;
+      }
       conn->state = CONN_READ_REQ;
       return;
     case PARSE_OK:
@@ -443,32 +1579,87 @@ static void handle_process_req(struct server_state *server, struct conn *conn) {
       assert(false);
   }
 
-  fprintf(stderr, "from client [%d]: ", conn->fd);
-  // TODO: Figure out how to print requests
-  // print_request(stderr, conn->req_parser.cmd, conn->req_parser.args);
-  fputc('\n', stderr);
+  // Only a sample of requests is logged since it's on the hot path
+  if (log_enabled(LOG_DEBUG) && log_sample_request()) {
+    struct const_slice cmd = conn->req_parser.args[0];
+    if (conn->proto == PROTO_BINARY) {
+      log_msg(
+          LOG_DEBUG, "request from client [%d]: type %u", conn->fd,
+          const_slice_get(cmd, 0));
+    } else {
+      log_msg(
+          LOG_DEBUG, "request from client [%d]: %.*s", conn->fd,
+          (int)(cmd.size < LOG_CMD_MAX ? cmd.size : LOG_CMD_MAX),
+          (const char *)cmd.data);
+    }
+  }
 
-  run_command((struct command_ctx){
-      .store = &server->store,
-      .arg_count = conn->req_parser.arg_count,
-      .args = conn->req_parser.args,
-      .out_buf = &conn->write_buf.buf,
-      .async_task_thread = server->async_task_thread,
-      .async_task_queue = &server->async_task_queue,
-  });
+  bool done = dispatch_req(server, conn);
+  // Forwarded requests have copied their arguments, so the request can be
+  // dropped from the read buffer
+  offset_buf_advance(&conn->read_buf, conn->req_parser.size);
+  req_parser_reset(&conn->req_parser);
+  if (!done) {
+    // Later requests have to wait to keep the replies in order
+    conn->state = CONN_WAIT_REMOTE;
+    return;
+  }
 
-  reset_req_parser(&conn->req_parser);
-  conn->state = CONN_WRITE_RES;
+  // Keep going with the next pipelined request, and only flush once nothing
+  // more can be processed
+  conn->batch_reqs++;
+  if (conn->batch_reqs >= PIPELINE_MAX_REQS ||
+      reply_remaining(&conn->write_buf, &conn->write_refs) >=
+          WRITE_BUF_FLUSH_SIZE) {
+    conn->state = CONN_WRITE_RES;
+  } else {
+    conn->state = CONN_PROCESS_REQ;
+  }
 }
 
-static void handle_write_res(struct conn *conn) {
-  enum send_result res = write_buf_flush(conn->fd, &conn->write_buf);
+/**
+ * Stop processing the connection until the other connections have been
+ * handled.
+ */
+static void conn_yield(struct server_state *server, struct conn *conn) {
+  conn->state = CONN_YIELD;
+  dlist_push_back(&server->ready_conns, &conn->ready_node);
+}
+
+static void uring_submit_send(struct server_state *server, struct conn *conn);
+
+static void handle_write_res(struct server_state *server, struct conn *conn) {
+  uint64_t output_hard = server->group->limits.output_hard;
+  size_t pending = reply_remaining(&conn->write_buf, &conn->write_refs);
+  if (output_hard > 0 && pending > output_hard) {
+    log_msg(
+        LOG_WARN,
+        "closing connection [%d] with %zu bytes of output over the hard limit",
+        conn->fd, pending);
+    conn->state = CONN_CLOSE;
+    return;
+  }
+
+  if (server->group->backend == IO_BACKEND_URING) {
+    if (!conn->send_pending) {
+      uring_submit_send(server, conn);
+    }
+    conn->state = CONN_WAIT_WRITE;
+    return;
+  }
+
+  enum send_result res =
+      write_buf_flush(conn->fd, &conn->write_buf, &conn->write_refs);
   switch (res) {
     case SEND_OK:
-      conn->state = CONN_PROCESS_REQ;
+      if (conn->batch_reqs >= PIPELINE_MAX_REQS) {
+        conn_yield(server, conn);
+      } else {
+        conn->state = CONN_PROCESS_REQ;
+      }
       break;
     case SEND_IO_ERR:
-      fprintf(stderr, "failed to write message\n");
+      log_errno(LOG_WARN, "failed to write message");
       conn->state = CONN_CLOSE;
       break;
     case SEND_MORE:
@@ -480,71 +1671,183 @@ static void handle_write_res(struct conn *conn) {
 }
 
 static void handle_end(struct server_state *server, struct conn *conn) {
+  if (conn->state == CONN_YIELD) {
+    dlist_detach(&server->ready_conns, &conn->ready_node);
+  }
+
+  if (conn->uring_ops > 0) {
+    // Shutting down the socket makes the outstanding operations complete, after
+    // which this is called again
+    if (conn->state != CONN_WAIT_CLOSE) {
+      shutdown(conn->fd, SHUT_RDWR);
+      conn->state = CONN_WAIT_CLOSE;
+    }
+    return;
+  }
+
   int res = close(conn->fd);
   if (res == -1) {
-    fprintf(stderr, "failed to close socket\n");
+    log_errno(LOG_WARN, "failed to close socket");
   }
-  fprintf(stderr, "closed connected [%d]\n", conn->fd);
+  log_msg(LOG_DEBUG, "closed connection [%d]", conn->fd);
 
   conn->fd = -1;
   free_conn(server, conn);
 }
 
-static void handle_data_available(
-    struct server_state *server, struct conn *conn) {
-  conn->idle_start_us = get_monotonic_usec();
-  dlist_detach(&server->idle_timeouts, &conn->timeout_node);
-  dlist_push_back(&server->idle_timeouts, &conn->timeout_node);
-
-  // Reset wait states from poll
-  if (conn->state == CONN_WAIT_READ) {
-    conn->state = CONN_READ_REQ;
-  } else if (conn->state == CONN_WAIT_WRITE) {
-    conn->state = CONN_WRITE_RES;
-  }
-
+static void run_conn(struct server_state *server, struct conn *conn) {
+  conn->batch_reqs = 0;
   while (true) {
     switch (conn->state) {
       case CONN_WAIT_READ:
       case CONN_WAIT_WRITE:
+      case CONN_WAIT_REMOTE:
+      case CONN_YIELD:
+      case CONN_WAIT_CLOSE:
+        conn_park(server, conn);
         return;
       case CONN_READ_REQ:
-        handle_read_req(conn);
+        handle_read_req(server, conn);
         break;
       case CONN_PROCESS_REQ:
         handle_process_req(server, conn);
         break;
       case CONN_WRITE_RES:
-        handle_write_res(conn);
+        handle_write_res(server, conn);
         break;
       case CONN_CLOSE:
         handle_end(server, conn);
         return;
       default:
-        fprintf(stderr, "Invalid state: %d\n", conn->state);
+        log_msg(LOG_ERROR, "invalid state: %d", conn->state);
         handle_end(server, conn);
         return;
     }
   }
 }
 
-static void handle_new_connection(struct server_state *server) {
-  struct sockaddr_in client_addr;
-  socklen_t client_addr_len = sizeof(client_addr);
-  int conn_fd = accept(
-      server->socket_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-  if (conn_fd == -1) {
-    perror("failed to connect to client");
-    return;
+static void conn_touch(struct server_state *server, struct conn *conn) {
+  timer_wheel_arm(
+      &server->idle_timeouts, &conn->idle_timer,
+      get_monotonic_usec() + CONN_TIMEOUT_US);
+}
+
+static void handle_data_available(
+    struct server_state *server, struct conn *conn) {
+  conn_touch(server, conn);
+
+  // Reset wait states from poll
+  if (conn->state == CONN_WAIT_READ) {
+    conn->state = CONN_READ_REQ;
+  } else if (conn->state == CONN_WAIT_WRITE) {
+    conn->state = CONN_WRITE_RES;
+  }
+
+  run_conn(server, conn);
+}
+
+static void handle_shard_res(
+    struct server_state *server, struct shard_msg *msg) {
+  struct conn *conn = msg->conn;
+  assert(conn->state == CONN_WAIT_REMOTE);
+  bool done = conn_add_shard_reply(server, conn, msg);
+  shard_msg_free(msg);
+  if (done && conn->close_pending) {
+    handle_end(server, conn);
+  } else if (done) {
+    // Continue with any requests pipelined after this one
+    conn->state = CONN_PROCESS_REQ;
+    run_conn(server, conn);
+  }
+}
+
+static void handle_ready_conns(struct server_state *server) {
+  // Connections yielding again are handled in the next loop iteration
+  struct dlist ready;
+  dlist_init(&ready);
+  dlist_move_all(&ready, &server->ready_conns);
+
+  struct dlist_node *node;
+  while ((node = dlist_pop_front(&ready)) != NULL) {
+    struct conn *conn = container_of(node, struct conn, ready_node);
+    assert(conn->state == CONN_YIELD);
+    conn->state = CONN_PROCESS_REQ;
+    run_conn(server, conn);
+  }
+}
+
+/**
+ * Process all messages in the mailbox.
+ *
+ * The eventfd counter must be reset beforehand so that no wake-ups are missed.
+ */
+static void handle_mailbox_messages(struct server_state *server) {
+  struct mailbox_node *node = mailbox_take_all(&server->mailbox);
+  while (node != NULL) {
+    struct mailbox_node *next = node->next;
+    struct shard_msg *msg = container_of(node, struct shard_msg, node);
+    switch (msg->type) {
+      case SHARD_MSG_REQ:
+        handle_shard_req(server, msg);
+        break;
+      case SHARD_MSG_RES:
+        handle_shard_res(server, msg);
+        break;
+      default:
+        assert(false);
+    }
+    node = next;
+  }
+}
+
+static void handle_mailbox(struct server_state *server) {
+  uint64_t count;
+  ssize_t res = read(server->mailbox_fd, &count, sizeof(count));
+  if (res == -1 && errno != EAGAIN) {
+    log_errno(LOG_ERROR, "failed to read eventfd");
   }
-  if (set_nonblocking(conn_fd) == -1) {
-    perror("failed to set non-blocking");
+
+  handle_mailbox_messages(server);
+}
+
+/**
+ * Check whether a new connection can be handled, or close it after trying to
+ * send the client an error.
+ */
+static bool admit_connection(struct server_state *server, int conn_fd) {
+  struct server_group *group = server->group;
+  const char *err = NULL;
+  if (server->overloaded) {
+    err = OVERLOADED_ERR;
+  } else if (atomic_fetch_add_explicit(
+                 &group->client_count, 1, memory_order_relaxed) >=
+             group->max_clients) {
+    atomic_fetch_sub_explicit(&group->client_count, 1, memory_order_relaxed);
+    err = "max number of clients reached";
+  }
+  if (err == NULL) {
+    return true;
+  }
+
+  log_msg(LOG_WARN, "rejected connection [%d]: %s", conn_fd, err);
+  // The socket is new so the error fits, but this must never block
+  char reply[ADMIT_ERR_MAX];
+  int len = snprintf(reply, sizeof(reply), "-%s\r\n", err);
+  assert(len > 0 && (size_t)len < sizeof(reply));
+  ssize_t res = send(conn_fd, reply, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  (void)res;
+  close(conn_fd);
+  return false;
+}
+
+static void handle_new_connection(struct server_state *server, int conn_fd) {
+  if (!admit_connection(server, conn_fd)) {
     return;
   }
 
   struct conn *new_conn = get_available_conn(server);
   conn_init(new_conn, conn_fd);
-  dlist_push_back(&server->idle_timeouts, &new_conn->timeout_node);
+  conn_touch(server, new_conn);
 
   struct epoll_event conn_rw_event = {
       .events = EPOLLIN | EPOLLOUT | EPOLLET,
@@ -552,36 +1855,80 @@ static void handle_new_connection(struct server_state *server) {
   };
   int res = epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn_fd, &conn_rw_event);
   if (res == -1) {
-    perror("failed to add connection to epoll group");
+    log_errno(LOG_WARN, "failed to add connection to epoll group");
     handle_end(server, new_conn);
     return;
   }
 
-  fprintf(stderr, "openned connection [%d]\n", conn_fd);
+  log_msg(LOG_DEBUG, "opened connection [%d]", conn_fd);
   // Check immediately in case data is available
   handle_data_available(server, new_conn);
 }
 
+static void handle_accept(
+    struct server_state *server, const struct listener *listener) {
+  // Accept until the backlog is empty since the socket is edge-triggered
+  while (true) {
+    int conn_fd =
+        accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn_fd == -1) {
+      // Another loop sharing the socket may have accepted the connection
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_errno(LOG_WARN, "failed to connect to client");
+      }
+      return;
+    }
+    handle_new_connection(server, conn_fd);
+  }
+}
+
+/** The listener that an epoll event is for, or NULL if it's for another fd */
+static struct listener *find_listener(struct server_state *server, void *ptr) {
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    if (ptr == &server->listeners[i]) {
+      return &server->listeners[i];
+    }
+  }
+  return NULL;
+}
+
 static void handle_timeouts(struct server_state *server) {
   uint64_t now_us = get_monotonic_usec();
 
   // Idle timeouts
-  struct dlist_node *node;
-  while ((node = dlist_peek_front(&server->idle_timeouts)) != NULL) {
-    struct conn *next_timeout_conn =
-        container_of(node, struct conn, timeout_node);
-    uint64_t next_timeout_us =
-        next_timeout_conn->idle_start_us + CONN_TIMEOUT_US;
-    if (next_timeout_us > now_us) {
-      break;
+  struct timer *timer;
+  while ((timer = timer_wheel_pop_expired(&server->idle_timeouts, now_us)) !=
+         NULL) {
+    struct conn *conn = container_of(timer, struct conn, idle_timer);
+
+    // Replies from other shards or outstanding I/O still reference the
+    // connection
+    if (conn->state == CONN_WAIT_REMOTE || conn->state == CONN_WAIT_CLOSE) {
+      conn_touch(server, conn);
+      continue;
     }
 
-    fprintf(
-        stderr, "closing connection [%d] after %lu ms of inactivty\n",
-        next_timeout_conn->fd,
-        (now_us - next_timeout_conn->idle_start_us) / USEC_PER_MSEC);
-    // This handles deletion of the queue node
-    handle_end(server, next_timeout_conn);
+    log_msg(
+        LOG_INFO, "closing connection [%d] after %lu ms of inactivity",
+        conn->fd,
+        (now_us - (timer->expires_us - CONN_TIMEOUT_US)) / USEC_PER_MSEC);
+    handle_end(server, conn);
+  }
+
+  // The timer is only armed while the connection is over the soft limit
+  while ((timer = timer_wheel_pop_expired(
+              &server->output_limit_timeouts, now_us)) != NULL) {
+    struct conn *conn = container_of(timer, struct conn, output_limit_timer);
+    // Checked again once the connection stops waiting
+    if (conn->state == CONN_WAIT_REMOTE || conn->state == CONN_WAIT_CLOSE) {
+      continue;
+    }
+
+    log_msg(
+        LOG_WARN,
+        "closing connection [%d] over the output soft limit for %lu s",
+        conn->fd, server->group->limits.output_soft_us / USEC_PER_SEC);
+    handle_end(server, conn);
   }
 
   for (unsigned deleted = 0; deleted < EXPIRE_MAX_WORK; deleted++) {
@@ -591,12 +1938,30 @@ static void handle_timeouts(struct server_state *server) {
       break;
     }
 
-    store_entry_free_maybe_async(&server->async_task_queue, expired);
+    store_entry_free_maybe_async(&server->group->async_task_queue, expired);
   }
 }
 
+/** Pin the calling thread to `cpu`, if it's not -1 */
+static void pin_thread(int cpu, const char *name) {
+  if (cpu < 0) {
+    return;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+    log_errno(LOG_WARN, "failed to set CPU affinity");
+    return;
+  }
+  log_msg(LOG_INFO, "pinned %s to CPU %d", name, cpu);
+}
+
 static int run_worker_thread(void *arg) {
-  struct work_queue *queue = arg;
+  struct server_group *group = arg;
+  struct work_queue *queue = &group->async_task_queue;
+  pin_thread(group->async_task_cpu, "async worker");
 
   while (true) {
     struct work_task task = work_queue_pop(queue);
@@ -606,29 +1971,819 @@ static int run_worker_thread(void *arg) {
   return thrd_error;
 }
 
-int main(void) {
-  struct server_state server;
-  server_state_setup(&server);
+static uint64_t uring_tag(void *ptr, enum uring_op op) {
+  assert(((uintptr_t)ptr & URING_OP_MASK) == 0);
+  return (uint64_t)(uintptr_t)ptr | op;
+}
+
+static struct io_uring_sqe *uring_sqe(struct server_state *server) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  if (sqe == NULL) {
+    log_flush();
+    fprintf(stderr, "io_uring submission queue full\n");
+    exit(EXIT_FAILURE);
+  }
+  return sqe;
+}
+
+static void uring_submit_accept(
+    struct server_state *server, struct listener *listener) {
+  uring_prep_accept_multishot(
+      uring_sqe(server), listener->fd, uring_tag(listener, URING_OP_ACCEPT));
+}
+
+static void uring_submit_mailbox_read(struct server_state *server) {
+  uring_prep_read(
+      uring_sqe(server), server->mailbox_fd, &server->mailbox_count,
+      sizeof(server->mailbox_count), uring_tag(server, URING_OP_MAILBOX));
+}
 
+static void uring_submit_recv(struct server_state *server, struct conn *conn) {
+  uring_prep_recv_multishot(
+      uring_sqe(server), conn->fd, server->recv_bufs.group_id,
+      uring_tag(conn, URING_OP_RECV));
+  conn->uring_ops++;
+  conn->recv_armed = true;
+}
+
+/**
+ * Stop receiving while the connection has a lot of pending output, or of input
+ * it can't process yet, so that clients which don't read their replies can't
+ * make its buffers grow. With epoll this happens implicitly, since data is only
+ * read when more input is needed and the output isn't blocked.
+ */
+static void uring_update_recv(struct server_state *server, struct conn *conn) {
+  bool pause =
+      reply_remaining(&conn->write_buf, &conn->write_refs) > READ_PAUSE_SIZE ||
+      (conn->state != CONN_WAIT_READ &&
+       offset_buf_remaining(&conn->read_buf) > READ_PAUSE_SIZE);
+  if (pause == conn->recv_paused) {
+    return;
+  }
+
+  conn->recv_paused = pause;
+  if (pause) {
+    if (conn->recv_armed) {
+      // The receive completes once it's cancelled, and isn't re-armed then
+      uring_prep_cancel(
+          uring_sqe(server), uring_tag(conn, URING_OP_RECV),
+          uring_tag(server, URING_OP_CANCEL));
+    }
+  } else if (!conn->recv_armed) {
+    uring_submit_recv(server, conn);
+  }
+}
+
+static void uring_submit_send(struct server_state *server, struct conn *conn) {
+  assert(!conn->send_pending);
+  conn->send_msg = (struct msghdr){
+      .msg_iov = conn->send_iov,
+      .msg_iovlen = reply_fill_iov(
+          &conn->write_buf, &conn->write_refs, conn->send_iov, WRITE_IOV_MAX),
+  };
+  uring_prep_sendmsg(
+      uring_sqe(server), conn->fd, &conn->send_msg,
+      uring_tag(conn, URING_OP_SEND));
+  conn->send_pending = true;
+  conn->uring_ops++;
+}
+
+static void handle_uring_accept(
+    struct server_state *server, struct listener *listener,
+    const struct io_uring_cqe *cqe) {
+  if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+    uring_submit_accept(server, listener);
+  }
+
+  if (cqe->res < 0) {
+    errno = -cqe->res;
+    log_errno(LOG_WARN, "failed to connect to client");
+    return;
+  }
+
+  int conn_fd = cqe->res;
+  if (!admit_connection(server, conn_fd)) {
+    return;
+  }
+
+  struct conn *new_conn = get_available_conn(server);
+  conn_init(new_conn, conn_fd);
+  conn_touch(server, new_conn);
+  uring_submit_recv(server, new_conn);
+
+  log_msg(LOG_DEBUG, "opened connection [%d]", conn_fd);
+  // Move to the waiting state for the receive
+  run_conn(server, new_conn);
+}
+
+/**
+ * Add received data to the connection's input.
+ *
+ * If there's no other input and the connection is waiting for it, the data is
+ * handled in-place instead of being copied, since requests usually arrive
+ * whole.
+ */
+static void conn_recv_data(
+    struct server_state *server, struct conn *conn, struct const_slice data) {
+  struct offset_buf *read_buf = &conn->read_buf;
+  if (offset_buf_remaining(read_buf) == 0 && conn->state == CONN_WAIT_READ) {
+    conn_release_read_buf(server, conn);
+    read_buf->buf = (struct buffer){
+        .size = data.size,
+        .cap = data.size,
+        .data = (void *)data.data,
+    };
+    conn->read_buf_borrowed = true;
+    return;
+  }
+
+  conn_own_read_buf(server, conn);
+  offset_buf_reset_start(read_buf);
+  if (read_buf->buf.data == NULL) {
+    buf_pool_acquire(&server->buf_pool, &read_buf->buf, data.size);
+  }
+  buffer_append_slice(&read_buf->buf, data);
+  uring_update_recv(server, conn);
+}
+
+/**
+ * Close a connection after its socket failed, or once the replies from other
+ * shards it's waiting on no longer reference it.
+ */
+static void handle_uring_conn_failed(
+    struct server_state *server, struct conn *conn) {
+  if (conn->state == CONN_WAIT_REMOTE) {
+    conn->close_pending = true;
+    return;
+  }
+  handle_end(server, conn);
+}
+
+static void handle_uring_recv_result(
+    struct server_state *server, struct conn *conn,
+    const struct io_uring_cqe *cqe, bool more) {
+  if (conn->state == CONN_WAIT_CLOSE) {
+    if (conn->uring_ops == 0) {
+      handle_end(server, conn);
+    }
+    return;
+  }
+
+  if (cqe->res == 0) {
+    log_msg(LOG_DEBUG, "socket EOF [%d]", conn->fd);
+    handle_uring_conn_failed(server, conn);
+    return;
+  }
+  if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+    errno = -cqe->res;
+    log_errno(LOG_WARN, "failed to read from socket");
+    handle_uring_conn_failed(server, conn);
+    return;
+  }
+
+  // The receive stops when running out of buffers (or for other internal
+  // reasons), so it has to be re-armed
+  if (!more && !conn->recv_paused) {
+    uring_submit_recv(server, conn);
+  }
+
+  conn_touch(server, conn);
+  // Otherwise the data is processed once the connection is done writing or
+  // waiting on other shards
+  if (conn->state == CONN_WAIT_READ && cqe->res > 0 &&
+      !conn->req_parser.streaming) {
+    conn->state = CONN_PROCESS_REQ;
+    run_conn(server, conn);
+  }
+}
+
+static void handle_uring_recv(
+    struct server_state *server, struct conn *conn,
+    const struct io_uring_cqe *cqe) {
+  bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+  if (!more) {
+    conn->uring_ops--;
+    conn->recv_armed = false;
+  }
+
+  uint16_t buf_id = 0;
+  bool has_buf = cqe->res > 0 && uring_cqe_buf_id(cqe, &buf_id);
+  if (has_buf && conn->state != CONN_WAIT_CLOSE) {
+    struct const_slice data = make_const_slice(
+        uring_buf_ring_get(&server->recv_bufs, buf_id), cqe->res);
+    if (conn->req_parser.streaming) {
+      const_slice_advance(&data, req_parser_stream(&conn->req_parser, data));
+    }
+    if (data.size > 0) {
+      conn_recv_data(server, conn, data);
+    }
+  }
+
+  handle_uring_recv_result(server, conn, cqe, more);
+  // Anything the connection still needs was moved out of the buffer once it
+  // stopped running
+  if (has_buf) {
+    uring_buf_ring_recycle(&server->recv_bufs, buf_id);
+  }
+}
+
+static void handle_uring_send(
+    struct server_state *server, struct conn *conn,
+    const struct io_uring_cqe *cqe) {
+  conn->uring_ops--;
+  conn->send_pending = false;
+
+  if (conn->state == CONN_WAIT_CLOSE) {
+    if (conn->uring_ops == 0) {
+      handle_end(server, conn);
+    }
+    return;
+  }
+
+  if (cqe->res < 0) {
+    errno = -cqe->res;
+    log_errno(LOG_WARN, "failed to write message");
+    handle_uring_conn_failed(server, conn);
+    return;
+  }
+
+  conn_touch(server, conn);
+  reply_advance(&conn->write_buf, &conn->write_refs, cqe->res);
+  if (reply_remaining(&conn->write_buf, &conn->write_refs) == 0) {
+    conn->state = CONN_PROCESS_REQ;
+  } else {
+    conn->state = CONN_WRITE_RES;
+  }
+  run_conn(server, conn);
+}
+
+static void handle_uring_completion(
+    struct server_state *server, const struct io_uring_cqe *cqe) {
+  enum uring_op op = cqe->user_data & URING_OP_MASK;
+  void *ptr = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+  switch (op) {
+    case URING_OP_ACCEPT:
+      handle_uring_accept(server, ptr, cqe);
+      break;
+    case URING_OP_MAILBOX:
+      if (cqe->res < 0) {
+        errno = -cqe->res;
+        log_errno(LOG_ERROR, "failed to read eventfd");
+      }
+      uring_submit_mailbox_read(server);
+      handle_mailbox_messages(server);
+      break;
+    case URING_OP_RECV:
+      handle_uring_recv(server, ptr, cqe);
+      break;
+    case URING_OP_SEND:
+      handle_uring_send(server, ptr, cqe);
+      break;
+    case URING_OP_CANCEL:
+      // Fails if the receive already completed, which is fine
+      break;
+    default:
+      assert(false);
+  }
+}
+
+static void uring_server_setup(struct server_state *server) {
+  int res = uring_init(&server->ring, URING_ENTRIES);
+  if (res < 0) {
+    errno = -res;
+    die_errno("failed to set up io_uring");
+  }
+
+  res = uring_buf_ring_init(
+      &server->ring, &server->recv_bufs, URING_RECV_BUF_GROUP,
+      URING_RECV_BUF_COUNT, URING_RECV_BUF_SIZE);
+  if (res < 0) {
+    errno = -res;
+    die_errno("failed to register io_uring buffers");
+  }
+
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    uring_submit_accept(server, &server->listeners[i]);
+  }
+  uring_submit_mailbox_read(server);
+}
+
+/**
+ * Account for an iteration of a busy-polling loop, and periodically report how
+ * much of the time was spent spinning without finding anything to do.
+ */
+static void busy_poll_account(
+    struct server_state *server, uint64_t now_us, bool idle) {
+  uint64_t iter_us = now_us - server->iter_end_us;
+  server->iter_end_us = now_us;
+  if (idle) {
+    server->spin_us += iter_us;
+  } else {
+    server->work_us += iter_us;
+  }
+
+  if (now_us - server->report_start_us < BUSY_POLL_REPORT_US) {
+    return;
+  }
+  uint64_t total_us = server->spin_us + server->work_us;
+  log_msg(
+      LOG_INFO, "loop %u spun for %lu%% of the last %lu ms", server->shard_id,
+      total_us == 0 ? 0 : server->spin_us * PERCENT / total_us,
+      (now_us - server->report_start_us) / USEC_PER_MSEC);
+  server->spin_us = 0;
+  server->work_us = 0;
+  server->report_start_us = now_us;
+}
+
+/**
+ * Shed load while handling the events of an iteration takes too long on
+ * average.
+ *
+ * Iterations which only shed load are quick, so the loop keeps shedding until
+ * the average is well under the target and it hasn't been over it for a while.
+ * Otherwise, the loop would alternate between shedding and running its backlog
+ * under steady load.
+ */
+static void update_overloaded(
+    struct server_state *server, uint64_t now_us, uint64_t iter_us) {
+  uint64_t target_us = server->group->overload_latency_us;
+  uint64_t scaled_us = server->iter_avg_scaled_us;
+  scaled_us = scaled_us - (scaled_us >> OVERLOAD_AVG_SHIFT) + iter_us;
+  server->iter_avg_scaled_us = scaled_us;
+  uint64_t avg_us = scaled_us >> OVERLOAD_AVG_SHIFT;
+
+  if (avg_us > target_us) {
+    server->shed_until_us = now_us + OVERLOAD_HOLD_US;
+    if (!server->overloaded) {
+      server->overloaded = true;
+      log_msg(
+          LOG_WARN, "loop %u is overloaded, iterations take %lu us on average",
+          server->shard_id, avg_us);
+    }
+  } else if (
+      server->overloaded && avg_us < target_us / 2 &&
+      now_us >= server->shed_until_us) {
+    server->overloaded = false;
+    log_msg(LOG_INFO, "loop %u is no longer overloaded", server->shard_id);
+  }
+}
+
+static bool loop_measured(const struct server_state *server) {
+  return server->group->busy_poll || server->group->overload_latency_us > 0;
+}
+
+/**
+ * Called at the end of each iteration of the loop with the time at which
+ * handling its events started.
+ */
+static void end_loop_iteration(
+    struct server_state *server, uint64_t start_us, bool idle) {
+  uint64_t now_us = get_monotonic_usec();
+  if (server->group->overload_latency_us > 0) {
+    update_overloaded(server, now_us, now_us - start_us);
+  }
+  if (server->group->busy_poll) {
+    busy_poll_account(server, now_us, idle);
+  }
+}
+
+static int run_server_uring(struct server_state *server) {
+  uring_server_setup(server);
+  bool busy_poll = server->group->busy_poll;
+  bool measured = loop_measured(server);
+
+  while (true) {
+    int res;
+    if (busy_poll) {
+      res = uring_submit_and_poll(&server->ring);
+    } else {
+      // Everything queued while handling the last batch of completions is
+      // submitted together with waiting for the next batch
+      res = uring_submit_and_wait(
+          &server->ring, 1, get_next_delay_ms(server));
+    }
+    if (res < 0) {
+      errno = -res;
+      die_errno("failed to submit io_uring operations");
+    }
+
+    uint64_t start_us = measured ? get_monotonic_usec() : 0;
+    bool idle = dlist_empty(&server->ready_conns);
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&server->ring)) != NULL) {
+      struct io_uring_cqe completion = *cqe;
+      uring_cqe_seen(&server->ring);
+      handle_uring_completion(server, &completion);
+      idle = false;
+    }
+
+    handle_ready_conns(server);
+    handle_timeouts(server);
+    if (measured) {
+      end_loop_iteration(server, start_us, idle);
+    }
+  }
+
+  return 0;
+}
+
+static int run_server_epoll(struct server_state *server) {
+  bool measured = loop_measured(server);
   while (true) {
-    int wait_timeout = get_next_delay_ms(&server);
+    bool idle = dlist_empty(&server->ready_conns);
+    int wait_timeout = get_next_delay_ms(server);
     struct epoll_event events[MAX_EVENTS];
     int n_events =
-        epoll_wait(server.epoll_fd, events, MAX_EVENTS, wait_timeout);
+        epoll_wait(server->epoll_fd, events, MAX_EVENTS, wait_timeout);
     if (n_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
       die_errno("failed to get epoll events");
     }
 
+    uint64_t start_us = measured ? get_monotonic_usec() : 0;
     for (int i = 0; i < n_events; i++) {
-      if (events[i].data.ptr == NULL) {
-        handle_new_connection(&server);
+      struct listener *listener = find_listener(server, events[i].data.ptr);
+      if (listener != NULL) {
+        handle_accept(server, listener);
+      } else if (events[i].data.ptr == &server->mailbox) {
+        handle_mailbox(server);
       } else {
-        handle_data_available(&server, events[i].data.ptr);
+        handle_data_available(server, events[i].data.ptr);
       }
     }
 
-    handle_timeouts(&server);
+    handle_ready_conns(server);
+    handle_timeouts(server);
+    if (measured) {
+      end_loop_iteration(server, start_us, idle && n_events == 0);
+    }
   }
 
   return 0;
 }
+
+static int run_server(struct server_state *server) {
+  char name[sizeof("event loop 4294967295")];
+  snprintf(name, sizeof(name), "event loop %u", server->shard_id);
+  pin_thread(server->cpu, name);
+
+  switch (server->group->backend) {
+    case IO_BACKEND_EPOLL:
+      return run_server_epoll(server);
+    case IO_BACKEND_URING:
+      return run_server_uring(server);
+    default:
+      assert(false);
+  }
+}
+
+static int run_server_thread(void *arg) { return run_server(arg); }
+
+_Noreturn static void usage(const char *prog, int status) {
+  fprintf(
+      status == EXIT_SUCCESS ? stdout : stderr,
+      "usage: %s [-t threads] [-b backend] [-l host:port]...\n"
+      "          [-u path[,mode]]... [-q size] [-o hard,soft,seconds]\n"
+      "          [-v level] [-s rate] [-P] [-c cpu,...] [-m clients] [-L ms]\n"
+      "\n"
+      "  -t threads  number of event loops, each owning a shard of the keys\n"
+      "              (default 1)\n"
+      "  -b backend  I/O backend: epoll or io_uring (default epoll)\n"
+      "  -l host:port\n"
+      "              listen on a TCP address, with IPv6 addresses in brackets\n"
+      "              (default 127.0.0.1:1234 if no other sockets are given)\n"
+      "  -u path[,mode]\n"
+      "              listen on a Unix socket, with octal permissions\n"
+      "  -q size     close clients with more unprocessed input than this\n"
+      "              (default 1g)\n"
+      "  -o hard,soft,seconds\n"
+      "              close clients with more pending output than the hard\n"
+      "              limit, or over the soft limit for longer than the given\n"
+      "              time (default 1g,256m,60)\n"
+      "  -v level    minimum level to log: debug, info, warn, error or none\n"
+      "              (default info)\n"
+      "  -s rate     log 1 in this many requests at the debug level\n"
+      "              (default 1)\n"
+      "  -P          busy-poll for events instead of blocking, using a whole\n"
+      "              CPU for each event loop\n"
+      "  -c cpu,...  pin the event loops to these CPUs in order, then the\n"
+      "              async worker thread to the next one if given\n"
+      "  -m clients  maximum number of connected clients (default no limit)\n"
+      "  -L ms       reject new connections and requests while iterations of\n"
+      "              an event loop take longer than this on average, and for\n"
+      "              at least a second after (default off)\n"
+      "\n"
+      "Sizes are in bytes with an optional k, m or g suffix, 0 for no limit.\n",
+      prog);
+  exit(status);
+}
+
+static unsigned parse_count_arg(
+    const char *prog, const char *arg, unsigned long max) {
+  char *end;
+  errno = 0;
+  unsigned long val = strtoul(arg, &end, PARSE_COUNT_BASE);
+  if (*arg == '\0' || *end != '\0' || errno != 0 || val == 0 || val > max) {
+    fprintf(stderr, "invalid count: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+  return (unsigned)val;
+}
+
+/**
+ * Parse a number with an optional size suffix at the start of `*arg`, moving it
+ * past the number.
+ */
+static bool parse_size(const char **arg, uint64_t *size) {
+  char *end;
+  errno = 0;
+  unsigned long long val = strtoull(*arg, &end, PARSE_COUNT_BASE);
+  if (end == *arg || **arg == '-' || errno != 0) {
+    return false;
+  }
+
+  unsigned shift = 0;
+  switch (*end) {
+    case 'k':
+      shift = KIB_SHIFT;
+      break;
+    case 'm':
+      shift = MIB_SHIFT;
+      break;
+    case 'g':
+      shift = GIB_SHIFT;
+      break;
+    default:
+      break;
+  }
+  if (shift > 0) {
+    end++;
+  }
+  if (val > (UINT64_MAX >> shift)) {
+    return false;
+  }
+
+  *size = (uint64_t)val << shift;
+  *arg = end;
+  return true;
+}
+
+static uint64_t parse_size_arg(const char *prog, const char *arg) {
+  const char *pos = arg;
+  uint64_t size;
+  if (!parse_size(&pos, &size) || *pos != '\0') {
+    fprintf(stderr, "invalid size: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+  return size;
+}
+
+static void parse_output_limits_arg(
+    const char *prog, const char *arg, struct conn_limits *limits) {
+  const char *pos = arg;
+  uint64_t soft_sec;
+  bool valid = parse_size(&pos, &limits->output_hard) && *pos++ == ',' &&
+               parse_size(&pos, &limits->output_soft) && *pos++ == ',' &&
+               parse_size(&pos, &soft_sec) && *pos == '\0' &&
+               soft_sec <= UINT64_MAX / USEC_PER_SEC;
+  if (!valid) {
+    fprintf(stderr, "invalid output limits: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+  limits->output_soft_us = soft_sec * USEC_PER_SEC;
+}
+
+static struct listen_addr *add_listen_addr(
+    const char *prog, struct server_config *config) {
+  if (config->listen_count == LISTEN_MAX) {
+    fprintf(stderr, "too many sockets, at most %d are supported\n", LISTEN_MAX);
+    usage(prog, EXIT_FAILURE);
+  }
+
+  struct listen_addr *listen_addr =
+      &config->listen_addrs[config->listen_count++];
+  memset(listen_addr, 0, sizeof(*listen_addr));
+  listen_addr->unix_mode = -1;
+  return listen_addr;
+}
+
+static bool resolve_tcp_addr(
+    const char *host, const char *port, struct listen_addr *listen_addr) {
+  struct addrinfo hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_socktype = SOCK_STREAM,
+      .ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV,
+  };
+  struct addrinfo *info;
+  if (getaddrinfo(host, port, &hints, &info) != 0) {
+    return false;
+  }
+
+  memcpy(&listen_addr->addr, info->ai_addr, info->ai_addrlen);
+  listen_addr->addr_len = info->ai_addrlen;
+  freeaddrinfo(info);
+  return true;
+}
+
+static void parse_tcp_addr_arg(
+    const char *prog, const char *arg, struct server_config *config) {
+  char host[NI_MAXHOST];
+  const char *port = strrchr(arg, ':');
+  size_t host_len = port == NULL ? 0 : (size_t)(port - arg);
+  const char *host_start = arg;
+  // IPv6 addresses contain colons themselves
+  if (host_len >= 2 && arg[0] == '[' && arg[host_len - 1] == ']') {
+    host_start++;
+    host_len -= 2;
+  }
+
+  struct listen_addr *listen_addr = add_listen_addr(prog, config);
+  bool valid = port != NULL && host_len > 0 && host_len < sizeof(host);
+  if (valid) {
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+    valid = resolve_tcp_addr(host, port + 1, listen_addr);
+  }
+  if (!valid) {
+    fprintf(stderr, "invalid address: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+}
+
+static void parse_unix_addr_arg(
+    const char *prog, const char *arg, struct server_config *config) {
+  struct listen_addr *listen_addr = add_listen_addr(prog, config);
+  struct sockaddr_un *addr = (struct sockaddr_un *)&listen_addr->addr;
+
+  const char *mode = strrchr(arg, ',');
+  size_t path_len = mode == NULL ? strlen(arg) : (size_t)(mode - arg);
+  if (path_len == 0 || path_len >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "invalid socket path: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, arg, path_len);
+  addr->sun_path[path_len] = '\0';
+  listen_addr->addr_len =
+      (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len + 1);
+
+  if (mode != NULL) {
+    char *end;
+    unsigned long val = strtoul(mode + 1, &end, UNIX_MODE_BASE);
+    if (mode[1] == '\0' || *end != '\0' || val > UNIX_MODE_MAX) {
+      fprintf(stderr, "invalid socket permissions: %s\n", mode + 1);
+      usage(prog, EXIT_FAILURE);
+    }
+    listen_addr->unix_mode = (int)val;
+  }
+}
+
+static enum log_level parse_log_level_arg(const char *prog, const char *arg) {
+  static const char *const names[] = {
+      [LOG_DEBUG] = "debug",
+      [LOG_INFO] = "info",
+      [LOG_WARN] = "warn",
+      [LOG_ERROR] = "error",
+      [LOG_NONE] = "none",
+  };
+  size_t count = sizeof(names) / sizeof(names[0]);
+  size_t level = 0;
+  while (level < count && strcmp(arg, names[level]) != 0) {
+    level++;
+  }
+  if (level == count) {
+    fprintf(stderr, "invalid log level: %s\n", arg);
+    usage(prog, EXIT_FAILURE);
+  }
+  return (enum log_level)level;
+}
+
+static void parse_cpus_arg(
+    const char *prog, const char *arg, struct server_config *config) {
+  const char *pos = arg;
+  config->cpu_count = 0;
+  while (true) {
+    char *end;
+    errno = 0;
+    unsigned long cpu = strtoul(pos, &end, PARSE_COUNT_BASE);
+    bool valid = end != pos && *pos != '-' && errno == 0 &&
+                 cpu < CPU_SETSIZE && config->cpu_count < MAX_PINNED_CPUS &&
+                 (*end == ',' || *end == '\0');
+    if (!valid) {
+      fprintf(stderr, "invalid CPU list: %s\n", arg);
+      usage(prog, EXIT_FAILURE);
+    }
+
+    config->cpus[config->cpu_count++] = (int)cpu;
+    if (*end == '\0') {
+      return;
+    }
+    pos = end + 1;
+  }
+}
+
+static void parse_args(int argc, char **argv, struct server_config *config) {
+  *config = (struct server_config){
+      .threads = 1,
+      .backend = IO_BACKEND_EPOLL,
+      .limits =
+          {
+              .query_max = 1ULL << GIB_SHIFT,
+              .output_hard = 1ULL << GIB_SHIFT,
+              .output_soft = 256ULL << MIB_SHIFT,
+              .output_soft_us = 60ULL * USEC_PER_SEC,
+          },
+      .log_level = LOG_INFO,
+      .log_sample_rate = 1,
+  };
+
+  int opt;
+  while ((opt = getopt(argc, argv, "hb:t:l:u:q:o:v:s:Pc:m:L:")) != -1) {
+    switch (opt) {
+      case 'b':
+        if (strcmp(optarg, "epoll") == 0) {
+          config->backend = IO_BACKEND_EPOLL;
+        } else if (strcmp(optarg, "io_uring") == 0) {
+          config->backend = IO_BACKEND_URING;
+        } else {
+          fprintf(stderr, "invalid backend: %s\n", optarg);
+          usage(argv[0], EXIT_FAILURE);
+        }
+        break;
+      case 't':
+        config->threads = parse_count_arg(argv[0], optarg, MAX_THREADS);
+        break;
+      case 'l':
+        parse_tcp_addr_arg(argv[0], optarg, config);
+        break;
+      case 'u':
+        parse_unix_addr_arg(argv[0], optarg, config);
+        break;
+      case 'q':
+        config->limits.query_max = parse_size_arg(argv[0], optarg);
+        break;
+      case 'o':
+        parse_output_limits_arg(argv[0], optarg, &config->limits);
+        break;
+      case 'v':
+        config->log_level = parse_log_level_arg(argv[0], optarg);
+        break;
+      case 's':
+        config->log_sample_rate = parse_count_arg(argv[0], optarg, UINT32_MAX);
+        break;
+      case 'P':
+        config->busy_poll = true;
+        break;
+      case 'c':
+        parse_cpus_arg(argv[0], optarg, config);
+        break;
+      case 'm':
+        config->max_clients = parse_count_arg(argv[0], optarg, MAX_CLIENTS_MAX);
+        break;
+      case 'L':
+        config->overload_latency_us =
+            (uint64_t)parse_count_arg(
+                argv[0], optarg, OVERLOAD_LATENCY_MS_MAX) *
+            USEC_PER_MSEC;
+        break;
+      default:
+        usage(argv[0], opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (optind < argc) {
+    usage(argv[0], EXIT_FAILURE);
+  }
+
+  if (config->listen_count == 0) {
+    struct listen_addr *listen_addr = add_listen_addr(argv[0], config);
+    struct sockaddr_in *addr = (struct sockaddr_in *)&listen_addr->addr;
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(DEFAULT_PORT);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_addr->addr_len = sizeof(*addr);
+  }
+}
+
+int main(int argc, char **argv) {
+  struct server_config config;
+  parse_args(argc, argv, &config);
+  log_init(config.log_level, config.log_sample_rate);
+  hash_seed_init();
+
+  struct server_group group;
+  server_group_setup(&group, &config);
+
+  // The first shard runs on the main thread
+  for (unsigned i = 1; i < group.shard_count; i++) {
+    thrd_t thread;
+    int res = thrd_create(&thread, run_server_thread, &group.shards[i]);
+    assert(res == thrd_success);
+    res = thrd_detach(thread);
+    assert(res == thrd_success);
+  }
+
+  return run_server(&group.shards[0]);
+}
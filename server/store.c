@@ -6,20 +6,17 @@
 #include <string.h>
 
 #include "hashmap.h"
-#include "heap.h"
 #include "object.h"
+#include "timer_wheel.h"
 #include "types.h"
 
 enum {
   STORE_INIT_CAP = 64,
-
-  // TODO: Make the index signed, or just treat this as a special value?
-  TTL_INDEX_NONE = UINT32_MAX,
 };
 
 struct store_entry {
   struct hash_entry entry;
-  struct heap_ref ttl_ref;
+  struct timer ttl_timer;
 
   // Owned
   struct object val;
@@ -27,24 +24,19 @@ struct store_entry {
   struct inline_string key;
 };
 
-struct store_key {
-  struct hash_entry entry;
-  struct const_slice key;
-};
-
-void store_init(struct store *store) {
+void store_init(struct store *store, uint64_t now_us) {
   hash_map_init(&store->map, STORE_INIT_CAP);
-  heap_init(&store->expires);
+  timer_wheel_init(&store->expires, now_us);
 }
 
 static struct store_entry *store_entry_alloc(
-    struct const_slice key, struct object val) {
-  struct store_entry *new = malloc(sizeof(*new) + key.size);
+    struct store_key key, struct object val) {
+  struct store_entry *new = malloc(sizeof(*new) + key.key.size);
   assert(new != NULL);
-  new->ttl_ref.index = TTL_INDEX_NONE;
-  new->entry.hash_code = slice_hash(key);
+  timer_init(&new->ttl_timer);
+  new->entry.hash_code = key.entry.hash_code;
   new->val = val;
-  inline_string_init_slice(&new->key, key);
+  inline_string_init_slice(&new->key, key.key);
   return new;
 }
 
@@ -63,15 +55,9 @@ static bool store_entry_compare(
   return slice_eq(key->key, inline_string_const_slice(&ent->key));
 }
 
-struct object *store_get(struct store *store, struct const_slice key) {
-  // TODO: Re-structure hashmap API to avoid double hashing when inserting?
-  struct store_key key_ent = {
-      .entry.hash_code = slice_hash(key),
-      .key = key,
-  };
-
+struct object *store_get(struct store *store, struct store_key key) {
   struct hash_entry *found =
-      hash_map_get(&store->map, &key_ent.entry, store_entry_compare);
+      hash_map_get(&store->map, &key.entry, store_entry_compare);
   if (found == NULL) {
     return NULL;
   }
@@ -80,19 +66,18 @@ struct object *store_get(struct store *store, struct const_slice key) {
   return &existing->val;
 }
 
-struct object *store_set(
-    struct store *store, struct const_slice key, struct object val) {
-  // TODO: Re-structure hashmap API to avoid double hashing when inserting?
-  struct store_key key_ent = {
-      .entry.hash_code = slice_hash(key),
-      .key = key,
-  };
+void store_prefetch(const struct store *store, struct store_key key) {
+  hash_map_prefetch(&store->map, key.entry.hash_code);
+}
 
+struct object *store_set(
+    struct store *store, struct store_key key, struct object val) {
+  struct hash_slot slot;
   struct hash_entry *existing =
-      hash_map_get(&store->map, &key_ent.entry, store_entry_compare);
+      hash_map_find_slot(&store->map, &key.entry, store_entry_compare, &slot);
   if (existing == NULL) {
     struct store_entry *new_ent = store_entry_alloc(key, val);
-    hash_map_insert(&store->map, &new_ent->entry);
+    hash_map_insert_slot(&store->map, slot, &new_ent->entry);
     return &new_ent->val;
   }
 
@@ -103,31 +88,33 @@ struct object *store_set(
   return &existing_ent->val;
 }
 
-/** Helper for detach functions */
-static struct store_entry *do_detach(
-    struct store *store, struct store_key *key) {
+struct object *store_get_or_insert(
+    struct store *store, struct store_key key,
+    struct object (*make_obj)(void)) {
+  struct hash_slot slot;
+  struct hash_entry *existing =
+      hash_map_find_slot(&store->map, &key.entry, store_entry_compare, &slot);
+  if (existing != NULL) {
+    return &container_of(existing, struct store_entry, entry)->val;
+  }
+
+  struct store_entry *new_ent = store_entry_alloc(key, make_obj());
+  hash_map_insert_slot(&store->map, slot, &new_ent->entry);
+  return &new_ent->val;
+}
+
+struct store_entry *store_detach(struct store *store, struct store_key key) {
   struct hash_entry *removed =
-      hash_map_delete(&store->map, &key->entry, store_entry_compare);
+      hash_map_delete(&store->map, &key.entry, store_entry_compare);
   if (removed == NULL) {
     return NULL;
   }
 
   struct store_entry *ent = container_of(removed, struct store_entry, entry);
-  if (ent->ttl_ref.index != TTL_INDEX_NONE) {
-    heap_pop(&store->expires, ent->ttl_ref.index);
-  }
+  timer_wheel_cancel(&store->expires, &ent->ttl_timer);
   return ent;
 }
 
-struct store_entry *store_detach(struct store *store, struct const_slice key) {
-  struct store_key key_ent = {
-      .entry.hash_code = slice_hash(key),
-      .key = key,
-  };
-
-  return do_detach(store, &key_ent);
-}
-
 struct object *store_entry_object(struct store_entry *entry) {
   return &entry->val;
 }
@@ -151,54 +138,36 @@ void store_iter(struct store *store, store_iter_fn iter, void *arg) {
 
 int64_t store_object_get_expire(
     const struct store *store, const struct object *obj) {
+  (void)store;
   struct store_entry *entry = container_of(obj, struct store_entry, val);
-  if (entry->ttl_ref.index == TTL_INDEX_NONE) {
+  if (!timer_armed(&entry->ttl_timer)) {
     return -1;
   }
 
-  return (int64_t)store->expires.data[entry->ttl_ref.index].value;
+  return (int64_t)entry->ttl_timer.expires_us;
 }
 
 void store_object_set_expire(
-    struct store *store, struct object *obj, int64_t timestamp_ms) {
+    struct store *store, struct object *obj, int64_t timestamp_us) {
   struct store_entry *entry = container_of(obj, struct store_entry, val);
-  if (timestamp_ms < 0) {
-    if (entry->ttl_ref.index != TTL_INDEX_NONE) {
-      heap_pop(&store->expires, entry->ttl_ref.index);
-      entry->ttl_ref.index = TTL_INDEX_NONE;
-    }
+  if (timestamp_us < 0) {
+    timer_wheel_cancel(&store->expires, &entry->ttl_timer);
   } else {
-    if (entry->ttl_ref.index == TTL_INDEX_NONE) {
-      heap_insert(&store->expires, timestamp_ms, &entry->ttl_ref);
-    } else {
-      heap_update(&store->expires, entry->ttl_ref.index, timestamp_ms);
-    }
+    timer_wheel_arm(&store->expires, &entry->ttl_timer, timestamp_us);
   }
 }
 
 struct store_entry *store_detach_next_expired(
     struct store *store, uint64_t expired_after_us) {
-  if (heap_empty(&store->expires)) {
-    return NULL;
-  }
-
-  struct heap_node next = heap_peek_min(&store->expires);
-  if (next.value > expired_after_us) {
+  struct timer *expired =
+      timer_wheel_pop_expired(&store->expires, expired_after_us);
+  if (expired == NULL) {
     return NULL;
   }
   struct store_entry *to_expire =
-      container_of(next.backref, struct store_entry, ttl_ref);
-
-  // TODO: Refactor the hashmap API so that an entry can be deleted by
-  // reference (currently this isn't possible since we need the "parent" ref
-  // in the hash bucket linked list)
-  struct store_key key = {
-      .entry.hash_code = to_expire->entry.hash_code,
-      .key = inline_string_const_slice(&to_expire->key),
-  };
-
-  // do_detach handles removing the entry from the heap
-  struct store_entry *detached = do_detach(store, &key);
-  assert(detached == to_expire);
+      container_of(expired, struct store_entry, ttl_timer);
+
+  // The timer was already removed by popping it
+  hash_map_remove(&store->map, &to_expire->entry);
   return to_expire;
 }
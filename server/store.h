@@ -4,27 +4,47 @@
 #include <stdint.h>
 
 #include "hashmap.h"
-#include "heap.h"
 #include "object.h"
+#include "timer_wheel.h"
 #include "types.h"
 
 struct store {
   struct hash_map map;
-  struct heap expires;
+  struct timer_wheel expires;
 };
 
-void store_init(struct store *store);
+void store_init(struct store *store, uint64_t now_us);
 
 static inline uint32_t store_size(const struct store *store) {
   return hash_map_size(&store->map);
 }
 
-struct object *store_get(struct store *store, struct const_slice key);
+/** A key with its hash, so that it's only hashed once per request */
+struct store_key {
+  struct hash_entry entry;
+  struct const_slice key;
+};
+
+static inline struct store_key make_hashed_store_key(
+    struct const_slice key, hash_t hash_code) {
+  return (struct store_key){.entry.hash_code = hash_code, .key = key};
+}
+
+static inline struct store_key make_store_key(struct const_slice key) {
+  return make_hashed_store_key(key, slice_hash(key));
+}
+
+struct object *store_get(struct store *store, struct store_key key);
+/** Hint that a key is about to be looked up */
+void store_prefetch(const struct store *store, struct store_key key);
 struct object *store_set(
-    struct store *store, struct const_slice key, struct object val);
+    struct store *store, struct store_key key, struct object val);
+/** Get the object of a key, or insert the one `make_obj` returns if missing */
+struct object *store_get_or_insert(
+    struct store *store, struct store_key key, struct object (*make_obj)(void));
 
 // Delete is 2 steps so the deletion can be async
-struct store_entry *store_detach(struct store *store, struct const_slice key);
+struct store_entry *store_detach(struct store *store, struct store_key key);
 struct object *store_entry_object(struct store_entry *entry);
 void store_entry_free(struct store_entry *entry);
 
@@ -35,7 +55,7 @@ void store_iter(struct store *store, store_iter_fn iter, void *arg);
 int64_t store_object_get_expire(
     const struct store *store, const struct object *obj);
 void store_object_set_expire(
-    struct store *store, struct object *obj, int64_t timestamp_ms);
+    struct store *store, struct object *obj, int64_t timestamp_us);
 
 struct store_entry *store_detach_next_expired(
     struct store *store, uint64_t expired_after_us);
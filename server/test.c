@@ -2,14 +2,22 @@ void test_parser(void);
 void test_writer(void);
 void test_hashmap(void);
 void test_avl(void);
-void test_heap(void);
+void test_buf_pool(void);
+void test_mailbox(void);
+void test_number(void);
+void test_reply(void);
+void test_timer_wheel(void);
 
 int main(void) {
   test_parser();
   test_writer();
   test_hashmap();
   test_avl();
-  test_heap();
+  test_buf_pool();
+  test_mailbox();
+  test_number();
+  test_reply();
+  test_timer_wheel();
 
   return 0;
 }
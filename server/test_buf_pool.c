@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "buf_pool.h"
+#include "buffer.h"
+#include "test.h"
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+static void test_buf_pool_acquire_rounds_up_to_class(void) {
+  struct buf_pool pool;
+  buf_pool_init(&pool);
+
+  struct buffer buf = {0};
+  buf_pool_acquire(&pool, &buf, 1);
+  assert(buf.data != NULL);
+  assert(buf.size == 0);
+  assert(buf.cap == BUF_POOL_MIN_SIZE);
+  buf_pool_release(&pool, &buf);
+  assert(buf.data == NULL);
+
+  buf_pool_acquire(&pool, &buf, BUF_POOL_MIN_SIZE + 1);
+  assert(buf.cap == BUF_POOL_MIN_SIZE * 2);
+  buf_pool_release(&pool, &buf);
+
+  // Larger than any class
+  buf_pool_acquire(&pool, &buf, BUF_POOL_MAX_SIZE + 1);
+  assert(buf.cap == BUF_POOL_MAX_SIZE + 1);
+  buf_pool_release(&pool, &buf);
+  assert(pool.free_count[BUF_POOL_CLASSES - 1] == 0);
+
+  buf_pool_destroy(&pool);
+}
+
+static void test_buf_pool_reuses_released(void) {
+  struct buf_pool pool;
+  buf_pool_init(&pool);
+
+  struct buffer buf = {0};
+  buf_pool_acquire(&pool, &buf, 100);
+  void *data = buf.data;
+  buffer_append(&buf, "abc", 3);
+  buf_pool_release(&pool, &buf);
+  assert(pool.free_count[0] == 1);
+
+  struct buffer other = {0};
+  buf_pool_acquire(&pool, &other, 100);
+  assert(other.data == data);
+  assert(other.size == 0);
+  assert(pool.free_count[0] == 0);
+  buf_pool_release(&pool, &other);
+
+  buf_pool_destroy(&pool);
+}
+
+static void test_buf_pool_grown_buffer_returns_to_class(void) {
+  struct buf_pool pool;
+  buf_pool_init(&pool);
+
+  struct buffer buf = {0};
+  buf_pool_acquire(&pool, &buf, BUF_POOL_MIN_SIZE);
+  buffer_ensure_cap(&buf, BUF_POOL_MIN_SIZE * 3);
+  assert(buf.cap == BUF_POOL_MIN_SIZE * 4);
+  buf_pool_release(&pool, &buf);
+  assert(pool.free_count[0] == 0);
+  assert(pool.free_count[2] == 1);
+
+  // Grown past the largest class, so it's freed
+  buf_pool_acquire(&pool, &buf, BUF_POOL_MAX_SIZE);
+  buffer_ensure_cap(&buf, BUF_POOL_MAX_SIZE + 1);
+  buf_pool_release(&pool, &buf);
+  assert(pool.free_count[BUF_POOL_CLASSES - 1] == 0);
+
+  buf_pool_destroy(&pool);
+}
+
+static void test_buf_pool_limits_free_memory(void) {
+  enum { COUNT = BUF_POOL_CLASS_MAX_FREE / BUF_POOL_MAX_SIZE + 4 };
+
+  struct buf_pool pool;
+  buf_pool_init(&pool);
+
+  struct buffer bufs[COUNT];
+  memset(bufs, 0, sizeof(bufs));
+  for (size_t i = 0; i < COUNT; i++) {
+    buf_pool_acquire(&pool, &bufs[i], BUF_POOL_MAX_SIZE);
+  }
+  for (size_t i = 0; i < COUNT; i++) {
+    buf_pool_release(&pool, &bufs[i]);
+  }
+  unsigned last = BUF_POOL_CLASSES - 1;
+  assert(pool.free_count[last] * BUF_POOL_MAX_SIZE == BUF_POOL_CLASS_MAX_FREE);
+
+  buf_pool_destroy(&pool);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+void test_buf_pool(void) {
+  RUN_TEST(test_buf_pool_acquire_rounds_up_to_class);
+  RUN_TEST(test_buf_pool_reuses_released);
+  RUN_TEST(test_buf_pool_grown_buffer_returns_to_class);
+  RUN_TEST(test_buf_pool_limits_free_memory);
+}
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "hashmap.h"
 #include "test.h"
@@ -190,6 +191,202 @@ static void test_hashmap_insert_and_delete_many_entries(void) {
   destroy(&map);
 }
 
+static void test_hashmap_same_hash_spanning_groups(void) {
+  struct hash_map map;
+  hash_map_init(&map, 8);
+
+  // More entries than fit in a group, all probing the same way
+  enum { COUNT = 100 };
+  struct test_node *nodes[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    nodes[i] = test_node_alloc(i, i * 2);
+    nodes[i]->entry.hash_code = 42;
+    hash_map_insert(&map, &nodes[i]->entry);
+  }
+
+  // Deleting from the first groups mustn't hide the later ones
+  for (int i = 0; i < COUNT; i += 3) {
+    struct test_node key;
+    test_key_init(&key, i);
+    key.entry.hash_code = 42;
+    struct hash_entry *removed =
+        hash_map_delete(&map, &key.entry, test_node_cmp);
+    assert(removed == &nodes[i]->entry);
+    free(nodes[i]);
+  }
+  for (int i = 0; i < COUNT; i++) {
+    struct test_node key;
+    test_key_init(&key, i);
+    key.entry.hash_code = 42;
+    struct hash_entry *found = hash_map_get(&map, &key.entry, test_node_cmp);
+    assert(i % 3 == 0 ? found == NULL : found == &nodes[i]->entry);
+  }
+
+  destroy(&map);
+}
+
+static void test_hashmap_churn_reuses_deleted_slots(void) {
+  struct hash_map map;
+  hash_map_init(&map, 8);
+
+  enum { LIVE = 1000, ROUNDS = 100000 };
+  for (int i = 0; i < LIVE; i++) {
+    hash_map_insert(&map, &test_node_alloc(i, i)->entry);
+  }
+
+  // Keep the size constant while every key is eventually replaced
+  for (int i = LIVE; i < LIVE + ROUNDS; i++) {
+    struct test_node key;
+    test_key_init(&key, i - LIVE);
+    free(hash_map_delete(&map, &key.entry, test_node_cmp));
+    hash_map_insert(&map, &test_node_alloc(i, i)->entry);
+  }
+
+  assert(hash_map_size(&map) == LIVE);
+  // Deleted slots are cleaned up by rehashing rather than growing
+  assert(map.table.mask + 1 <= 4 * LIVE);
+  for (int i = ROUNDS; i < LIVE + ROUNDS; i++) {
+    struct test_node key;
+    test_key_init(&key, i);
+    assert(hash_map_get(&map, &key.entry, test_node_cmp) != NULL);
+  }
+
+  destroy(&map);
+}
+
+static void test_hashmap_find_slot_then_insert(void) {
+  struct hash_map map;
+  hash_map_init(&map, 8);
+
+  // Enough to go through resizes, with every key inserted by a lookup
+  for (int i = 0; i < 10000; i++) {
+    struct test_node key;
+    test_key_init(&key, i / 2);
+    struct hash_slot slot;
+    struct hash_entry *found =
+        hash_map_find_slot(&map, &key.entry, test_node_cmp, &slot);
+    if (i % 2 == 1) {
+      // Inserted just before
+      assert(found != NULL);
+      assert(container_of(found, struct test_node, entry)->key == i / 2);
+      continue;
+    }
+
+    assert(found == NULL);
+    hash_map_insert_slot(&map, slot, &test_node_alloc(i / 2, i)->entry);
+  }
+
+  assert(hash_map_size(&map) == 5000);
+  for (int i = 0; i < 5000; i++) {
+    struct test_node key;
+    test_key_init(&key, i);
+    struct test_node *found =
+        (void *)hash_map_get(&map, &key.entry, test_node_cmp);
+    assert(found != NULL && found->val == i * 2);
+  }
+
+  destroy(&map);
+}
+
+static void test_hashmap_remove_by_reference(void) {
+  struct hash_map map;
+  hash_map_init(&map, 8);
+
+  // Equal keys and hashes, which only the pointers tell apart
+  enum { COUNT = 1000 };
+  struct test_node *nodes[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    nodes[i] = test_node_alloc(i % 2 == 0 ? 1 : i, i);
+    hash_map_insert(&map, &nodes[i]->entry);
+  }
+
+  for (int i = 0; i < COUNT; i += 2) {
+    hash_map_remove(&map, &nodes[i]->entry);
+    free(nodes[i]);
+  }
+  assert(hash_map_size(&map) == COUNT / 2);
+
+  // Only the others are left
+  int popped = 0;
+  struct hash_entry *entry;
+  while ((entry = hash_map_pop(&map)) != NULL) {
+    struct test_node *node = container_of(entry, struct test_node, entry);
+    assert(node->val % 2 == 1);
+    free(node);
+    popped++;
+  }
+  assert(popped == COUNT / 2);
+
+  destroy(&map);
+}
+
+static void test_hashmap_shrinks_after_deleting(void) {
+  struct hash_map map;
+  hash_map_init(&map, 8);
+
+  enum { COUNT = 100000, KEPT = 100 };
+  for (int i = 0; i < COUNT; i++) {
+    hash_map_insert(&map, &test_node_alloc(i, i)->entry);
+  }
+  uint32_t peak_capacity = map.table.mask + 1;
+
+  // Large tables leave room for inserts while they move their entries, so
+  // deletes keep shrinking them in more than one step
+  uint32_t capacity = peak_capacity;
+  int shrink_steps = 0;
+  for (int i = KEPT; i < COUNT; i++) {
+    struct test_node key;
+    test_key_init(&key, i);
+    free(hash_map_delete(&map, &key.entry, test_node_cmp));
+    if (map.table.mask + 1 < capacity) {
+      capacity = map.table.mask + 1;
+      shrink_steps++;
+    }
+    // Entries stay reachable while they're moved to the smaller table
+    if (i % 1000 == 0) {
+      for (int j = 0; j < KEPT; j++) {
+        test_key_init(&key, j);
+        assert(hash_map_get(&map, &key.entry, test_node_cmp) != NULL);
+      }
+    }
+  }
+
+  // Lookups only finish moving the entries, they never shrink the table
+  for (int i = 0; i < 100; i++) {
+    struct test_node key;
+    test_key_init(&key, i % KEPT);
+    assert(hash_map_get(&map, &key.entry, test_node_cmp) != NULL);
+  }
+  assert(shrink_steps > 1);
+  assert(hash_map_size(&map) == KEPT);
+  assert(map.table.mask + 1 == capacity);
+  assert(capacity < peak_capacity / 16);
+
+  destroy(&map);
+}
+
+static void test_slice_hash_covers_every_byte(void) {
+  uint8_t data[100] = {0};
+  uint8_t copy[100 + 3];
+  for (size_t size = 0; size <= sizeof(data); size++) {
+    uint64_t hash = slice_hash64(make_const_slice(data, size));
+    // Only the contents matter, not the alignment
+    memcpy(copy + 3, data, size);
+    assert(slice_hash64(make_const_slice(copy + 3, size)) == hash);
+
+    for (size_t i = 0; i < size; i++) {
+      data[i] ^= 1;
+      assert(slice_hash64(make_const_slice(data, size)) != hash);
+      data[i] ^= 1;
+    }
+  }
+
+  // Sizes are hashed too, not just the bytes
+  assert(
+      slice_hash64(make_const_slice(data, 3)) !=
+      slice_hash64(make_const_slice(data, 4)));
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 void test_hashmap(void) {
@@ -203,4 +400,11 @@ void test_hashmap(void) {
   RUN_TEST(test_hashmap_get_after_delete_and_reinsert);
 
   RUN_TEST(test_hashmap_insert_and_delete_many_entries);
+  RUN_TEST(test_hashmap_same_hash_spanning_groups);
+  RUN_TEST(test_hashmap_churn_reuses_deleted_slots);
+  RUN_TEST(test_hashmap_find_slot_then_insert);
+  RUN_TEST(test_hashmap_remove_by_reference);
+  RUN_TEST(test_hashmap_shrinks_after_deleting);
+
+  RUN_TEST(test_slice_hash_covers_every_byte);
 }
@@ -0,0 +1,117 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "mailbox.h"
+#include "test.h"
+#include "types.h"
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+struct test_msg {
+  struct mailbox_node node;
+  int producer;
+  int seq;
+};
+
+static void test_mailbox_empty_at_init(void) {
+  struct mailbox box;
+  mailbox_init(&box);
+  assert(mailbox_take_all(&box) == NULL);
+}
+
+static void test_mailbox_push_reports_empty(void) {
+  struct mailbox box;
+  mailbox_init(&box);
+  struct test_msg msgs[2];
+  assert(mailbox_push(&box, &msgs[0].node));
+  assert(!mailbox_push(&box, &msgs[1].node));
+  assert(mailbox_take_all(&box) != NULL);
+  assert(mailbox_push(&box, &msgs[0].node));
+}
+
+static void test_mailbox_take_all_in_push_order(void) {
+  struct mailbox box;
+  mailbox_init(&box);
+  struct test_msg msgs[10];
+  for (int i = 0; i < 10; i++) {
+    msgs[i].seq = i;
+    mailbox_push(&box, &msgs[i].node);
+  }
+
+  struct mailbox_node *node = mailbox_take_all(&box);
+  for (int i = 0; i < 10; i++) {
+    assert(node != NULL);
+    assert(container_of(node, struct test_msg, node)->seq == i);
+    node = node->next;
+  }
+  assert(node == NULL);
+  assert(mailbox_take_all(&box) == NULL);
+}
+
+enum {
+  PRODUCER_COUNT = 4,
+  PRODUCER_MSG_COUNT = 100000,
+};
+
+struct producer_ctx {
+  struct mailbox *box;
+  int producer;
+  struct test_msg *msgs;
+};
+
+static int run_producer(void *arg) {
+  struct producer_ctx *ctx = arg;
+  for (int i = 0; i < PRODUCER_MSG_COUNT; i++) {
+    ctx->msgs[i].producer = ctx->producer;
+    ctx->msgs[i].seq = i;
+    mailbox_push(ctx->box, &ctx->msgs[i].node);
+  }
+  return 0;
+}
+
+static void test_mailbox_multiple_producers(void) {
+  struct mailbox box;
+  mailbox_init(&box);
+
+  thrd_t threads[PRODUCER_COUNT];
+  struct producer_ctx ctxs[PRODUCER_COUNT];
+  for (int p = 0; p < PRODUCER_COUNT; p++) {
+    ctxs[p] = (struct producer_ctx){
+        .box = &box,
+        .producer = p,
+        .msgs = malloc(sizeof(struct test_msg) * PRODUCER_MSG_COUNT),
+    };
+    int res = thrd_create(&threads[p], run_producer, &ctxs[p]);
+    assert(res == thrd_success);
+  }
+
+  // Messages from each producer must be received in order
+  int next_seq[PRODUCER_COUNT] = {0};
+  int received = 0;
+  while (received < PRODUCER_COUNT * PRODUCER_MSG_COUNT) {
+    struct mailbox_node *node = mailbox_take_all(&box);
+    for (; node != NULL; node = node->next) {
+      struct test_msg *msg = container_of(node, struct test_msg, node);
+      assert(msg->seq == next_seq[msg->producer]);
+      next_seq[msg->producer]++;
+      received++;
+    }
+  }
+
+  for (int p = 0; p < PRODUCER_COUNT; p++) {
+    int res = thrd_join(threads[p], NULL);
+    assert(res == thrd_success);
+    free(ctxs[p].msgs);
+  }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+void test_mailbox(void) {
+  RUN_TEST(test_mailbox_empty_at_init);
+  RUN_TEST(test_mailbox_push_reports_empty);
+  RUN_TEST(test_mailbox_take_all_in_push_order);
+  RUN_TEST(test_mailbox_multiple_producers);
+}
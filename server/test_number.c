@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+#include "test.h"
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+#define parse_int_str(val, str) number_parse_int((val), (str), strlen(str))
+#define parse_double_str(val, str) \
+  number_parse_double((val), (str), strlen(str))
+
+static void assert_format_int(int64_t val, const char *expected) {
+  char out[NUMBER_INT_MAX_LEN];
+  size_t len = number_format_int(out, val);
+  assert(len == strlen(expected));
+  assert(memcmp(out, expected, len) == 0);
+}
+
+static void assert_format_double(double val, const char *expected) {
+  char out[NUMBER_DOUBLE_BUF_SIZE];
+  size_t len = number_format_double(out, val);
+  assert(len == strlen(expected));
+  assert(strcmp(out, expected) == 0);
+}
+
+static void test_number_format_int(void) {
+  assert_format_int(0, "0");
+  assert_format_int(7, "7");
+  assert_format_int(10, "10");
+  assert_format_int(99, "99");
+  assert_format_int(100, "100");
+  assert_format_int(-1, "-1");
+  assert_format_int(1200451, "1200451");
+  assert_format_int(INT64_MAX, "9223372036854775807");
+  assert_format_int(INT64_MIN, "-9223372036854775808");
+
+  char out[NUMBER_UINT_MAX_LEN];
+  assert(number_format_uint(out, UINT64_MAX) == NUMBER_UINT_MAX_LEN);
+  assert(memcmp(out, "18446744073709551615", NUMBER_UINT_MAX_LEN) == 0);
+}
+
+static void test_number_format_int_matches_printf(void) {
+  srand(1);
+  for (int i = 0; i < 100000; i++) {
+    // Random magnitudes, not just large numbers
+    int64_t val = (int64_t)(((uint64_t)rand() << 32) ^ (uint64_t)rand()) >>
+                  (rand() % 63);
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%" PRId64, val);
+    assert_format_int(val, expected);
+  }
+}
+
+static void test_number_format_double(void) {
+  assert_format_double(0, "0");
+  assert_format_double(-0.0, "-0");
+  assert_format_double(1.5, "1.5");
+  assert_format_double(-42, "-42");
+  assert_format_double(0.1, "0.1");
+  assert_format_double(0.1 + 0.2, "0.30000000000000004");
+  assert_format_double(1e100, "1e+100");
+  assert_format_double(123456789012, "123456789012");
+  assert_format_double(99.99, "99.99");
+  assert_format_double(-1234.25, "-1234.25");
+  assert_format_double(0.001, "0.001");
+  assert_format_double(1e-7, "0.0000001");
+  assert_format_double(1.5e-20, "1.5e-20");
+  assert_format_double(NAN, "nan");
+  assert_format_double(INFINITY, "inf");
+  assert_format_double(-INFINITY, "-inf");
+}
+
+static void test_number_format_double_round_trips(void) {
+  srand(2);
+  for (int i = 0; i < 100000; i++) {
+    uint64_t bits = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 2) ^
+                    (uint64_t)rand();
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    if (!isfinite(val)) {
+      continue;
+    }
+
+    char out[NUMBER_DOUBLE_BUF_SIZE];
+    number_format_double(out, val);
+    double parsed;
+    assert(parse_double_str(&parsed, out));
+    assert(memcmp(&parsed, &val, sizeof(val)) == 0);
+  }
+}
+
+/** Significant digits of a formatted number, without trailing zeros */
+static int count_significant(const char *str) {
+  int count = 0;
+  int nonzero_count = 0;
+  for (; *str != '\0' && *str != 'e'; str++) {
+    if (*str >= '1' && *str <= '9') {
+      count++;
+      nonzero_count = count;
+    } else if (*str == '0' && count > 0) {
+      count++;
+    }
+  }
+  return nonzero_count;
+}
+
+static void test_number_format_double_is_shortest(void) {
+  srand(4);
+  for (int i = 0; i < 100000; i++) {
+    // Mostly short decimals, like scores
+    double val = (double)(rand() % 10000000) / pow(10, rand() % 8);
+    if (i % 4 == 0) {
+      val = (double)rand() / RAND_MAX;
+    }
+
+    char out[NUMBER_DOUBLE_BUF_SIZE];
+    number_format_double(out, val);
+    int shortest = 1;
+    char expected[NUMBER_DOUBLE_BUF_SIZE];
+    while (true) {
+      snprintf(expected, sizeof(expected), "%.*g", shortest, val);
+      if (strtod(expected, NULL) == val) {
+        break;
+      }
+      shortest++;
+    }
+    assert(count_significant(out) == count_significant(expected));
+  }
+}
+
+static void test_number_parse_int(void) {
+  int64_t val;
+  assert(parse_int_str(&val, "0") && val == 0);
+  assert(parse_int_str(&val, "+15") && val == 15);
+  assert(parse_int_str(&val, "-15") && val == -15);
+  assert(parse_int_str(&val, "0000000000000000000000042") && val == 42);
+  assert(parse_int_str(&val, "9223372036854775807") && val == INT64_MAX);
+  assert(parse_int_str(&val, "-9223372036854775808") && val == INT64_MIN);
+
+  assert(!parse_int_str(&val, ""));
+  assert(!parse_int_str(&val, "-"));
+  assert(!parse_int_str(&val, "1a"));
+  assert(!parse_int_str(&val, "1.0"));
+  assert(!parse_int_str(&val, " 1"));
+  assert(!parse_int_str(&val, "9223372036854775808"));
+  assert(!parse_int_str(&val, "-9223372036854775809"));
+  assert(!parse_int_str(&val, "100000000000000000000"));
+}
+
+static void test_number_parse_double(void) {
+  double val;
+  assert(parse_double_str(&val, "0") && val == 0);
+  assert(parse_double_str(&val, "-0") && val == 0 && signbit(val));
+  assert(parse_double_str(&val, "1.5") && val == 1.5);
+  assert(parse_double_str(&val, "+1.5") && val == 1.5);
+  assert(parse_double_str(&val, "-.5") && val == -0.5);
+  assert(parse_double_str(&val, "2.") && val == 2);
+  assert(parse_double_str(&val, "0.1") && val == 0.1);
+  assert(parse_double_str(&val, "1e3") && val == 1000);
+  assert(parse_double_str(&val, "1.25E-2") && val == 0.0125);
+  assert(parse_double_str(&val, "0.000001") && val == 1e-6);
+  assert(parse_double_str(&val, "inf") && val == INFINITY);
+  assert(parse_double_str(&val, "+inf") && val == INFINITY);
+  assert(parse_double_str(&val, "-inf") && val == -INFINITY);
+  assert(parse_double_str(&val, "nan") && isnan(val));
+  // Outside of the exact range
+  assert(parse_double_str(&val, "1e23") && val == 1e23);
+  assert(parse_double_str(&val, "1.7976931348623157e308") && val == DBL_MAX);
+  assert(parse_double_str(&val, "1e400") && val == INFINITY);
+  assert(parse_double_str(&val, "4.9406564584124654e-324") && val > 0);
+  assert(parse_double_str(&val, "1e-400") && val == 0);
+  assert(
+      parse_double_str(&val, "0.30000000000000004440892098500626") &&
+      val == 0.1 + 0.2);
+  // More digits than fit in 64 bits
+  assert(
+      parse_double_str(&val, "123456789012345678901234") &&
+      val == 1.2345678901234568e23);
+
+  assert(!parse_double_str(&val, ""));
+  assert(!parse_double_str(&val, "-"));
+  assert(!parse_double_str(&val, "."));
+  assert(!parse_double_str(&val, "1.2.3"));
+  assert(!parse_double_str(&val, "1e"));
+  assert(!parse_double_str(&val, "1e+"));
+  assert(!parse_double_str(&val, "e5"));
+  assert(!parse_double_str(&val, "0x10"));
+  assert(!parse_double_str(&val, "infinity"));
+  assert(!parse_double_str(&val, "-nan"));
+  assert(!parse_double_str(&val, " 1"));
+}
+
+static void test_number_parse_double_matches_strtod(void) {
+  srand(3);
+  char str[64];
+  for (int i = 0; i < 100000; i++) {
+    // Digits spread around the decimal point, some with exponents
+    int len = 0;
+    int digits = 1 + rand() % 25;
+    int point = rand() % (digits + 1);
+    for (int j = 0; j < digits; j++) {
+      if (j == point) {
+        str[len++] = '.';
+      }
+      str[len++] = (char)('0' + rand() % 10);
+    }
+    if (rand() % 2 == 0) {
+      len += snprintf(str + len, sizeof(str) - len, "e%d", rand() % 80 - 40);
+    }
+    str[len] = '\0';
+
+    double val;
+    assert(parse_double_str(&val, str));
+    assert(val == strtod(str, NULL));
+  }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+void test_number(void) {
+  RUN_TEST(test_number_format_int);
+  RUN_TEST(test_number_format_int_matches_printf);
+  RUN_TEST(test_number_format_double);
+  RUN_TEST(test_number_format_double_round_trips);
+  RUN_TEST(test_number_format_double_is_shortest);
+  RUN_TEST(test_number_parse_int);
+  RUN_TEST(test_number_parse_double);
+  RUN_TEST(test_number_parse_double_matches_strtod);
+}
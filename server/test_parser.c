@@ -134,6 +134,136 @@ static void test_parse_blob_str_no_crlf_after_content(void) {
   assert(n_parsed == PARSE_ERR);
 }
 
+// Header and end separately
+
+static void test_parse_blob_str_header_without_content(void) {
+  struct const_slice input = make_input_slice("$1200000\r\nabc");
+  uint64_t size;
+  ssize_t n_parsed = parse_blob_str_header(&size, input);
+  assert(n_parsed == 10);
+  assert(size == 1200000);
+}
+
+static void test_parse_blob_str_end(void) {
+  assert(parse_blob_str_end(make_input_slice("\r\n$3")) == 2);
+  assert(parse_blob_str_end(make_input_slice("\r")) == PARSE_MORE);
+  assert(parse_blob_str_end(make_input_slice("a\r\n")) == PARSE_ERR);
+}
+
+// Sizes followed by enough data are found with a single compare, others are
+// parsed byte by byte
+static void test_parse_blob_str_header_with_and_without_data(void) {
+  static const char input[] = "$12345\r\nabcdefghijklmnop";
+  uint64_t size;
+  for (size_t len = 0; len < sizeof(input) - 1; len++) {
+    ssize_t n_parsed =
+        parse_blob_str_header(&size, make_const_slice(input, len));
+    if (len < 8) {
+      assert(n_parsed == PARSE_MORE);
+    } else {
+      assert(n_parsed == 8);
+      assert(size == 12345);
+    }
+  }
+
+  assert(
+      parse_blob_str_header(&size, make_input_slice("$12a45\r\nabcdefghijk")) ==
+      PARSE_ERR);
+  assert(
+      parse_blob_str_header(&size, make_input_slice("$12345\r\rabcdefghijk")) ==
+      PARSE_ERR);
+}
+
+static void test_parse_blob_str_header_too_many_digits(void) {
+  uint64_t size;
+  assert(
+      parse_blob_str_header(
+          &size, make_input_slice("$1234567890123456789\r\n")) == 22);
+  assert(size == 1234567890123456789);
+  assert(
+      parse_blob_str_header(
+          &size, make_input_slice("$12345678901234567890\r\n")) == PARSE_ERR);
+  // Even before the end is received
+  assert(
+      parse_blob_str_header(&size, make_input_slice("$12345678901234567890")) ==
+      PARSE_ERR);
+}
+
+static void test_parse_reply_array_header(void) {
+  uint32_t size;
+  assert(
+      parse_reply_array_header(
+          PROTO_RESP3, &size, make_input_slice("*3\r\n")) == 4);
+  assert(size == 3);
+  assert(
+      parse_reply_array_header(
+          PROTO_RESP3, &size, make_input_slice("*?\r\n$1\r\na\r\n.\r\n")) == 4);
+  assert(size == PROTO_SIZE_STREAMED);
+  assert(
+      parse_reply_array_header(
+          PROTO_RESP3, &size, make_input_slice("-error\r\n")) == PARSE_ERR);
+
+  assert(
+      parse_reply_array_header(
+          PROTO_BINARY, &size, make_input_slice("*\2\0\0\0")) == 5);
+  assert(size == 2);
+  assert(
+      parse_reply_array_header(
+          PROTO_BINARY, &size, make_input_slice("*\377\377\377\377.")) == 5);
+  assert(size == PROTO_SIZE_STREAMED);
+  assert(
+      parse_reply_array_header(
+          PROTO_BINARY, &size, make_input_slice("-\2\0\0\0no")) == PARSE_ERR);
+
+  assert(parse_reply_stream_end(PROTO_RESP3, make_input_slice(".\r\n")) == 3);
+  assert(parse_reply_stream_end(PROTO_RESP3, make_input_slice(".\n")) < 0);
+  assert(parse_reply_stream_end(PROTO_BINARY, make_input_slice(".")) == 1);
+  assert(reply_stream_end_size(PROTO_RESP3) == 3);
+  assert(reply_stream_end_size(PROTO_BINARY) == 1);
+}
+
+static void test_parse_bin_req(void) {
+  struct const_slice input = make_input_slice("\6\0\0\0\1\1\0\0\0k");
+  proto_size_t frame_size;
+  uint8_t req_type;
+  assert(parse_bin_req_header(&frame_size, &req_type, input) == 5);
+  assert(frame_size == 6);
+  assert(req_type == REQ_SET);
+  const_slice_advance(&input, 5);
+
+  struct const_slice str;
+  assert(parse_bin_str(&str, input) == 5);
+  assert_slice_eq(str, make_input_slice("k"));
+
+  assert(
+      parse_bin_req_header(
+          &frame_size, &req_type, make_input_slice("\6\0\0\0")) ==
+      PARSE_MORE);
+  assert(
+      parse_bin_req_header(
+          &frame_size, &req_type, make_input_slice("\0\0\0\0\1")) ==
+      PARSE_ERR);
+  assert(parse_bin_str(&str, make_input_slice("\3\0\0\0ab")) == PARSE_MORE);
+  assert(parse_bin_str(&str, make_input_slice("\3\0")) == PARSE_MORE);
+}
+
+static void test_parse_bin_numeric_args(void) {
+  int_val_t int_val;
+  double float_val;
+  assert(parse_int_arg(
+      &int_val, PROTO_BINARY,
+      make_input_slice("\376\377\377\377\377\377\377\377")));
+  assert(int_val == -2);
+  assert(!parse_int_arg(&int_val, PROTO_BINARY, make_input_slice("-2")));
+  assert(parse_int_arg(&int_val, PROTO_RESP3, make_input_slice("-2")));
+  assert(int_val == -2);
+
+  assert(parse_float_arg(
+      &float_val, PROTO_BINARY, make_input_slice("\0\0\0\0\0\0\370\077")));
+  assert(float_val == 1.5);
+  assert(!parse_float_arg(&float_val, PROTO_BINARY, make_input_slice("1.5")));
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 void test_parser(void) {
@@ -150,4 +280,11 @@ void test_parser(void) {
   RUN_TEST(test_parse_blob_str_invalid_number);
   RUN_TEST(test_parse_blob_str_invalid_crlf);
   RUN_TEST(test_parse_blob_str_no_crlf_after_content);
+  RUN_TEST(test_parse_blob_str_header_without_content);
+  RUN_TEST(test_parse_blob_str_end);
+  RUN_TEST(test_parse_blob_str_header_with_and_without_data);
+  RUN_TEST(test_parse_blob_str_header_too_many_digits);
+  RUN_TEST(test_parse_reply_array_header);
+  RUN_TEST(test_parse_bin_req);
+  RUN_TEST(test_parse_bin_numeric_args);
 }
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "buffer.h"
+#include "protocol.h"
+#include "reply.h"
+#include "test.h"
+#include "types.h"
+
+#define resp_out(buf) make_reply_out((buf), PROTO_RESP3)
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+enum {
+  TEST_IOV_MAX = 4,
+};
+
+static string make_filled_string(size_t size, uint8_t fill) {
+  string str = string_create(size);
+  memset(string_data(&str), fill, size);
+  return str;
+}
+
+/** Send everything in chunks of at most `chunk_size` into `out` */
+static void drain_reply(
+    struct offset_buf *buf, struct reply_refs *refs, size_t chunk_size,
+    struct buffer *out) {
+  while (reply_remaining(buf, refs) > 0) {
+    struct iovec iov[TEST_IOV_MAX];
+    int iov_count = reply_fill_iov(buf, refs, iov, TEST_IOV_MAX);
+    assert(iov_count > 0);
+
+    size_t sent = 0;
+    for (int i = 0; i < iov_count && sent < chunk_size; i++) {
+      size_t size = iov[i].iov_len;
+      if (size > chunk_size - sent) {
+        size = chunk_size - sent;
+      }
+      buffer_append(out, iov[i].iov_base, size);
+      sent += size;
+    }
+    reply_advance(buf, refs, sent);
+  }
+}
+
+static void test_reply_small_string_copied(void) {
+  struct buffer buf;
+  buffer_init(&buf, 16);
+  struct reply_refs refs;
+  reply_refs_init(&refs);
+
+  string str = make_filled_string(100, 'a');
+  assert(!reply_refs_push(&refs, &buf, &str));
+  assert(reply_refs_empty(&refs));
+
+  string_destroy(&str);
+  reply_refs_destroy(&refs);
+  buffer_destroy(&buf);
+}
+
+static void test_reply_refs_keep_data_alive(void) {
+  struct offset_buf buf;
+  offset_buf_init(&buf, 16);
+  struct reply_refs refs;
+  reply_refs_init(&refs);
+
+  string str = make_filled_string(SHARED_STRING_MIN_SIZE, 'a');
+  write_stored_str_value(resp_out(&buf.buf), &refs, &str);
+  // Replaced while the reply is still pending
+  string_destroy(&str);
+
+  size_t reply_size = buf.buf.size + SHARED_STRING_MIN_SIZE;
+  assert(reply_remaining(&buf, &refs) == reply_size);
+
+  struct buffer out;
+  buffer_init(&out, 16);
+  drain_reply(&buf, &refs, SIZE_MAX, &out);
+  assert(out.size == reply_size);
+  assert(const_slice_get(buffer_const_slice(&out), out.size - 3) == 'a');
+
+  buffer_destroy(&out);
+  reply_refs_destroy(&refs);
+  offset_buf_destroy(&buf);
+}
+
+static void test_reply_partial_sends_in_order(void) {
+  struct offset_buf buf;
+  offset_buf_init(&buf, 16);
+  struct reply_refs refs;
+  reply_refs_init(&refs);
+
+  string first = make_filled_string(SHARED_STRING_MIN_SIZE, 'a');
+  string second = make_filled_string(SHARED_STRING_MIN_SIZE + 1, 'b');
+
+  // Expected output, all copied
+  struct buffer expected;
+  buffer_init(&expected, 16);
+  write_int_value(resp_out(&expected), 1);
+  write_str_value(resp_out(&expected), string_const_slice(&first));
+  write_str_value(resp_out(&expected), string_const_slice(&second));
+  write_int_value(resp_out(&expected), 2);
+
+  write_int_value(resp_out(&buf.buf), 1);
+  write_stored_str_value(resp_out(&buf.buf), &refs, &first);
+  write_stored_str_value(resp_out(&buf.buf), &refs, &second);
+  write_int_value(resp_out(&buf.buf), 2);
+  string_destroy(&first);
+  string_destroy(&second);
+  assert(refs.count == 2);
+
+  struct buffer out;
+  buffer_init(&out, 16);
+  drain_reply(&buf, &refs, 1000, &out);
+  assert(out.size == expected.size);
+  assert(memcmp(out.data, expected.data, out.size) == 0);
+
+  // Reset for the next reply
+  assert(buf.start == 0 && buf.buf.size == 0);
+  assert(reply_refs_empty(&refs));
+
+  buffer_destroy(&out);
+  buffer_destroy(&expected);
+  reply_refs_destroy(&refs);
+  offset_buf_destroy(&buf);
+}
+
+static void test_reply_refs_move(void) {
+  struct offset_buf buf;
+  offset_buf_init(&buf, 16);
+  struct reply_refs refs;
+  reply_refs_init(&refs);
+
+  struct buffer other_buf;
+  buffer_init(&other_buf, 16);
+  struct reply_refs other_refs;
+  reply_refs_init(&other_refs);
+
+  string str = make_filled_string(SHARED_STRING_MIN_SIZE, 'a');
+  write_stored_str_value(resp_out(&other_buf), &other_refs, &str);
+  string_destroy(&str);
+
+  uint32_t ref_offset = other_refs.refs[0].offset;
+
+  write_int_value(resp_out(&buf.buf), 1);
+  uint32_t base_offset = buf.buf.size;
+  buffer_append_slice(&buf.buf, buffer_const_slice(&other_buf));
+  reply_refs_move(&refs, base_offset, &other_refs);
+  assert(reply_refs_empty(&other_refs));
+  assert(refs.count == 1);
+  assert(refs.refs[0].offset == base_offset + ref_offset);
+
+  size_t reply_size = buf.buf.size + SHARED_STRING_MIN_SIZE;
+  struct buffer out;
+  buffer_init(&out, 16);
+  drain_reply(&buf, &refs, SIZE_MAX, &out);
+  assert(out.size == reply_size);
+
+  buffer_destroy(&out);
+  reply_refs_destroy(&other_refs);
+  buffer_destroy(&other_buf);
+  reply_refs_destroy(&refs);
+  offset_buf_destroy(&buf);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+void test_reply(void) {
+  RUN_TEST(test_reply_small_string_copied);
+  RUN_TEST(test_reply_refs_keep_data_alive);
+  RUN_TEST(test_reply_partial_sends_in_order);
+  RUN_TEST(test_reply_refs_move);
+}
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "timer_wheel.h"
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+enum {
+  START_US = 123456000,
+};
+
+static void test_timer_wheel_empty(void) {
+  struct timer_wheel wheel;
+  timer_wheel_init(&wheel, START_US);
+  assert(timer_wheel_empty(&wheel));
+  assert(timer_wheel_next_expiry(&wheel) == -1);
+  assert(timer_wheel_pop_expired(&wheel, START_US * 2) == NULL);
+}
+
+static void test_timer_wheel_expires_on_time(void) {
+  struct timer_wheel wheel;
+  timer_wheel_init(&wheel, START_US);
+
+  // On different levels, and in the overflow list
+  uint64_t delays_us[] = {
+      0, 1, 999, 1000, 65 * 1000, 5 * 1000000, 3600ULL * 1000000,
+      // More than the highest level covers
+      (1ULL << 40) * 1000,
+  };
+  size_t count = sizeof(delays_us) / sizeof(delays_us[0]);
+  struct timer timers[count];
+  for (size_t i = 0; i < count; i++) {
+    timer_init(&timers[i]);
+    timer_wheel_arm(&wheel, &timers[i], START_US + delays_us[i]);
+    assert(timer_armed(&timers[i]));
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    // Expires at the start of the next tick
+    uint64_t expires_us = START_US + delays_us[i];
+    uint64_t due_us = (expires_us + TIMER_WHEEL_TICK_US - 1) /
+                      TIMER_WHEEL_TICK_US * TIMER_WHEEL_TICK_US;
+    // Wake-ups may come early but never late
+    int64_t next_us = timer_wheel_next_expiry(&wheel);
+    assert(next_us >= 0 && (uint64_t)next_us <= due_us);
+
+    if (due_us > START_US) {
+      assert(timer_wheel_pop_expired(&wheel, due_us - 1) == NULL);
+    }
+    assert(timer_wheel_pop_expired(&wheel, due_us) == &timers[i]);
+    assert(!timer_armed(&timers[i]));
+  }
+
+  assert(timer_wheel_empty(&wheel));
+  assert(timer_wheel_next_expiry(&wheel) == -1);
+}
+
+static void test_timer_wheel_cancel_and_rearm(void) {
+  struct timer_wheel wheel;
+  timer_wheel_init(&wheel, START_US);
+
+  struct timer first;
+  struct timer second;
+  timer_init(&first);
+  timer_init(&second);
+  // Cancelling an unarmed timer does nothing
+  timer_wheel_cancel(&wheel, &first);
+
+  timer_wheel_arm(&wheel, &first, START_US + 10000);
+  timer_wheel_arm(&wheel, &second, START_US + 20000);
+  timer_wheel_cancel(&wheel, &first);
+  assert(!timer_armed(&first));
+
+  // Re-arming moves the timer
+  timer_wheel_arm(&wheel, &second, START_US + 5000000);
+  assert(timer_wheel_pop_expired(&wheel, START_US + 4999999) == NULL);
+  assert(timer_wheel_pop_expired(&wheel, START_US + 5000000) == &second);
+  assert(timer_wheel_empty(&wheel));
+}
+
+static void test_timer_wheel_random(void) {
+  enum { TIMER_COUNT = 1000, STEPS = 2000 };
+
+  struct timer_wheel wheel;
+  timer_wheel_init(&wheel, START_US);
+  struct timer *timers = malloc(sizeof(*timers) * TIMER_COUNT);
+  assert(timers != NULL);
+  for (size_t i = 0; i < TIMER_COUNT; i++) {
+    timer_init(&timers[i]);
+  }
+
+  srand(1234);
+  uint64_t now_us = START_US;
+  for (size_t step = 0; step < STEPS; step++) {
+    for (size_t i = 0; i < 10; i++) {
+      struct timer *timer = &timers[rand() % TIMER_COUNT];
+      if (rand() % 4 == 0) {
+        timer_wheel_cancel(&wheel, timer);
+      } else {
+        uint64_t delay_us = (uint64_t)rand() % (1U << (rand() % 31));
+        timer_wheel_arm(&wheel, timer, now_us + delay_us);
+      }
+    }
+
+    uint64_t min_expires_us = UINT64_MAX;
+    for (size_t i = 0; i < TIMER_COUNT; i++) {
+      if (timer_armed(&timers[i]) && timers[i].expires_us < min_expires_us) {
+        min_expires_us = timers[i].expires_us;
+      }
+    }
+    int64_t next_us = timer_wheel_next_expiry(&wheel);
+    assert(next_us >= 0 && (uint64_t)next_us <= min_expires_us + 999);
+
+    now_us += (uint64_t)rand() % (1U << (rand() % 24));
+    struct timer *expired;
+    while ((expired = timer_wheel_pop_expired(&wheel, now_us)) != NULL) {
+      assert(expired->expires_us <= now_us);
+    }
+    for (size_t i = 0; i < TIMER_COUNT; i++) {
+      // Everything is expired within a tick
+      assert(!timer_armed(&timers[i]) || timers[i].expires_us + 999 > now_us);
+    }
+  }
+
+  free(timers);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+void test_timer_wheel(void) {
+  RUN_TEST(test_timer_wheel_empty);
+  RUN_TEST(test_timer_wheel_expires_on_time);
+  RUN_TEST(test_timer_wheel_cancel_and_rearm);
+  RUN_TEST(test_timer_wheel_random);
+}
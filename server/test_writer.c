@@ -1,4 +1,7 @@
 #include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -7,6 +10,8 @@
 #include "test.h"
 #include "types.h"
 
+#define resp_out(buf) make_reply_out((buf), PROTO_RESP3)
+
 #define make_output_slice(output_str) \
   make_const_slice((output_str), sizeof(output_str) - 1)
 
@@ -24,7 +29,7 @@ static void test_write_null_value(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_null_value(&buffer);
+  write_null_value(resp_out(&buffer));
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -36,7 +41,7 @@ static void test_write_int_value(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_int_value(&buffer, 1200451);
+  write_int_value(resp_out(&buffer), 1200451);
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -48,7 +53,34 @@ static void test_write_int_value_negative(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_int_value(&buffer, -287634);
+  write_int_value(resp_out(&buffer), -287634);
+
+  assert_slice_eq(buffer_const_slice(&buffer), expected);
+  buffer_destroy(&buffer);
+}
+
+static void test_write_int_value_fills_remaining_space(void) {
+  struct const_slice expected = make_output_slice(":7\r\n");
+
+  struct buffer buffer;
+  // Exactly enough space for the digit, but not the null terminator
+  buffer_init(&buffer, 2);
+
+  write_int_value(resp_out(&buffer), 7);
+
+  assert_slice_eq(buffer_const_slice(&buffer), expected);
+  buffer_destroy(&buffer);
+}
+
+static void test_write_float_value(void) {
+  struct const_slice expected = make_output_slice(",1.5\r\n,-3\r\n,inf\r\n");
+
+  struct buffer buffer;
+  buffer_init(&buffer, 2);
+
+  write_float_value(resp_out(&buffer), 1.5);
+  write_float_value(resp_out(&buffer), -3);
+  write_float_value(resp_out(&buffer), INFINITY);
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -60,7 +92,7 @@ static void test_write_simple_str_value(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_simple_str_value(&buffer, "OK");
+  write_simple_str_value(resp_out(&buffer), "OK");
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -72,7 +104,7 @@ static void test_write_str_value_empty(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_str_value(&buffer, make_const_slice(NULL, 0));
+  write_str_value(resp_out(&buffer), make_const_slice(NULL, 0));
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -84,7 +116,7 @@ static void test_write_str_value_non_empty(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_str_value(&buffer, make_str_slice("Hello, World!"));
+  write_str_value(resp_out(&buffer), make_str_slice("Hello, World!"));
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -96,7 +128,7 @@ static void test_write_simple_err_value(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_simple_err_value(&buffer, "NOT FOUND");
+  write_simple_err_value(resp_out(&buffer), "NOT FOUND");
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
@@ -112,24 +144,147 @@ static void test_write_arr_value_mixed(void) {
   struct buffer buffer;
   buffer_init(&buffer, expected.size);
 
-  write_array_header(&buffer, 3);
-  write_int_value(&buffer, -123);
-  write_str_value(&buffer, make_str_slice("AbCd"));
-  write_null_value(&buffer);
+  write_array_header(resp_out(&buffer), 3);
+  write_int_value(resp_out(&buffer), -123);
+  write_str_value(resp_out(&buffer), make_str_slice("AbCd"));
+  write_null_value(resp_out(&buffer));
 
   assert_slice_eq(buffer_const_slice(&buffer), expected);
   buffer_destroy(&buffer);
 }
 
+static void test_write_arr_stream(void) {
+  struct const_slice expected = make_output_slice(
+      "*?\r\n"
+      "$1\r\na\r\n"
+      ",2.5\r\n"
+      ".\r\n");
+
+  struct buffer buffer;
+  buffer_init(&buffer, 1);
+
+  write_array_stream_start(resp_out(&buffer));
+  write_str_value(resp_out(&buffer), make_str_slice("a"));
+  write_float_value(resp_out(&buffer), 2.5);
+  write_stream_end(resp_out(&buffer));
+
+  assert_slice_eq(buffer_const_slice(&buffer), expected);
+  buffer_destroy(&buffer);
+}
+
+static void test_write_bin_values(void) {
+  struct const_slice expected = make_output_slice(
+      "*\3\0\0\0"
+      ":\376\377\377\377\377\377\377\377"
+      "$\2\0\0\0ab"
+      "_"
+      "#\1"
+      ",\0\0\0\0\0\0\370\077"
+      "-\2\0\0\0no"
+      "*\377\377\377\377"
+      "+\2\0\0\0OK"
+      ".");
+
+  struct buffer buffer;
+  buffer_init(&buffer, 1);
+  struct reply_out out = make_reply_out(&buffer, PROTO_BINARY);
+
+  write_array_header(out, 3);
+  write_int_value(out, -2);
+  write_str_value(out, make_str_slice("ab"));
+  write_null_value(out);
+  write_bool_value(out, true);
+  write_float_value(out, 1.5);
+  write_simple_err_value(out, "no");
+  write_array_stream_start(out);
+  write_simple_str_value(out, "OK");
+  write_stream_end(out);
+
+  assert_slice_eq(buffer_const_slice(&buffer), expected);
+  buffer_destroy(&buffer);
+}
+
+static void test_write_shared_reply(void) {
+  const struct {
+    enum shared_reply reply;
+    bool error;
+    const char *str;
+  } cases[] = {
+      {SHARED_OK, false, "OK"},
+      {SHARED_ERR_COMMAND, true, "invalid command"},
+      {SHARED_ERR_ARGS, true, "not enough arguments"},
+      {SHARED_ERR_NOT_STR, true, "not string value"},
+      {SHARED_ERR_NOT_HMAP, true, "object not a hash map"},
+      {SHARED_ERR_NOT_HSET, true, "object not a set"},
+      {SHARED_ERR_NOT_ZSET, true, "object not a sorted set"},
+      {SHARED_ERR_PROTO, true, "unsupported protocol version"},
+      {SHARED_ERR_TTL, true, "invalid ttl"},
+      {SHARED_ERR_SCORE, true, "invalid score"},
+      {SHARED_ERR_OFFSET, true, "invalid offset"},
+      {SHARED_ERR_LIMIT, true, "invalid limit"},
+  };
+  static_assert(
+      sizeof(cases) / sizeof(cases[0]) == SHARED_REPLY_COUNT,
+      "missing shared replies");
+
+  struct buffer shared;
+  struct buffer expected;
+  buffer_init(&shared, 1);
+  buffer_init(&expected, 1);
+  const enum proto_version protos[] = {PROTO_RESP2, PROTO_BINARY};
+  for (size_t i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+    for (size_t j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+      write_shared_reply(make_reply_out(&shared, protos[i]), cases[j].reply);
+      struct reply_out out = make_reply_out(&expected, protos[i]);
+      if (cases[j].error) {
+        write_simple_err_value(out, cases[j].str);
+      } else {
+        write_simple_str_value(out, cases[j].str);
+      }
+    }
+  }
+
+  assert_slice_eq(buffer_const_slice(&shared), buffer_const_slice(&expected));
+  buffer_destroy(&shared);
+  buffer_destroy(&expected);
+}
+
+static void test_write_small_numbers(void) {
+  char expected[32];
+  struct buffer buffer;
+  for (uint32_t i = 0; i < SHARED_UINT_COUNT + 500; i++) {
+    // Without any spare room, to check the fixed size copies
+    buffer_init(&buffer, 1);
+    write_int_value(resp_out(&buffer), i);
+    int len = snprintf(expected, sizeof(expected), ":%u\r\n", i);
+    assert_slice_eq(
+        buffer_const_slice(&buffer), make_const_slice(expected, len));
+    buffer_destroy(&buffer);
+
+    buffer_init(&buffer, 1);
+    write_array_header(resp_out(&buffer), i);
+    len = snprintf(expected, sizeof(expected), "*%u\r\n", i);
+    assert_slice_eq(
+        buffer_const_slice(&buffer), make_const_slice(expected, len));
+    buffer_destroy(&buffer);
+  }
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 void test_writer(void) {
   RUN_TEST(test_write_null_value);
   RUN_TEST(test_write_int_value);
   RUN_TEST(test_write_int_value_negative);
+  RUN_TEST(test_write_int_value_fills_remaining_space);
+  RUN_TEST(test_write_float_value);
   RUN_TEST(test_write_simple_str_value);
   RUN_TEST(test_write_str_value_empty);
   RUN_TEST(test_write_str_value_non_empty);
   RUN_TEST(test_write_simple_err_value);
   RUN_TEST(test_write_arr_value_mixed);
+  RUN_TEST(test_write_arr_stream);
+  RUN_TEST(test_write_bin_values);
+  RUN_TEST(test_write_shared_reply);
+  RUN_TEST(test_write_small_numbers);
 }
@@ -0,0 +1,189 @@
+#include "timer_wheel.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "types.h"
+
+enum {
+  SLOT_MASK = TIMER_WHEEL_SLOTS - 1,
+  // Ticks which differ in higher bits than these are in the overflow list
+  WHEEL_BITS = TIMER_WHEEL_LEVELS * TIMER_WHEEL_LEVEL_BITS,
+};
+
+static unsigned highest_bit(uint64_t val) {
+  assert(val != 0);
+  return (unsigned)(sizeof(val) * CHAR_BIT - 1) - __builtin_clzll(val);
+}
+
+void timer_init(struct timer *timer) {
+  timer->node.prev = timer->node.next = NULL;
+  timer->expires_us = 0;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_us) {
+  wheel->now = now_us / TIMER_WHEEL_TICK_US;
+  wheel->count = 0;
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    wheel->occupied[level] = 0;
+    for (unsigned slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      dlist_init(&wheel->slots[level][slot]);
+    }
+  }
+  dlist_init(&wheel->overflow);
+}
+
+static uint64_t timer_tick(const struct timer *timer) {
+  // Rounded up so that timers never expire early
+  uint64_t tick = timer->expires_us / TIMER_WHEEL_TICK_US;
+  return timer->expires_us % TIMER_WHEEL_TICK_US == 0 ? tick : tick + 1;
+}
+
+/** Link the timer into the slot for its tick relative to the current tick */
+static void wheel_place(struct timer_wheel *wheel, struct timer *timer) {
+  uint64_t tick = timer_tick(timer);
+  if (tick < wheel->now) {
+    // Already expired
+    tick = wheel->now;
+  }
+
+  uint64_t diff = tick ^ wheel->now;
+  if ((diff >> WHEEL_BITS) != 0) {
+    dlist_push_back(&wheel->overflow, &timer->node);
+    return;
+  }
+
+  // The lowest level on which only the timer's own slot differs from the
+  // current tick
+  unsigned level = diff == 0 ? 0 : highest_bit(diff) / TIMER_WHEEL_LEVEL_BITS;
+  unsigned slot = (tick >> (level * TIMER_WHEEL_LEVEL_BITS)) & SLOT_MASK;
+  dlist_push_back(&wheel->slots[level][slot], &timer->node);
+  wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+void timer_wheel_arm(
+    struct timer_wheel *wheel, struct timer *timer, uint64_t expires_us) {
+  timer_wheel_cancel(wheel, timer);
+  timer->expires_us = expires_us;
+  wheel_place(wheel, timer);
+  wheel->count++;
+}
+
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer *timer) {
+  if (!timer_armed(timer)) {
+    return;
+  }
+
+  // The slot's occupied bit is cleared when it's next looked at
+  dlist_unlink(&timer->node);
+  timer->node.prev = timer->node.next = NULL;
+  wheel->count--;
+}
+
+/** Re-distribute the timers in `slot` relative to the current tick */
+static void wheel_cascade(struct timer_wheel *wheel, struct dlist *slot) {
+  struct dlist timers;
+  dlist_init(&timers);
+  dlist_move_all(&timers, slot);
+
+  struct dlist_node *node;
+  while ((node = dlist_pop_front(&timers)) != NULL) {
+    wheel_place(wheel, container_of(node, struct timer, node));
+  }
+}
+
+/**
+ * Next tick after the current one at which a slot with timers becomes current,
+ * or `UINT64_MAX` if there is none.
+ */
+static uint64_t wheel_next_tick(struct timer_wheel *wheel) {
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    unsigned shift = level * TIMER_WHEEL_LEVEL_BITS;
+    unsigned current = (wheel->now >> shift) & SLOT_MASK;
+    // Timers are only ever placed in slots after the current one
+    uint64_t later = 0;
+    if (current < SLOT_MASK) {
+      later = wheel->occupied[level] & (~(uint64_t)0 << (current + 1));
+    }
+
+    while (later != 0) {
+      unsigned slot = __builtin_ctzll(later);
+      if (!dlist_empty(&wheel->slots[level][slot])) {
+        unsigned block_shift = shift + TIMER_WHEEL_LEVEL_BITS;
+        uint64_t block_start = wheel->now >> block_shift << block_shift;
+        return block_start + ((uint64_t)slot << shift);
+      }
+
+      // All of its timers were cancelled
+      wheel->occupied[level] &= ~((uint64_t)1 << slot);
+      later &= later - 1;
+    }
+  }
+
+  if (!dlist_empty(&wheel->overflow)) {
+    return ((wheel->now >> WHEEL_BITS) + 1) << WHEEL_BITS;
+  }
+  return UINT64_MAX;
+}
+
+/** Move to a later tick, which must not skip over any slots with timers */
+static void wheel_advance(struct timer_wheel *wheel, uint64_t tick) {
+  uint64_t prev = wheel->now;
+  wheel->now = tick;
+
+  if ((prev >> WHEEL_BITS) != (tick >> WHEEL_BITS)) {
+    wheel_cascade(wheel, &wheel->overflow);
+  }
+
+  for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+    unsigned shift = level * TIMER_WHEEL_LEVEL_BITS;
+    if ((prev >> shift) == (tick >> shift)) {
+      continue;
+    }
+
+    unsigned slot = (tick >> shift) & SLOT_MASK;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    wheel_cascade(wheel, &wheel->slots[level][slot]);
+  }
+}
+
+struct timer *timer_wheel_pop_expired(
+    struct timer_wheel *wheel, uint64_t now_us) {
+  uint64_t target = now_us / TIMER_WHEEL_TICK_US;
+  while (wheel->now <= target) {
+    unsigned slot = wheel->now & SLOT_MASK;
+    struct dlist_node *node = dlist_pop_front(&wheel->slots[0][slot]);
+    if (node != NULL) {
+      struct timer *timer = container_of(node, struct timer, node);
+      timer->node.prev = timer->node.next = NULL;
+      wheel->count--;
+      return timer;
+    }
+
+    wheel->occupied[0] &= ~((uint64_t)1 << slot);
+    if (wheel->now == target) {
+      break;
+    }
+
+    uint64_t next = wheel_next_tick(wheel);
+    wheel_advance(wheel, next < target ? next : target);
+  }
+
+  return NULL;
+}
+
+int64_t timer_wheel_next_expiry(struct timer_wheel *wheel) {
+  if (timer_wheel_empty(wheel)) {
+    return -1;
+  }
+
+  uint64_t tick = wheel->now;
+  if (dlist_empty(&wheel->slots[0][tick & SLOT_MASK])) {
+    tick = wheel_next_tick(wheel);
+  }
+  assert(tick != UINT64_MAX);
+  return (int64_t)(tick * TIMER_WHEEL_TICK_US);
+}
@@ -0,0 +1,72 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+
+enum {
+  TIMER_WHEEL_TICK_US = 1000,
+  TIMER_WHEEL_LEVEL_BITS = 6,
+  TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_LEVEL_BITS,
+  // Covers about 2 years of ticks, later timers are kept in a separate list
+  TIMER_WHEEL_LEVELS = 6,
+};
+
+/** Intrusive timer, which is armed while it's linked into a wheel */
+struct timer {
+  struct dlist_node node;
+  uint64_t expires_us;
+};
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Each level has slots for ticks which only differ from the current tick on
+ * that level, so arming and cancelling is O(1). Timers on higher levels are
+ * re-distributed to lower levels once their slot becomes current.
+ */
+struct timer_wheel {
+  // Current tick, timers in its slot on the lowest level are due
+  uint64_t now;
+  uint32_t count;
+  // Slots which may have timers, bits are only cleared lazily
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  struct dlist slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  // Timers too far in the future for the highest level
+  struct dlist overflow;
+};
+
+void timer_init(struct timer *timer);
+
+static inline bool timer_armed(const struct timer *timer) {
+  return timer->node.next != NULL;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_us);
+
+static inline bool timer_wheel_empty(const struct timer_wheel *wheel) {
+  return wheel->count == 0;
+}
+
+/** Arm the timer to expire at `expires_us`, re-arming it if it's armed */
+void timer_wheel_arm(
+    struct timer_wheel *wheel, struct timer *timer, uint64_t expires_us);
+/** Does nothing if the timer isn't armed */
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer *timer);
+
+/** Detach the next timer which expired at `now_us`, or NULL if there is none */
+struct timer *timer_wheel_pop_expired(
+    struct timer_wheel *wheel, uint64_t now_us);
+
+/**
+ * Time at which the wheel needs to be advanced next, or -1 if there are no
+ * timers.
+ *
+ * This may be before any timer actually expires, since timers on higher
+ * levels only get re-distributed at that point.
+ */
+int64_t timer_wheel_next_expiry(struct timer_wheel *wheel);
+
+#endif
@@ -1,7 +1,9 @@
 #include "types.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,13 +12,62 @@ string string_create(size_t size) {
   if (size <= SMALL_STRING_MAX_SIZE) {
     return (string){.small = {.is_small = true, .size = size}};
   }
+
+  if (size >= SHARED_STRING_MIN_SIZE) {
+    struct string_shared_data *shared = malloc(sizeof(*shared) + size);
+    assert(shared != NULL);
+    atomic_init(&shared->refs, 1);
+    return (string){
+        .heap = {
+            .is_small = false,
+            .is_shared = true,
+            .size = size,
+            .data = shared->data,
+        }};
+  }
+
   uint8_t *data = malloc(size);
   assert(data != NULL);
-  return (string){.heap = {.is_small = false, .size = size, .data = data}};
+  return (string){
+      .heap = {
+          .is_small = false,
+          .is_shared = false,
+          .size = size,
+          .data = data,
+      }};
+}
+
+static struct string_shared_data *string_shared_data(const string *str) {
+  assert(!str->is_small && str->heap.is_shared);
+  return container_of(str->heap.data, struct string_shared_data, data);
 }
 
 void string_destroy(string *str) {
-  if (!str->is_small) {
+  if (str->is_small) {
+    return;
+  }
+
+  if (str->heap.is_shared) {
+    string_shared_data_release(string_shared_data(str));
+  } else {
     free(str->heap.data);
   }
 }
+
+struct string_shared_data *string_share(const string *str) {
+  if (str->is_small || !str->heap.is_shared) {
+    return NULL;
+  }
+
+  struct string_shared_data *shared = string_shared_data(str);
+  // The caller already holds a reference through the string, so no ordering
+  // is needed
+  atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+  return shared;
+}
+
+void string_shared_data_release(struct string_shared_data *shared) {
+  if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) == 1) {
+    free(shared);
+  }
+}
@@ -2,7 +2,9 @@
 #define TYPES_H_
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -83,20 +85,42 @@ static inline bool slice_eq(
       memcmp(slice_a.data, slice_b.data, slice_a.size) == 0);
 }
 
-static inline ssize_t slice_index_of(struct const_slice slice, uint8_t byte) {
-  // Can't use strchr because it needs to consider the slice size
+/**
+ * Compare to a string of upper case letters, ignoring the case of the letters
+ * in `slice`
+ */
+static inline bool slice_eq_upper(
+    struct const_slice slice, struct const_slice upper) {
+  if (slice.size != upper.size) {
+    return false;
+  }
   for (size_t i = 0; i < slice.size; i++) {
-    if (const_slice_get(slice, i) == byte) {
-      return (ssize_t)i;
+    uint8_t byte = const_slice_get(slice, i);
+    uint8_t expected = const_slice_get(upper, i);
+    // Lower case letters only differ by this bit
+    if (byte != expected && byte != (expected | 0x20)) {
+      return false;
     }
   }
-  return -1;
+  return true;
+}
+
+static inline ssize_t slice_index_of(struct const_slice slice, uint8_t byte) {
+  // Can't use strchr because it needs to consider the slice size. memchr is
+  // vectorized by the C library.
+  if (slice.size == 0) {
+    return -1;
+  }
+  const void *found = memchr(slice.data, byte, slice.size);
+  return found == NULL ? -1 : (ssize_t)(found - slice.data);
 }
 
 /** Owned, heap-allocated string with associated length */
 struct heap_string {
   bool is_small : 1;
-  size_t size : sizeof(size_t) * 8 - 1;
+  // Data is part of a `struct string_shared_data`
+  bool is_shared : 1;
+  size_t size : sizeof(size_t) * 8 - 2;
   uint8_t *data;
 };
 
@@ -106,6 +130,9 @@ static_assert(
 
 enum {
   SMALL_STRING_MAX_SIZE = sizeof(struct heap_string) - 1,
+  // Strings at least this large are reference-counted. Below this, copying
+  // the data is cheaper than keeping track of references.
+  SHARED_STRING_MIN_SIZE = 16 * 1024,
 };
 
 struct small_str {
@@ -124,9 +151,29 @@ typedef union {
   struct small_str small;
 } string;
 
+/**
+ * Reference-counted allocation backing large strings, so that the data can be
+ * used (e.g. by a pending reply) after the string itself is destroyed.
+ *
+ * References may be released from any thread.
+ */
+struct string_shared_data {
+  atomic_uint refs;
+  uint8_t data[];
+};
+
 string string_create(size_t size);
 void string_destroy(string *str);
 
+/**
+ * Take a reference to the string's data, which stays valid until the
+ * reference is released.
+ *
+ * Returns NULL if the string's data isn't reference-counted.
+ */
+struct string_shared_data *string_share(const string *str);
+void string_shared_data_release(struct string_shared_data *shared);
+
 static inline size_t string_size(const string *str) {
   return str->is_small ? str->small.size : str->heap.size;
 }
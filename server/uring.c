@@ -0,0 +1,305 @@
+// Needed for MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+  MSEC_PER_SEC = 1000,
+  NSEC_PER_MSEC = 1000000,
+};
+
+static int sys_io_uring_setup(
+    unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(
+    int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+    const void *arg, size_t arg_size) {
+  return (int)syscall(
+      __NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg,
+      arg_size);
+}
+
+static int sys_io_uring_register(
+    int ring_fd, unsigned opcode, const void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *ring, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // Only the event loop thread submits, and completions are only processed
+  // when it enters the kernel anyway
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+
+  int ring_fd = sys_io_uring_setup(entries, &params);
+  if (ring_fd == -1) {
+    return -errno;
+  }
+
+  // Required for the single mmap below and waiting with a timeout
+  uint32_t required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+  if ((params.features & required_features) != required_features) {
+    close(ring_fd);
+    return -ENOSYS;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ring_mem_size = sq_size > cq_size ? sq_size : cq_size;
+  ring->ring_mem = mmap(
+      NULL, ring->ring_mem_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (ring->ring_mem == MAP_FAILED) {
+    int err = errno;
+    close(ring_fd);
+    return -err;
+  }
+
+  ring->sqes_mem_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(
+      NULL, ring->sqes_mem_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    int err = errno;
+    munmap(ring->ring_mem, ring->ring_mem_size);
+    close(ring_fd);
+    return -err;
+  }
+
+  uint8_t *mem = ring->ring_mem;
+  ring->fd = ring_fd;
+
+  ring->sq_entries = params.sq_entries;
+  ring->sq_mask = *(unsigned *)(mem + params.sq_off.ring_mask);
+  ring->sq_head = (unsigned *)(mem + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(mem + params.sq_off.tail);
+  ring->sqe_tail = *ring->sq_tail;
+
+  // Submission entries are always used in order, so the indirection array can
+  // be filled in once
+  unsigned *sq_array = (unsigned *)(mem + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    sq_array[i] = i;
+  }
+
+  ring->cq_mask = *(unsigned *)(mem + params.cq_off.ring_mask);
+  ring->cq_head = (unsigned *)(mem + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(mem + params.cq_off.tail);
+  ring->cqes = (struct io_uring_cqe *)(mem + params.cq_off.cqes);
+
+  return 0;
+}
+
+void uring_destroy(struct uring *ring) {
+  munmap(ring->sqes, ring->sqes_mem_size);
+  munmap(ring->ring_mem, ring->ring_mem_size);
+  close(ring->fd);
+}
+
+/** Make queued entries visible to the kernel, returning how many there are */
+static unsigned uring_flush(struct uring *ring) {
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  return ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sqe_tail - head >= ring->sq_entries) {
+    uring_submit_and_wait(ring, 0, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+      return NULL;
+    }
+  }
+
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring_submit_and_wait(
+    struct uring *ring, unsigned wait_nr, int timeout_ms) {
+  unsigned to_submit = uring_flush(ring);
+  unsigned flags = 0;
+  if (wait_nr > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (wait_nr > 0 && timeout_ms >= 0) {
+    timeout.tv_sec = timeout_ms / MSEC_PER_SEC;
+    timeout.tv_nsec = (long long)(timeout_ms % MSEC_PER_SEC) * NSEC_PER_MSEC;
+    arg.ts = (uint64_t)(uintptr_t)&timeout;
+  }
+  flags |= IORING_ENTER_EXT_ARG;
+
+  int res;
+  do {
+    res = sys_io_uring_enter(
+        ring->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+  } while (res == -1 && errno == EINTR && to_submit > 0);
+
+  if (res == -1) {
+    if (errno == ETIME || errno == EINTR || errno == EBUSY) {
+      return 0;
+    }
+    return -errno;
+  }
+  return res;
+}
+
+int uring_submit_and_poll(struct uring *ring) {
+  unsigned to_submit = uring_flush(ring);
+  // Getting events also runs the kernel's deferred completion work
+  int res = sys_io_uring_enter(
+      ring->fd, to_submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+  if (res == -1) {
+    if (errno == EINTR || errno == EBUSY) {
+      return 0;
+    }
+    return -errno;
+  }
+  return res;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(
+    struct io_uring_sqe *sqe, int fildes, uint64_t user_data) {
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fildes;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(
+    struct io_uring_sqe *sqe, int fildes, uint16_t buf_group,
+    uint64_t user_data) {
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fildes;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buf_group;
+  sqe->user_data = user_data;
+}
+
+void uring_prep_sendmsg(
+    struct io_uring_sqe *sqe, int fildes, const struct msghdr *msg,
+    uint64_t user_data) {
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fildes;
+  sqe->addr = (uint64_t)(uintptr_t)msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(
+    struct io_uring_sqe *sqe, uint64_t target_user_data, uint64_t user_data) {
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target_user_data;
+  sqe->user_data = user_data;
+}
+
+void uring_prep_read(
+    struct io_uring_sqe *sqe, int fildes, void *data, uint32_t size,
+    uint64_t user_data) {
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fildes;
+  sqe->addr = (uint64_t)(uintptr_t)data;
+  sqe->len = size;
+  // Read from the current position
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = user_data;
+}
+
+int uring_buf_ring_init(
+    struct uring *ring, struct uring_buf_ring *bufs, uint16_t group_id,
+    uint16_t count, uint32_t buf_size) {
+  // Count must be a power of 2
+  if (count == 0 || (count & (count - 1)) != 0) {
+    return -EINVAL;
+  }
+
+  bufs->ring_mem_size = sizeof(struct io_uring_buf) * count;
+  // The ring has to be page-aligned
+  bufs->ring = mmap(
+      NULL, bufs->ring_mem_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs->ring == MAP_FAILED) {
+    return -errno;
+  }
+
+  bufs->bufs = mmap(
+      NULL, (size_t)count * buf_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs->bufs == MAP_FAILED) {
+    int err = errno;
+    munmap(bufs->ring, bufs->ring_mem_size);
+    return -err;
+  }
+
+  bufs->count = count;
+  bufs->group_id = group_id;
+  bufs->buf_size = buf_size;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)bufs->ring;
+  reg.ring_entries = count;
+  reg.bgid = group_id;
+  int res =
+      sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+  if (res == -1) {
+    int err = errno;
+    munmap(bufs->bufs, (size_t)count * buf_size);
+    munmap(bufs->ring, bufs->ring_mem_size);
+    return -err;
+  }
+
+  bufs->ring->tail = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uring_buf_ring_recycle(bufs, i);
+  }
+  return 0;
+}
+
+void uring_buf_ring_recycle(struct uring_buf_ring *bufs, uint16_t buf_id) {
+  uint16_t tail = bufs->ring->tail;
+  struct io_uring_buf *buf = &bufs->ring->bufs[tail & (bufs->count - 1)];
+  buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_get(bufs, buf_id);
+  buf->len = bufs->buf_size;
+  buf->bid = buf_id;
+  __atomic_store_n(&bufs->ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,117 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Minimal io_uring wrapper using the raw system calls.
+ *
+ * Submissions are queued with `uring_get_sqe` and only handed to the kernel by
+ * `uring_submit_and_wait`, so everything queued during one loop iteration is
+ * submitted with a single system call.
+ */
+struct uring {
+  int fd;
+
+  unsigned sq_entries;
+  unsigned sq_mask;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  struct io_uring_sqe *sqes;
+  /** Local tail, including entries not yet visible to the kernel */
+  unsigned sqe_tail;
+
+  unsigned cq_mask;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  struct io_uring_cqe *cqes;
+
+  void *ring_mem;
+  size_t ring_mem_size;
+  size_t sqes_mem_size;
+};
+
+/** Returns 0 on success or a negative errno value. */
+int uring_init(struct uring *ring, unsigned entries);
+void uring_destroy(struct uring *ring);
+
+/**
+ * Get a submission entry to fill in, which is submitted by the next call to
+ * `uring_submit_and_wait`.
+ *
+ * If the submission queue is full, the pending entries are submitted first.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Submit all pending entries and wait for at least `wait_nr` completions, or
+ * until `timeout_ms` passes. A negative timeout waits forever.
+ *
+ * Returns the number of submitted entries or a negative errno value. Timeouts
+ * and interrupts are not reported as errors.
+ */
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr, int timeout_ms);
+/** Submit all pending entries and reap completions without waiting. */
+int uring_submit_and_poll(struct uring *ring);
+
+/** Get the next completion, or NULL if there are none available. */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+/** Mark the completion returned by `uring_peek_cqe` as consumed. */
+void uring_cqe_seen(struct uring *ring);
+
+void uring_prep_accept_multishot(
+    struct io_uring_sqe *sqe, int fildes, uint64_t user_data);
+void uring_prep_recv_multishot(
+    struct io_uring_sqe *sqe, int fildes, uint16_t buf_group,
+    uint64_t user_data);
+void uring_prep_sendmsg(
+    struct io_uring_sqe *sqe, int fildes, const struct msghdr *msg,
+    uint64_t user_data);
+/** Cancel the request submitted with `target_user_data` */
+void uring_prep_cancel(
+    struct io_uring_sqe *sqe, uint64_t target_user_data, uint64_t user_data);
+void uring_prep_read(
+    struct io_uring_sqe *sqe, int fildes, void *data, uint32_t size,
+    uint64_t user_data);
+
+/**
+ * Ring of fixed-size buffers registered with the kernel, which multishot
+ * receives pick from as data arrives.
+ */
+struct uring_buf_ring {
+  struct io_uring_buf_ring *ring;
+  size_t ring_mem_size;
+  uint16_t count;
+  uint16_t group_id;
+  uint32_t buf_size;
+  uint8_t *bufs;
+};
+
+/** Returns 0 on success or a negative errno value. */
+int uring_buf_ring_init(
+    struct uring *ring, struct uring_buf_ring *bufs, uint16_t group_id,
+    uint16_t count, uint32_t buf_size);
+
+static inline void *uring_buf_ring_get(
+    const struct uring_buf_ring *bufs, uint16_t buf_id) {
+  return bufs->bufs + (size_t)buf_id * bufs->buf_size;
+}
+
+/** Give a buffer back to the kernel once its data has been consumed. */
+void uring_buf_ring_recycle(struct uring_buf_ring *bufs, uint16_t buf_id);
+
+/** Buffer ID of a completion which used buffer selection */
+static inline bool uring_cqe_buf_id(
+    const struct io_uring_cqe *cqe, uint16_t *buf_id) {
+  if ((cqe->flags & IORING_CQE_F_BUFFER) == 0) {
+    return false;
+  }
+  *buf_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  return true;
+}
+
+#endif
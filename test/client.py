@@ -3,8 +3,10 @@ import itertools
 import math
 import re
 import socket
+import struct
 import time
-from collections.abc import Buffer, Iterator
+import typing
+from collections.abc import Buffer, Iterable, Iterator
 from types import TracebackType
 
 
@@ -17,12 +19,58 @@ class RespType(enum.Enum):
     SIMPLE_ERR = b"-"
     BLOB_STR = b"$"
     ARRAY = b"*"
+    STREAM_END = b"."
 
     @enum.property
     def byte(self) -> int:
         return self.value[0]
 
 
+class ReqType(enum.IntEnum):
+    """Command types sent by `BinaryClient` instead of their names"""
+
+    GET = 0
+    SET = 1
+    DEL = 2
+    KEYS = 3
+    TTL = 4
+    EXPIRE = 5
+    PERSIST = 6
+    HELLO = 7
+    TYPE = 8
+    MGET = 9
+    MSET = 10
+
+    HGET = 16
+    HSET = 17
+    HDEL = 18
+    HLEN = 19
+    HKEYS = 20
+    HGETALL = 21
+    HMGET = 22
+
+    SADD = 32
+    SISMEMBER = 33
+    SREM = 34
+    SCARD = 35
+    SRANDMEMBER = 36
+    SPOP = 37
+    SMEMBERS = 38
+    SMISMEMBER = 39
+
+    ZSCORE = 48
+    ZADD = 49
+    ZREM = 50
+    ZCARD = 51
+    ZRANK = 52
+    ZQUERY = 53
+
+    SHUTDOWN = 255
+
+
+# Count of binary arrays which end with a `STREAM_END` byte instead
+PROTO_SIZE_STREAMED = 0xFFFFFFFF
+
 ReqObject = int | float | str | bytes
 RespObject = None | int | float | bytes | list["RespObject"]
 
@@ -58,6 +106,30 @@ class NotEnoughData(Exception):
     pass
 
 
+def resp_serialize_req(buffer: bytearray, args: tuple[ReqObject, ...]):
+    resp_serialize_array_header(buffer, len(args))
+    for a in args:
+        resp_serialize_object(buffer, a)
+
+
+def bin_serialize_req(buffer: bytearray, args: tuple[ReqObject, ...]):
+    """The first argument is the `ReqType`. Numbers are sent in binary."""
+    req_type, *rest = args
+    assert isinstance(req_type, int)
+    frame = bytearray((req_type,))
+    for a in rest:
+        if isinstance(a, str):
+            a = a.encode()
+        elif isinstance(a, int):
+            a = struct.pack("<q", a)
+        elif isinstance(a, float):
+            a = struct.pack("<d", a)
+        frame.extend(struct.pack("<I", len(a)))
+        frame.extend(a)
+    buffer.extend(struct.pack("<I", len(frame)))
+    buffer.extend(frame)
+
+
 def resp_serialize_array_header(buffer: bytearray, arr_len: int):
     buffer.extend(RespType.ARRAY.value)
     buffer.extend(f"{arr_len}\r\n".encode())
@@ -127,9 +199,28 @@ def parse_blob_str(buffer: memoryview) -> tuple[bytes, memoryview]:
     return bytes(buffer[:str_len]), skip_crlr(buffer[str_len:])
 
 
+def parse_array_stream(
+    buffer: memoryview,
+) -> tuple[list[RespObject] | ResponseError, Buffer]:
+    arr: list[RespObject] = []
+    while True:
+        if len(buffer) == 0:
+            raise NotEnoughData
+        if buffer[0] == RespType.STREAM_END.byte:
+            return arr, skip_crlr(buffer[1:])
+        elem, buffer = try_parse_object(buffer)
+        if isinstance(elem, ResponseError):
+            return elem, buffer
+        arr.append(elem)
+
+
 def parse_array(buffer: Buffer) -> tuple[list[RespObject] | ResponseError, Buffer]:
+    buffer = memoryview(buffer)
+    if len(buffer) > 0 and buffer[0] == ord("?"):
+        return parse_array_stream(skip_crlr(buffer[1:]))
+
     # TODO: Store partial array in parser so array can be read incrementally
-    arr_len, buffer = parse_number(memoryview(buffer))
+    arr_len, buffer = parse_number(buffer)
     if arr_len < 0:
         raise ParseError("invalid array length")
 
@@ -181,14 +272,82 @@ def try_parse_object(buffer: Buffer) -> tuple[RespObject | ResponseError, Buffer
             raise ParseError(f"Invalid response type: {bytes((type_byte,))}")
 
 
+def bin_unpack(fmt: str, buffer: memoryview) -> tuple[typing.Any, memoryview]:
+    size = struct.calcsize(fmt)
+    if len(buffer) < size:
+        raise NotEnoughData
+    return struct.unpack_from(fmt, buffer)[0], buffer[size:]
+
+
+def parse_bin_str(buffer: memoryview) -> tuple[bytes, memoryview]:
+    str_len, buffer = bin_unpack("<I", buffer)
+    if len(buffer) < str_len:
+        raise NotEnoughData
+    return bytes(buffer[:str_len]), buffer[str_len:]
+
+
+def try_parse_bin_object(
+    buffer: Buffer,
+) -> tuple[RespObject | ResponseError, Buffer]:
+    buffer = memoryview(buffer)
+    if len(buffer) == 0:
+        raise NotEnoughData
+
+    type_byte = buffer[0]
+    buffer = buffer[1:]
+    match type_byte:
+        case RespType.NULL.byte:
+            return None, buffer
+        case RespType.BOOLEAN.byte:
+            val, buffer = bin_unpack("<B", buffer)
+            return val != 0, buffer
+        case RespType.NUMBER.byte:
+            return bin_unpack("<q", buffer)
+        case RespType.DOUBLE.byte:
+            return bin_unpack("<d", buffer)
+        case RespType.SIMPLE_STR.byte | RespType.BLOB_STR.byte:
+            return parse_bin_str(buffer)
+        case RespType.SIMPLE_ERR.byte:
+            msg, buffer = parse_bin_str(buffer)
+            return ResponseError(msg), buffer
+        case RespType.ARRAY.byte:
+            arr_len, buffer = bin_unpack("<I", buffer)
+            arr: list[RespObject] = []
+            while True:
+                if arr_len == PROTO_SIZE_STREAMED:
+                    if len(buffer) == 0:
+                        raise NotEnoughData
+                    if buffer[0] == RespType.STREAM_END.byte:
+                        return arr, buffer[1:]
+                elif len(arr) == arr_len:
+                    return arr, buffer
+                elem, buffer = try_parse_bin_object(buffer)
+                if isinstance(elem, ResponseError):
+                    return elem, buffer
+                arr.append(elem)
+        case _:
+            raise ParseError(f"Invalid response type: {bytes((type_byte,))}")
+
+
+def connect_unix(path: str, timeout: float | None) -> socket.socket:
+    conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        conn.settimeout(timeout)
+        conn.connect(path)
+    except OSError:
+        conn.close()
+        raise
+    return conn
+
+
 def retry_for_connection(
-    address: tuple[str | None, int],
+    address: tuple[str | None, int] | str,
     timeout: float | None,
     *,
     poll_interval: float = 0.01,
 ) -> socket.socket:
     """Wrapper around `socket.create_connection` which waits for the server to
-    accept connections."""
+    accept connections. String addresses are Unix socket paths."""
     start_time = time.perf_counter()
     if timeout is not None:
         end_time = start_time + timeout
@@ -205,8 +364,10 @@ def retry_for_connection(
             remaining = None
 
         try:
+            if isinstance(address, str):
+                return connect_unix(address, remaining)
             return socket.create_connection(address, timeout=remaining)
-        except ConnectionRefusedError:
+        except (ConnectionRefusedError, FileNotFoundError):
             time.sleep(poll_interval)
 
 
@@ -215,29 +376,47 @@ class Client:
     recv_buf: bytearray
     recv_len: int
 
+    serialize_req = staticmethod(resp_serialize_req)
+    parse_object = staticmethod(try_parse_object)
+    shutdown_cmd: ReqObject = b"SHUTDOWN"
+
     def __init__(
-        self, host: str = "127.0.0.1", port: int = 1234, *, timeout: float | None = None
+        self,
+        host: str = "127.0.0.1",
+        port: int = 1234,
+        *,
+        timeout: float | None = None,
+        unix_path: str | None = None,
     ):
-        self.conn = retry_for_connection((host, port), timeout=timeout)
+        address = (host, port) if unix_path is None else unix_path
+        self.conn = retry_for_connection(address, timeout=timeout)
         self.recv_buf = bytearray(4096)
         self.recv_len = 0
 
     def send_req(self, *args: ReqObject):
         """Send a single request, but don't wait for the response."""
         buffer = bytearray()
-        resp_serialize_array_header(buffer, len(args))
-        for a in args:
-            resp_serialize_object(buffer, a)
+        self.serialize_req(buffer, args)
 
         print("sending", buffer)
         self.conn.sendall(buffer)
 
+    def send_reqs(self, reqs: Iterable[tuple[ReqObject, ...]]):
+        """Send multiple requests in a single write, but don't wait for the
+        responses."""
+        buffer = bytearray()
+        for args in reqs:
+            self.serialize_req(buffer, args)
+
+        print("sending", len(buffer), "bytes")
+        self.conn.sendall(buffer)
+
     def recv_resp(self) -> RespObject:
         """Receive a single response."""
         # TODO: Reduce the amount of copies
         while True:
             try:
-                resp_obj, rest = try_parse_object(
+                resp_obj, rest = self.parse_object(
                     memoryview(self.recv_buf)[: self.recv_len]
                 )
                 # Reset the buffers after a good parse
@@ -267,7 +446,7 @@ class Client:
     def send_shutdown(self):
         """This needs some special handling since the server won't send a response."""
         try:
-            val = self.send(b"SHUTDOWN")
+            val = self.send(self.shutdown_cmd)
         except UnexpectedEofError:
             return
         raise ProtocolError("Unexpected response from SHUTDOWN command", val)
@@ -287,6 +466,26 @@ class Client:
         self.close()
 
 
+class BinaryClient(Client):
+    """Client for the binary protocol, which sends a `ReqType` instead of the
+    command name."""
+
+    shutdown_cmd = ReqType.SHUTDOWN
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        # Switch with a RESP request, the reply is already binary
+        buffer = bytearray()
+        resp_serialize_req(buffer, ("HELLO", "BINARY"))
+        self.conn.sendall(buffer)
+        val = self.recv_resp()
+        if val != [b"proto", 4]:
+            raise ProtocolError("Unexpected response from HELLO", val)
+
+    serialize_req = staticmethod(bin_serialize_req)
+    parse_object = staticmethod(try_parse_bin_object)
+
+
 def resp_object_pairs(val: RespObject) -> Iterator[tuple[RespObject, RespObject]]:
     assert isinstance(val, list)
     for group in itertools.batched(val, 2):
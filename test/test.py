@@ -5,11 +5,16 @@ from contextlib import redirect_stdout
 from dataclasses import dataclass
 
 # Import these for side effect
+import test_backend
 import test_basic
+import test_binary
 import test_hash
+import test_limits
+import test_listen
 import test_set
+import test_sharded
 import test_sorted_set
-from test_util import Server, all_tests
+from test_util import Server, all_tests, get_server_args
 
 
 @dataclass
@@ -40,6 +45,9 @@ class TestResult:
 
 
 def main():
+    # Extra arguments are passed to the server for every test
+    extra_server_args = tuple(sys.argv[1:])
+
     passed: list[TestResult] = []
     failed: list[TestResult] = []
     for test_fn in all_tests:
@@ -49,7 +57,8 @@ def main():
             exc = None
             try:
                 with redirect_stdout(saved_output):
-                    with Server() as server:
+                    args = extra_server_args + get_server_args(test_fn)
+                    with Server(args) as server:
                         test_fn(server)
                 success = True
                 print("PASS")
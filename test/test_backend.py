@@ -0,0 +1,70 @@
+import random
+
+from client import Client
+from test_util import client_test, server_args
+
+URING = ("-b", "io_uring")
+
+
+@server_args(*URING)
+@client_test
+def test_uring_set_and_get_large_value(c: Client):
+    # Larger than all of the registered receive buffers combined
+    large_value = random.randbytes(2_000_000)
+    _ = c.send("SET", "abc", large_value)
+    val = c.send("GET", "abc")
+    assert val == large_value
+
+
+@server_args(*URING)
+@client_test
+def test_uring_pipeline_10_000_commands(c: Client):
+    n = 10_000
+
+    for i in range(n):
+        c.send_req("SET", f"key:{i}", f"value:{i}")
+    for i in range(n):
+        c.send_req("GET", f"key:{i}")
+
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == b"OK"
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == f"value:{i}".encode("ascii")
+
+
+@server_args(*URING, "-t", "4")
+@client_test
+def test_uring_sharded_keys(c: Client):
+    keys = {f"key:{i}".encode("ascii") for i in range(100)}
+    for k in keys:
+        _ = c.send("SET", k, "value")
+
+    val = c.send("KEYS")
+    assert isinstance(val, list)
+    assert set(val) == keys
+
+
+@server_args("-P", "-c", "0")
+@client_test
+def test_busy_poll_pipeline(c: Client):
+    n = 1_000
+
+    c.send_reqs([("SET", f"key:{i}", f"value:{i}") for i in range(n)])
+    for i in range(n):
+        assert c.recv_resp() == b"OK"
+
+    for i in range(n):
+        assert c.send("GET", f"key:{i}") == f"value:{i}".encode("ascii")
+
+
+@server_args("-P", "-t", "2", "-c", "0,0,0")
+@client_test
+def test_busy_poll_sharded_keys(c: Client):
+    n = 100
+
+    for i in range(n):
+        assert c.send("SET", f"key:{i}", f"value:{i}") == b"OK"
+    for i in range(n):
+        assert c.send("GET", f"key:{i}") == f"value:{i}".encode("ascii")
@@ -1,8 +1,14 @@
 import random
+import struct
 import time
 
-from client import Client
-from test_util import client_test
+from client import (
+    Client,
+    ResponseError,
+    resp_serialize_array_header,
+    resp_serialize_object,
+)
+from test_util import Server, client_test, server_test
 
 
 @client_test
@@ -11,6 +17,33 @@ def test_keys_empty_on_startup(c: Client):
     assert val == []
 
 
+@client_test
+def test_hello_switches_protocol_version(c: Client):
+    val = c.send("HELLO", 3)
+    assert val == [b"proto", 3]
+    val = c.send("HELLO", 2)
+    assert val == [b"proto", 2]
+
+    try:
+        _ = c.send("HELLO", 4)
+    except ResponseError as e:
+        assert e.message == b"unsupported protocol version"
+        return
+    assert False, "Expected ResponseError"
+
+
+@client_test
+def test_keys_streamed_after_hello(c: Client):
+    keys = {f"key:{i}".encode("ascii") for i in range(100)}
+    for k in keys:
+        _ = c.send("SET", k, "value")
+
+    _ = c.send("HELLO", 3)
+    val = c.send("KEYS")
+    assert isinstance(val, list)
+    assert set(val) == keys
+
+
 @client_test
 def test_get_not_exist_returns_error(c: Client):
     val = c.send("GET", "abc")
@@ -42,6 +75,51 @@ def test_set_and_get_large_value(c: Client):
     assert val == large_value
 
 
+@client_test
+def test_set_large_value_sent_in_chunks(c: Client):
+    large_value = random.randbytes(3_000_000)
+    req = bytearray()
+    resp_serialize_array_header(req, 3)
+    for arg in (b"SET", b"abc", large_value):
+        resp_serialize_object(req, arg)
+    # Followed by another request in the same write as the end of the value
+    resp_serialize_array_header(req, 2)
+    for arg in (b"GET", b"abc"):
+        resp_serialize_object(req, arg)
+
+    chunk_size = 100_000
+    for i in range(0, len(req), chunk_size):
+        c.conn.sendall(req[i : i + chunk_size])
+        time.sleep(0.001)
+
+    assert c.recv_resp() == b"OK"
+    assert c.recv_resp() == large_value
+
+
+@client_test
+def test_get_large_value_then_replace_in_same_batch(c: Client):
+    first = random.randbytes(1_000_000)
+    second = random.randbytes(500_000)
+    _ = c.send("SET", "abc", first)
+
+    # The reply to the first GET may still be pending when the value is
+    # replaced and deleted
+    c.send_reqs(
+        [
+            ("GET", "abc"),
+            ("SET", "abc", second),
+            ("GET", "abc"),
+            ("DEL", "abc"),
+            ("GET", "abc"),
+        ]
+    )
+    assert c.recv_resp() == first
+    assert c.recv_resp() == b"OK"
+    assert c.recv_resp() == second
+    assert c.recv_resp() == 1
+    assert c.recv_resp() is None
+
+
 @client_test
 def test_del_returns_0_if_not_present(c: Client):
     val = c.send("DEL", "abc")
@@ -82,6 +160,38 @@ def test_pipeline_set_get_commands(c: Client):
     assert val == b"value"
 
 
+@client_test
+def test_pipeline_batch_in_single_write(c: Client):
+    n = 1_000
+
+    # More requests than are handled at once before flushing
+    reqs = [("SET", f"key:{i}", f"value:{i}") for i in range(n)]
+    reqs += [("GET", f"key:{i}") for i in range(n)]
+    c.send_reqs(reqs)
+
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == b"OK"
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == f"value:{i}".encode("ascii")
+
+
+@client_test
+def test_pipeline_partial_request_after_batch(c: Client):
+    c.send_reqs([("SET", "abc", "value"), ("GET", "abc")])
+    # Split a request across writes after the batch
+    c.conn.sendall(b"*2\r\n$3\r\nGET")
+    val = c.recv_resp()
+    assert val == b"OK"
+    val = c.recv_resp()
+    assert val == b"value"
+
+    c.conn.sendall(b"\r\n$3\r\nabc\r\n")
+    val = c.recv_resp()
+    assert val == b"value"
+
+
 @client_test
 def test_set_get_del_10_000_keys(c: Client):
     n = 10_000
@@ -156,6 +266,17 @@ def test_key_expires_soon_after_expiration_time(c: Client):
     assert val is None
 
 
+@server_test
+def test_key_expires_without_connected_clients(server: Server):
+    with server.make_client() as c:
+        _ = c.send("SET", "expired", "temporary")
+        _ = c.send("EXPIRE", "expired", 1)
+    time.sleep(1.0 + TTL_EPSILON / 1000.0)
+    with server.make_client() as c:
+        val = c.send("KEYS")
+        assert val == []
+
+
 @client_test
 def test_key_does_not_expire_if_ttl_changed_before_old_ttl(c: Client):
     _ = c.send("SET", "not-expired", "still-there")
@@ -194,3 +315,69 @@ def test_type_is_string_if_key_is_numeric_string(c: Client):
     _ = c.send("SET", "string-key", "1234")
     val = c.send("TYPE", "string-key")
     assert val == b"string"
+
+
+@client_test
+def test_mset_then_mget(c: Client):
+    val = c.send("MSET", "a", "1", "b", "2", "c", "3")
+    assert val == b"OK"
+    _ = c.send("SADD", "set", "member")
+
+    # Missing keys and other types are null
+    val = c.send("MGET", "a", "missing", "c", "set", "b")
+    assert val == [b"1", None, b"3", None, b"2"]
+
+
+@client_test
+def test_del_returns_count_of_deleted_keys(c: Client):
+    _ = c.send("MSET", "a", "1", "b", "2")
+    val = c.send("DEL", "a", "missing", "b", "a")
+    assert val == 2
+    val = c.send("MGET", "a", "b")
+    assert val == [None, None]
+
+
+@client_test
+def test_variadic_wrong_arg_count_returns_error(c: Client):
+    try:
+        _ = c.send("MSET", "a", "1", "b")
+    except ResponseError as e:
+        assert e.message == b"not enough arguments"
+        return
+    assert False, "Expected ResponseError"
+
+
+@client_test
+def test_mset_many_keys_in_one_request(c: Client):
+    n = 2_000
+    # Some values are large enough to be received into their own allocation
+    values = {
+        f"key:{i}": random.randbytes(100_000) if i % 500 == 0 else f"value:{i}"
+        for i in range(n)
+    }
+    args = [arg for pair in values.items() for arg in pair]
+    val = c.send("MSET", *args)
+    assert val == b"OK"
+
+    val = c.send("MGET", *values.keys())
+    assert isinstance(val, list)
+    assert val == [v if isinstance(v, bytes) else v.encode() for v in values.values()]
+
+
+@client_test
+def test_commands_ignore_case(c: Client):
+    val = c.send("set", "key", "value")
+    assert val == b"OK"
+    val = c.send("Get", "key")
+    assert val == b"value"
+    try:
+        _ = c.send("gets", "key")
+    except ResponseError as e:
+        assert e.message == b"invalid command"
+    else:
+        assert False, "Expected ResponseError"
+
+    c.send_req("hello", "binary")
+    assert c.conn.recv(4096) == (
+        b"*\x02\x00\x00\x00$\x05\x00\x00\x00proto:" + struct.pack("<q", 4)
+    )
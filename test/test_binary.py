@@ -0,0 +1,126 @@
+import random
+import struct
+
+from client import ReqType
+from test_util import Server, expect_error, server_args, server_test
+
+
+@server_test
+def test_binary_set_get_del(server: Server):
+    with server.make_binary_client() as c:
+        assert c.send(ReqType.GET, "key") is None
+        assert c.send(ReqType.SET, "key", "value") == b"OK"
+        assert c.send(ReqType.GET, "key") == b"value"
+        assert c.send(ReqType.DEL, "key") == 1
+        assert c.send(ReqType.GET, "key") is None
+
+
+@server_test
+def test_binary_numbers_are_native(server: Server):
+    with server.make_binary_client() as c:
+        assert c.send(ReqType.ZADD, "scores", 1.5, "a") == 1
+        assert c.send(ReqType.ZADD, "scores", -2.25, "b") == 1
+        assert c.send(ReqType.ZSCORE, "scores", "a") == 1.5
+        assert c.send(ReqType.ZRANK, "scores", "a") == 1
+
+        # Numeric arguments have to be binary
+        c.send_req(ReqType.ZADD, "scores", b"1.5", "c")
+        expect_error(c, b"invalid score")
+
+        assert c.send(ReqType.SET, "key", "value") == b"OK"
+        assert c.send(ReqType.EXPIRE, "key", 100) == 1
+        ttl = c.send(ReqType.TTL, "key")
+        assert isinstance(ttl, int) and 0 < ttl <= 100
+
+
+@server_test
+def test_binary_zquery_streams_results(server: Server):
+    with server.make_binary_client() as c:
+        for i in range(10):
+            _ = c.send(ReqType.ZADD, "numbers", float(i), str(i))
+
+        c.send_req(ReqType.ZQUERY, "numbers", 4.2, "", 1, 2)
+        data = c.conn.recv(4096)
+        assert data == (
+            b"*\xff\xff\xff\xff"
+            + b"$\x01\x00\x00\x006"
+            + b","
+            + struct.pack("<d", 6.0)
+            + b"$\x01\x00\x00\x007"
+            + b","
+            + struct.pack("<d", 7.0)
+            + b"."
+        )
+
+        items = c.send(ReqType.ZQUERY, "numbers", 0.0, "", 8, 100)
+        assert items == [b"8", 8.0, b"9", 9.0]
+
+
+@server_test
+def test_binary_variadic_commands(server: Server):
+    with server.make_binary_client() as c:
+        assert c.send(ReqType.MSET, "a", "1", "b", "2") == b"OK"
+        assert c.send(ReqType.MGET, "a", "missing", "b") == [b"1", None, b"2"]
+        assert c.send(ReqType.ZADD, "scores", 1.0, "x", 2.0, "y") == 2
+        assert c.send(ReqType.SADD, "set", "x", "y", "z") == 3
+        assert c.send(ReqType.SMISMEMBER, "set", "x", "w") == [1, 0]
+
+
+@server_test
+def test_binary_errors(server: Server):
+    with server.make_binary_client() as c:
+        c.send_reqs([(200,), (ReqType.GET,), (ReqType.HELLO, "5")])
+        expect_error(c, b"invalid command")
+        expect_error(c, b"not enough arguments")
+        expect_error(c, b"unsupported protocol version")
+        # Still usable afterwards
+        assert c.send(ReqType.SET, "key", "value") == b"OK"
+
+
+@server_test
+def test_binary_invalid_frame_closes_connection(server: Server):
+    with server.make_binary_client() as c:
+        # Argument sizes go past the end of the frame
+        c.conn.sendall(b"\x06\x00\x00\x00\x00\x05\x00\x00\x00k")
+        assert c.conn.recv(4096) == b""
+
+
+@server_test
+def test_binary_large_values(server: Server):
+    with server.make_binary_client() as c:
+        value = random.randbytes(1024 * 1024)
+        c.send_reqs([(ReqType.SET, "big", value), (ReqType.GET, "big")])
+        assert c.recv_resp() == b"OK"
+        assert c.recv_resp() == value
+
+
+@server_test
+def test_binary_pipelined_after_hello(server: Server):
+    with server.make_binary_client() as c:
+        n = 500
+        c.send_reqs([(ReqType.SET, f"key:{i}", i) for i in range(n)])
+        for _ in range(n):
+            assert c.recv_resp() == b"OK"
+
+        c.send_reqs([(ReqType.GET, f"key:{i}") for i in range(n)])
+        for i in range(n):
+            assert c.recv_resp() == struct.pack("<q", i)
+
+        # Switch back, which is still sent as text
+        c.send_req(ReqType.HELLO, "2")
+        assert c.conn.recv(4096) == b"*2\r\n$5\r\nproto\r\n:2\r\n"
+
+
+@server_args("-t", "4")
+@server_test
+def test_binary_sharded_keys(server: Server):
+    with server.make_binary_client() as c:
+        keys = {f"key:{i}".encode() for i in range(100)}
+        for k in keys:
+            assert c.send(ReqType.SET, k, "value") == b"OK"
+        for k in keys:
+            assert c.send(ReqType.GET, k) == b"value"
+
+        val = c.send(ReqType.KEYS)
+        assert isinstance(val, list)
+        assert set(val) == keys
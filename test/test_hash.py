@@ -1,3 +1,5 @@
+import random
+
 from client import Client, ResponseError, resp_object_dict
 from test_util import client_test
 
@@ -25,6 +27,15 @@ def test_type_is_hash_after_hset(c: Client):
     assert val == b"hash"
 
 
+@client_test
+def test_hget_returns_large_value_after_hset(c: Client):
+    large_value = random.randbytes(1_000_000)
+    val = c.send("HSET", "abc", "field", large_value)
+    assert val == 1
+    val = c.send("HGET", "abc", "field")
+    assert val == large_value
+
+
 @client_test
 def test_hget_missing_key(c: Client):
     val = c.send("HGET", "map", "field")
@@ -195,3 +206,28 @@ def test_get_returns_nil_after_deleting_hash(c: Client):
 
     val = c.send("GET", "map")
     assert val is None
+
+
+@client_test
+def test_hset_many_fields_returns_count_of_new(c: Client):
+    val = c.send("HSET", "map", "a", "1", "b", "2")
+    assert val == 2
+    val = c.send("HSET", "map", "b", "3", "c", "4")
+    assert val == 1
+    val = c.send("HMGET", "map", "a", "b", "c", "missing")
+    assert val == [b"1", b"3", b"4", None]
+
+
+@client_test
+def test_hmget_missing_key(c: Client):
+    val = c.send("HMGET", "missing", "a", "b")
+    assert val == [None, None]
+
+
+@client_test
+def test_hdel_many_fields(c: Client):
+    _ = c.send("HSET", "map", "a", "1", "b", "2", "c", "3")
+    val = c.send("HDEL", "map", "a", "c", "missing")
+    assert val == 2
+    val = c.send("HLEN", "map")
+    assert val == 1
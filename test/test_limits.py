@@ -0,0 +1,118 @@
+import random
+import time
+
+from client import Client, ResponseError
+from test_util import Server, client_test, expect_error, server_args, server_test
+
+VALUE_SIZE = 100_000
+
+
+def recv_until_closed(c: Client) -> int:
+    """Read raw data until the server closes the connection, returning how much
+    was received. Replies aren't parsed or printed since they can be large."""
+    total = 0
+    while True:
+        try:
+            chunk = c.conn.recv(1 << 16)
+        except ConnectionResetError:
+            return total
+        if len(chunk) == 0:
+            return total
+        total += len(chunk)
+
+
+@server_args("-o", "64k,0,0")
+@client_test
+def test_output_hard_limit_closes_connection(c: Client):
+    value = random.randbytes(VALUE_SIZE)
+    assert c.send("SET", "key", value) == b"OK"
+    assert c.send("SET", "small", "value") == b"OK"
+    assert c.send("GET", "small") == b"value"
+
+    c.send_req("GET", "key")
+    assert recv_until_closed(c) == 0
+
+
+@server_args("-o", "0,64k,1")
+@client_test
+def test_output_soft_limit_closes_slow_reader(c: Client):
+    n = 300
+    value = random.randbytes(VALUE_SIZE)
+    assert c.send("SET", "key", value) == b"OK"
+    # Briefly going over the limit is fine
+    assert c.send("GET", "key") == value
+
+    # Stop reading while the replies pile up
+    c.send_reqs([("GET", "key")] * n)
+    time.sleep(2)
+    assert recv_until_closed(c) < n * VALUE_SIZE
+
+
+@server_args("-q", "64k")
+@client_test
+def test_query_limit_closes_connection(c: Client):
+    assert c.send("SET", "key", "value") == b"OK"
+
+    try:
+        c.send_req("SET", "key", random.randbytes(VALUE_SIZE))
+    except (BrokenPipeError, ConnectionResetError):
+        return
+    assert recv_until_closed(c) == 0
+
+
+@server_args("-m", "2")
+@server_test
+def test_max_clients_rejects_connections(server: Server):
+    with server.make_client() as a, server.make_client() as b:
+        assert a.send("SET", "key", "value") == b"OK"
+        assert b.send("GET", "key") == b"value"
+        with server.make_client() as c:
+            expect_error(c, b"max number of clients reached")
+
+    # Closing the others makes room, once the server has noticed
+    for _ in range(100):
+        with server.make_client() as c:
+            try:
+                assert c.send("GET", "key") == b"value"
+                return
+            except ResponseError:
+                time.sleep(0.01)
+    assert False, "Expected a free client slot"
+
+
+def send_burst(c: Client, n: int) -> int:
+    """Pipeline `n` large SETs, returning how many were shed. Once shedding
+    starts, it holds for the rest of the burst."""
+    value = random.randbytes(VALUE_SIZE)
+    c.send_reqs([("SET", f"key{i}", value) for i in range(n)])
+
+    busy = 0
+    for _ in range(n):
+        try:
+            assert c.recv_resp() == b"OK"
+            assert busy == 0, "Expected shedding to hold"
+        except ResponseError as e:
+            assert e.message == b"BUSY server is overloaded"
+            busy += 1
+    return busy
+
+
+@server_args("-L", "1")
+@client_test
+def test_overloaded_loop_sheds_requests(c: Client):
+    n = 2000
+    # Keep the loop busy until it notices
+    for _ in range(10):
+        busy = send_burst(c, n)
+        if busy > 0:
+            break
+    assert busy > 0
+
+    # The loop recovers a while after it has caught up
+    for _ in range(300):
+        try:
+            assert c.send("SET", "key", "value") == b"OK"
+            return
+        except ResponseError:
+            time.sleep(0.01)
+    assert False, "Expected the server to recover"
@@ -0,0 +1,44 @@
+import os
+import stat
+import tempfile
+
+from client import Client
+from test_util import Server, server_args, server_test
+
+# The default address is still needed for the test harness
+DEFAULT_ADDR = ("-l", "127.0.0.1:1234")
+UNIX_PATH = os.path.join(tempfile.gettempdir(), f"test-server-{os.getpid()}.sock")
+
+
+@server_args(*DEFAULT_ADDR, "-l", "127.0.0.1:1235", "-l", "[::1]:1236")
+@server_test
+def test_listen_on_multiple_tcp_addresses(_server: Server):
+    with Client(port=1235, timeout=5) as c:
+        assert c.send("SET", "key", "value") == b"OK"
+    with Client("::1", 1236, timeout=5) as c:
+        assert c.send("GET", "key") == b"value"
+
+
+@server_args(*DEFAULT_ADDR, "-u", f"{UNIX_PATH},600")
+@server_test
+def test_listen_on_unix_socket(server: Server):
+    with Client(unix_path=UNIX_PATH, timeout=5) as c:
+        assert c.send("SET", "key", "value") == b"OK"
+    assert stat.S_IMODE(os.stat(UNIX_PATH).st_mode) == 0o600
+    with server.make_client() as c:
+        assert c.send("GET", "key") == b"value"
+
+
+@server_args(*DEFAULT_ADDR, "-u", UNIX_PATH, "-t", "4")
+@server_test
+def test_unix_socket_shared_by_shards(_server: Server):
+    n = 20
+    clients = [Client(unix_path=UNIX_PATH, timeout=5) for _ in range(n)]
+    try:
+        for i, c in enumerate(clients):
+            assert c.send("SET", f"key:{i}", f"value:{i}") == b"OK"
+        for i, c in enumerate(clients):
+            assert c.send("GET", f"key:{(i + 1) % n}") == f"value:{(i + 1) % n}".encode()
+    finally:
+        for c in clients:
+            c.close()
@@ -272,3 +272,26 @@ def test_spop_returns_all_elements_when_called_repeatedly(c: Client):
     assert isinstance(val2, bytes)
 
     assert {val1, val2} == {b"key1", b"key2"}
+
+
+@client_test
+def test_sadd_srem_many_members(c: Client):
+    members = [f"member:{i}" for i in range(1_000)]
+    val = c.send("SADD", "set", *members, "member:0")
+    assert val == len(members)
+    val = c.send("SCARD", "set")
+    assert val == len(members)
+
+    val = c.send("SREM", "set", *members[:10], "missing")
+    assert val == 10
+    val = c.send("SCARD", "set")
+    assert val == len(members) - 10
+
+
+@client_test
+def test_smismember(c: Client):
+    _ = c.send("SADD", "set", "a", "c")
+    val = c.send("SMISMEMBER", "set", "a", "b", "c")
+    assert val == [1, 0, 1]
+    val = c.send("SMISMEMBER", "missing", "a", "b")
+    assert val == [0, 0]
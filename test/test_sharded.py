@@ -0,0 +1,181 @@
+import random
+import socket
+
+from client import Client, ReqObject, ResponseError
+from test_util import Server, client_test, server_args, server_test
+
+SHARDS = ("-t", "4")
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_set_get_del_1_000_keys(c: Client):
+    n = 1_000
+
+    for i in range(n):
+        c.send_req("SET", f"key:{i}", f"value:{i}")
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == b"OK"
+
+    for i in range(n):
+        c.send_req("GET", f"key:{i}")
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == f"value:{i}".encode("ascii")
+
+    for i in range(n):
+        c.send_req("DEL", f"key:{i}")
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == 1
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_pipeline_keeps_reply_order(c: Client):
+    n = 500
+
+    # Mix of local and forwarded requests in a single batch
+    reqs: list[tuple[ReqObject, ...]] = []
+    for i in range(n):
+        reqs.append(("SET", f"key:{i}", f"value:{i}"))
+        reqs.append(("GET", f"key:{i}"))
+    reqs.append(("KEYS",))
+    c.send_reqs(reqs)
+
+    for i in range(n):
+        val = c.recv_resp()
+        assert val == b"OK"
+        val = c.recv_resp()
+        assert val == f"value:{i}".encode("ascii")
+    val = c.recv_resp()
+    assert isinstance(val, list)
+    assert len(val) == n
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_large_values(c: Client):
+    values = {f"key:{i}": random.randbytes(100_000) for i in range(20)}
+    c.send_reqs([("SET", k, v) for k, v in values.items()])
+    for _ in values:
+        assert c.recv_resp() == b"OK"
+
+    c.send_reqs([("GET", k) for k in values])
+    for v in values.values():
+        assert c.recv_resp() == v
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_keys_empty(c: Client):
+    val = c.send("KEYS")
+    assert val == []
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_keys_includes_all_shards(c: Client):
+    keys = {f"key:{i}".encode("ascii") for i in range(100)}
+    for k in keys:
+        _ = c.send("SET", k, "value")
+
+    val = c.send("KEYS")
+    assert isinstance(val, list)
+    assert len(val) == len(keys)
+    assert set(val) == keys
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_keys_streamed_after_hello(c: Client):
+    keys = {f"key:{i}".encode("ascii") for i in range(100)}
+    for k in keys:
+        _ = c.send("SET", k, "value")
+
+    _ = c.send("HELLO", 3)
+    c.send_req("KEYS")
+    data = b""
+    while not data.endswith(b".\r\n"):
+        chunk = c.conn.recv(4096)
+        assert len(chunk) > 0
+        data += chunk
+    # A single merged array, not one per shard
+    assert data.startswith(b"*?\r\n")
+    assert data.count(b"*") == 1
+    assert data.count(b"$") == len(keys)
+
+    _ = c.send("HELLO", 2)
+    val = c.send("KEYS")
+    assert isinstance(val, list)
+    assert set(val) == keys
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_hash_values(c: Client):
+    for i in range(100):
+        _ = c.send("HSET", f"hash:{i % 10}", f"field:{i}", i)
+
+    for i in range(10):
+        val = c.send("HLEN", f"hash:{i}")
+        assert val == 10
+
+    val = c.send("HGET", "hash:3", "field:53")
+    assert val == b"53"
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_invalid_command_returns_error(c: Client):
+    try:
+        _ = c.send("NOT-A-COMMAND", "abc")
+    except ResponseError as e:
+        assert e.message == b"invalid command"
+        return
+    assert False, "Expected ResponseError"
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_multi_key_on_different_shards_returns_error(c: Client):
+    keys = [f"key:{i}" for i in range(20)]
+    try:
+        _ = c.send("MGET", *keys)
+    except ResponseError as e:
+        assert e.message.startswith(b"CROSSSHARD")
+        return
+    assert False, "Expected ResponseError"
+
+
+@server_args(*SHARDS)
+@client_test
+def test_sharded_multi_key_with_hash_tag(c: Client):
+    keys = [f"{{user:1}}:{i}" for i in range(20)]
+    val = c.send("MSET", *[arg for k in keys for arg in (k, k)])
+    assert val == b"OK"
+    val = c.send("MGET", *keys)
+    assert val == [k.encode() for k in keys]
+    val = c.send("DEL", *keys)
+    assert val == len(keys)
+
+    # Single keys work wherever they are
+    for i in range(20):
+        _ = c.send("SET", f"key:{i}", "value")
+    for i in range(20):
+        val = c.send("DEL", f"key:{i}")
+        assert val == 1
+
+
+@server_args(*SHARDS, "-b", "io_uring")
+@server_test
+def test_sharded_uring_client_closes_with_pending_replies(server: Server):
+    # The replies from other shards arrive after the client has gone away
+    for _ in range(500):
+        with server.make_client() as c:
+            c.send_reqs([("GET", f"key:{i}") for i in range(20)])
+            c.conn.shutdown(socket.SHUT_WR)
+
+    with server.make_client() as c:
+        assert c.send("SET", "key", "value") == b"OK"
@@ -234,6 +234,32 @@ def test_zquery_with_score_from_middle(c: Client):
     ]
 
 
+def recv_raw_stream(c: Client) -> bytes:
+    """Receive a streamed reply without parsing it"""
+    data = b""
+    while not data.endswith(b".\r\n"):
+        chunk = c.conn.recv(4096)
+        assert len(chunk) > 0
+        data += chunk
+    return data
+
+
+@client_test
+def test_zquery_streamed_after_hello(c: Client):
+    create_numbers_set(c, "numbers", 10)
+    _ = c.send("HELLO", 3)
+
+    c.send_req("ZQUERY", "numbers", 4.2, "", 1, 2)
+    assert recv_raw_stream(c) == b"*?\r\n$1\r\n6\r\n,6\r\n$1\r\n7\r\n,7\r\n.\r\n"
+
+    items = c.send("ZQUERY", "numbers", 0.0, "", 8, 100)
+    assert items == [b"8", 8.0, b"9", 9.0]
+    items = c.send("ZQUERY", "numbers", 0.0, "", 10, 100)
+    assert items == []
+    items = c.send("ZQUERY", "numbers", 3.0, "", 0, 0)
+    assert items == []
+
+
 @client_test
 def test_zadd_zscore_del_10_000_keys(c: Client):
     n = 10_000
@@ -252,3 +278,30 @@ def test_zadd_zscore_del_10_000_keys(c: Client):
 
     val = c.send("DEL", "scores")
     assert val == 1
+
+
+@client_test
+def test_zadd_zrem_many_members(c: Client):
+    val = c.send("ZADD", "scores", 1, "a", 2, "b", 3, "c")
+    assert val == 3
+    val = c.send("ZADD", "scores", 5, "a", 4, "d")
+    assert val == 1
+    val = c.send("ZSCORE", "scores", "a")
+    assert val == 5.0
+
+    val = c.send("ZREM", "scores", "a", "b", "missing")
+    assert val == 2
+    val = c.send("ZCARD", "scores")
+    assert val == 2
+
+
+@client_test
+def test_zadd_nothing_added_if_any_score_invalid(c: Client):
+    try:
+        _ = c.send("ZADD", "scores", 1, "a", "nope", "b")
+    except ResponseError as e:
+        assert e.message == b"invalid score"
+        val = c.send("ZCARD", "scores")
+        assert val == 0
+        return
+    assert False, "Expected ResponseError"
@@ -1,14 +1,17 @@
 import functools
+import socket
 import subprocess
 import tempfile
+import time
 import typing
 from pathlib import Path
 from types import TracebackType
 
-from client import Client, ClientError
+from client import BinaryClient, Client, ClientError, ResponseError
 
 root_dir = Path(__file__).parent.parent
-run_command = (root_dir / "bin" / "server",)
+# Log everything to help debugging failed tests
+run_command = (str(root_dir / "bin" / "server"), "-v", "debug")
 
 
 class ServerProc:
@@ -30,6 +33,25 @@ class ServerProc:
         )
 
 
+def wait_until_not_listening(
+    address: tuple[str, int], timeout: float = 5, *, poll_interval: float = 0.01
+):
+    """With io_uring, the listening socket can stay open for a moment after the
+    process exited. Connections made to it in the meantime are reset, so the
+    next server must not be tested before it's gone."""
+    end_time = time.perf_counter() + timeout
+    while time.perf_counter() < end_time:
+        try:
+            with socket.create_connection(address, timeout=poll_interval):
+                pass
+        except ConnectionResetError:
+            # Closed while connecting
+            pass
+        except (ConnectionRefusedError, TimeoutError):
+            return
+        time.sleep(poll_interval)
+
+
 def read_all_and_close(file: typing.IO[bytes]) -> str:
     try:
         with file:
@@ -46,12 +68,12 @@ class Server:
     stderr_file: typing.IO[bytes]
     stderr_data: str | None = None
 
-    def __init__(self):
+    def __init__(self, args: tuple[str, ...] = ()):
         self.stdout_file = tempfile.TemporaryFile()
         self.stderr_file = tempfile.TemporaryFile()
 
         self.process = subprocess.Popen(
-            run_command,
+            run_command + args,
             cwd=root_dir,
             stdin=subprocess.DEVNULL,
             # Use temp files to capture output as pipes can fill up if there is too
@@ -76,14 +98,19 @@ class Server:
             pass
 
         try:
-            return self.process.wait(timeout=1)
+            exit_code = self.process.wait(timeout=1)
         except subprocess.TimeoutExpired:
             self.process.kill()
-            return self.process.wait()
+            exit_code = self.process.wait()
+        wait_until_not_listening(("127.0.0.1", 1234))
+        return exit_code
 
     def make_client(self) -> Client:
         return Client(timeout=5)
 
+    def make_binary_client(self) -> BinaryClient:
+        return BinaryClient(timeout=5)
+
     def __enter__(self):
         return self
 
@@ -136,3 +163,29 @@ def client_test(test_fn: ClientTestFn) -> TestFn:
 
     all_tests.append(wrapper)
     return wrapper
+
+
+def server_args(*args: str) -> typing.Callable[[TestFn], TestFn]:
+    """Annotation for running a test with extra server arguments.
+
+    This must be applied after (above) `server_test` or `client_test`."""
+
+    def decorator(test_fn: TestFn) -> TestFn:
+        setattr(test_fn, "server_args", args)
+        return test_fn
+
+    return decorator
+
+
+def get_server_args(test_fn: TestFn) -> tuple[str, ...]:
+    return getattr(test_fn, "server_args", ())
+
+
+def expect_error(c: Client, message: bytes):
+    """Receive the next reply, which must be an error with this message."""
+    try:
+        c.recv_resp()
+    except ResponseError as e:
+        assert e.message == message
+        return
+    assert False, "Expected ResponseError"